@@ -35,6 +35,8 @@
 
 #include "gi.h"
 #include "gi/object.h"
+#include "gi/function.h"
+#include "gi/boxed.h"
 
 #include <modules/modules.h>
 
@@ -44,6 +46,11 @@
 
 #include <string.h>
 
+#ifdef G_OS_UNIX
+#include <glib-unix.h>
+#include <signal.h>
+#endif
+
 static void     gjs_context_dispose           (GObject               *object);
 static void     gjs_context_finalize          (GObject               *object);
 static void     gjs_context_constructed       (GObject               *object);
@@ -98,6 +105,23 @@ enum {
 static GMutex contexts_lock;
 static GList *all_contexts = NULL;
 
+#ifdef G_OS_UNIX
+/* Set GJS_WRAPPER_STATS_FILE to a file name (or "-" for stderr) to
+ * have the per-GType wrapper counters written there on SIGUSR2 */
+static guint wrapper_stats_signal_id = 0;
+
+static gboolean
+dump_wrapper_stats_on_signal(gpointer data)
+{
+    const char *filename = g_getenv("GJS_WRAPPER_STATS_FILE");
+
+    if (filename != NULL)
+        gjs_object_dump_type_stats(filename);
+
+    return TRUE;
+}
+#endif
+
 static JSBool
 gjs_log(JSContext *context,
         unsigned   argc,
@@ -339,6 +363,11 @@ gjs_context_dispose(GObject *object)
                   "Destroying JS context");
 
         JS_BeginRequest(js_context->context);
+        /* Drop the async callbacks still waiting for the idle
+         * handler, so that their JS functions can be collected below
+         */
+        gjs_callback_trampoline_reclaim_all();
+
         /* Do a full GC here before tearing down, since once we do
          * that we may not have the JS_GetPrivate() to access the
          * context
@@ -356,6 +385,8 @@ gjs_context_dispose(GObject *object)
 
         /* Tear down JS */
         JS_DestroyContext(js_context->context);
+        gjs_boxed_release_free_lists(js_context->runtime);
+        gjs_callback_trampoline_release_pool();
         js_context->context = NULL;
         js_context->runtime = NULL;
     }
@@ -458,6 +489,11 @@ gjs_context_constructed(GObject *object)
     g_mutex_lock (&contexts_lock);
     all_contexts = g_list_prepend(all_contexts, object);
     g_mutex_unlock (&contexts_lock);
+
+#ifdef G_OS_UNIX
+    if (wrapper_stats_signal_id == 0 && g_getenv("GJS_WRAPPER_STATS_FILE") != NULL)
+        wrapper_stats_signal_id = g_unix_signal_add(SIGUSR2, dump_wrapper_stats_on_signal, NULL);
+#endif
 }
 
 static void
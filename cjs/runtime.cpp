@@ -26,10 +26,35 @@
 #include "compat.h"
 #include "runtime.h"
 
+/* Past this many entries, interned strings are converted without being
+ * cached until the next GC empties the cache */
+#define GJS_INTERNED_UTF8_MAX_ENTRIES 1024
+
 struct RuntimeData {
   JSBool in_gc_sweep;
+
+  /* Bumped every time a GC starts sweeping */
+  guint gc_generation;
+
+  /* JSString atom -> UTF-8 copy, see gjs_runtime_lookup_interned_utf8() */
+  GHashTable *interned_utf8;
+
+  /* SweepCallback, see gjs_runtime_add_sweep_callback() */
+  GArray *sweep_callbacks;
+
+  /* see gjs_runtime_get_wrapper_table() */
+  GHashTable *wrapper_tables[GJS_N_WRAPPER_TABLES];
+
+  /* see gjs_runtime_get_data() */
+  gpointer data[GJS_N_RUNTIME_DATA];
+  GDestroyNotify data_destroy[GJS_N_RUNTIME_DATA];
 };
 
+typedef struct {
+  GjsSweepFunc func;
+  gpointer data;
+} SweepCallback;
+
 JSBool
 gjs_runtime_is_sweeping (JSRuntime *runtime)
 {
@@ -38,6 +63,161 @@ gjs_runtime_is_sweeping (JSRuntime *runtime)
   return data->in_gc_sweep;
 }
 
+/* Caches keyed by the address of atoms or other GC things can compare
+ * this against the value they were filled in under, and throw their
+ * entries away when it has changed, since a swept key's address may
+ * have been reused since. */
+guint
+gjs_runtime_get_gc_generation (JSRuntime *runtime)
+{
+  RuntimeData *data = (RuntimeData*) JS_GetRuntimePrivate(runtime);
+
+  return data->gc_generation;
+}
+
+/**
+ * gjs_runtime_add_sweep_callback:
+ * @runtime: a #JSRuntime
+ * @func: function to call
+ * @data: data for @func
+ *
+ * Has @func called whenever a garbage collection of @runtime starts
+ * sweeping, before any object is finalized. Weak tables can use
+ * JS_IsAboutToBeFinalized() there to drop the entries of dead objects.
+ */
+void
+gjs_runtime_add_sweep_callback(JSRuntime    *runtime,
+                               GjsSweepFunc  func,
+                               gpointer      data)
+{
+  RuntimeData *rtdata = (RuntimeData*) JS_GetRuntimePrivate(runtime);
+  SweepCallback callback = { func, data };
+
+  g_array_append_val(rtdata->sweep_callbacks, callback);
+}
+
+/**
+ * gjs_runtime_get_wrapper_table:
+ * @runtime: a #JSRuntime
+ * @which: the table to get
+ *
+ * Returns: the table that the owner of @which stored with
+ * gjs_runtime_set_wrapper_table(), or %NULL if there is none yet.
+ */
+GHashTable *
+gjs_runtime_get_wrapper_table(JSRuntime       *runtime,
+                              GjsWrapperTable  which)
+{
+  RuntimeData *rtdata = (RuntimeData*) JS_GetRuntimePrivate(runtime);
+
+  return rtdata->wrapper_tables[which];
+}
+
+/**
+ * gjs_runtime_set_wrapper_table:
+ * @runtime: a #JSRuntime
+ * @which: the table to set
+ * @table: (transfer full): the table
+ *
+ * Stores @table for @runtime. It is unreffed when @runtime is
+ * destroyed.
+ */
+void
+gjs_runtime_set_wrapper_table(JSRuntime       *runtime,
+                              GjsWrapperTable  which,
+                              GHashTable      *table)
+{
+  RuntimeData *rtdata = (RuntimeData*) JS_GetRuntimePrivate(runtime);
+
+  g_assert(rtdata->wrapper_tables[which] == NULL);
+  rtdata->wrapper_tables[which] = table;
+}
+
+/**
+ * gjs_runtime_get_data:
+ * @runtime: a #JSRuntime
+ * @slot: the data to get
+ *
+ * Returns: what was stored in @slot with gjs_runtime_set_data(), or
+ * %NULL
+ */
+gpointer
+gjs_runtime_get_data(JSRuntime          *runtime,
+                     GjsRuntimeDataSlot  slot)
+{
+  RuntimeData *rtdata = (RuntimeData*) JS_GetRuntimePrivate(runtime);
+
+  return rtdata->data[slot];
+}
+
+/**
+ * gjs_runtime_set_data:
+ * @runtime: a #JSRuntime
+ * @slot: the data to set
+ * @data: the data
+ * @destroy: (allow-none): called on @data when @runtime is destroyed
+ *
+ * Stores @data in @slot of @runtime, which must be empty.
+ */
+void
+gjs_runtime_set_data(JSRuntime          *runtime,
+                     GjsRuntimeDataSlot  slot,
+                     gpointer            data,
+                     GDestroyNotify      destroy)
+{
+  RuntimeData *rtdata = (RuntimeData*) JS_GetRuntimePrivate(runtime);
+
+  g_assert(rtdata->data[slot] == NULL);
+  rtdata->data[slot] = data;
+  rtdata->data_destroy[slot] = destroy;
+}
+
+/**
+ * gjs_runtime_lookup_interned_utf8:
+ * @context: a #JSContext
+ * @str: a JS string
+ * @utf8_p: return location for the UTF-8 form of @str
+ *
+ * Looks up the UTF-8 form of @str if it is an interned (atomized)
+ * string, such as a string literal or a property name, converting and
+ * caching it on first use. *@utf8_p is set to %NULL for other strings,
+ * which should be converted with gjs_string_to_utf8() as usual.
+ *
+ * Atoms are matched by address, so the cache is emptied whenever a
+ * garbage collection starts sweeping. The returned string belongs to
+ * the cache and must be copied if it is needed after JS code may have
+ * run again.
+ *
+ * Returns: %JS_FALSE if converting @str threw an exception
+ */
+JSBool
+gjs_runtime_lookup_interned_utf8(JSContext   *context,
+                                 JSString    *str,
+                                 const char **utf8_p)
+{
+    RuntimeData *data = (RuntimeData*) JS_GetRuntimePrivate(JS_GetRuntime(context));
+    char *utf8;
+
+    *utf8_p = NULL;
+
+    if (!JS_StringHasBeenInterned(context, str))
+        return JS_TRUE;
+
+    utf8 = (char *) g_hash_table_lookup(data->interned_utf8, str);
+    if (utf8 == NULL) {
+        if (g_hash_table_size(data->interned_utf8) >= GJS_INTERNED_UTF8_MAX_ENTRIES)
+            return JS_TRUE;
+
+        if (!gjs_string_to_utf8(context, STRING_TO_JSVAL(str), &utf8))
+            return JS_FALSE;
+
+        g_hash_table_insert(data->interned_utf8, str, utf8);
+    }
+
+    *utf8_p = utf8;
+    return JS_TRUE;
+}
+
 /* Implementations of locale-specific operations; these are used
  * in the implementation of String.localeCompare(), Date.toLocaleDateString(),
  * and so forth. We take the straight-forward approach of converting
@@ -151,9 +331,23 @@ destroy_runtime(gpointer data)
 {
     JSRuntime *runtime = (JSRuntime *) data;
     RuntimeData *rtdata = (RuntimeData *) JS_GetRuntimePrivate(runtime);
+    int i;
 
-    g_free(rtdata);
+    /* The last GC runs our finalize callback and finalizers, which
+     * still use rtdata */
     JS_DestroyRuntime(runtime);
+
+    for (i = 0; i < GJS_N_WRAPPER_TABLES; i++) {
+        if (rtdata->wrapper_tables[i] != NULL)
+            g_hash_table_unref(rtdata->wrapper_tables[i]);
+    }
+    for (i = 0; i < GJS_N_RUNTIME_DATA; i++) {
+        if (rtdata->data[i] != NULL && rtdata->data_destroy[i] != NULL)
+            rtdata->data_destroy[i](rtdata->data[i]);
+    }
+    g_hash_table_destroy(rtdata->interned_utf8);
+    g_array_free(rtdata->sweep_callbacks, TRUE);
+    g_free(rtdata);
 }
 
 static GPrivate thread_runtime = G_PRIVATE_INIT(destroy_runtime);
@@ -173,6 +367,7 @@ gjs_finalize_callback(JSFreeOp         *fop,
 {
   JSRuntime *runtime;
   RuntimeData *data;
+  guint i;
 
   runtime = fop->runtime();
   data = (RuntimeData*) JS_GetRuntimePrivate(runtime);
@@ -217,9 +412,19 @@ gjs_finalize_callback(JSFreeOp         *fop,
      code, so we can probably rely on this behavior.
   */
 
-  if (status == JSFINALIZE_GROUP_START)
+  if (status == JSFINALIZE_GROUP_START) {
     data->in_gc_sweep = JS_TRUE;
-  else if (status == JSFINALIZE_GROUP_END)
+    data->gc_generation++;
+
+    /* Atoms that are about to be swept may still be keys here, and
+       their addresses could be reused by unrelated strings */
+    g_hash_table_remove_all(data->interned_utf8);
+
+    for (i = 0; i < data->sweep_callbacks->len; i++) {
+      SweepCallback *callback = &g_array_index(data->sweep_callbacks, SweepCallback, i);
+      callback->func(runtime, callback->data);
+    }
+  } else if (status == JSFINALIZE_GROUP_END)
     data->in_gc_sweep = JS_FALSE;
 }
 
@@ -235,6 +440,8 @@ gjs_runtime_for_current_thread(void)
             g_error("Failed to create javascript runtime");
 
         data = g_new0(RuntimeData, 1);
+        data->interned_utf8 = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+        data->sweep_callbacks = g_array_new(FALSE, FALSE, sizeof(SweepCallback));
         JS_SetRuntimePrivate(runtime, data);
 
         JS_SetNativeStackQuota(runtime, 1024*1024);
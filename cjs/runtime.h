@@ -24,8 +24,45 @@
 #ifndef __GJS_RUNTIME_H__
 #define __GJS_RUNTIME_H__
 
+typedef void (*GjsSweepFunc) (JSRuntime *runtime,
+                              gpointer   data);
+
+/* Native object -> JSObject tables, one of each per runtime */
+typedef enum {
+  GJS_WRAPPER_TABLE_OBJECT,
+  GJS_WRAPPER_TABLE_FUNDAMENTAL,
+  GJS_N_WRAPPER_TABLES
+} GjsWrapperTable;
+
+/* Other per-runtime state of subsystems */
+typedef enum {
+  GJS_RUNTIME_DATA_BOXED_FREE_LISTS,
+  GJS_N_RUNTIME_DATA
+} GjsRuntimeDataSlot;
+
 JSRuntime * gjs_runtime_for_current_thread (void);
 
 JSBool      gjs_runtime_is_sweeping        (JSRuntime *runtime);
+guint       gjs_runtime_get_gc_generation  (JSRuntime *runtime);
+void        gjs_runtime_add_sweep_callback (JSRuntime    *runtime,
+                                            GjsSweepFunc  func,
+                                            gpointer      data);
+
+GHashTable *gjs_runtime_get_wrapper_table  (JSRuntime       *runtime,
+                                            GjsWrapperTable  which);
+void        gjs_runtime_set_wrapper_table  (JSRuntime       *runtime,
+                                            GjsWrapperTable  which,
+                                            GHashTable      *table);
+
+gpointer    gjs_runtime_get_data           (JSRuntime          *runtime,
+                                            GjsRuntimeDataSlot  slot);
+void        gjs_runtime_set_data           (JSRuntime          *runtime,
+                                            GjsRuntimeDataSlot  slot,
+                                            gpointer            data,
+                                            GDestroyNotify      destroy);
+
+JSBool      gjs_runtime_lookup_interned_utf8 (JSContext   *context,
+                                              JSString    *str,
+                                              const char **utf8_p);
 
 #endif /* __GJS_RUNTIME_H__ */
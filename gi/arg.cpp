@@ -38,6 +38,48 @@
 #include <cjs/compat.h>
 
 #include <util/log.h>
+#include <util/misc.h>
+#include <util/arena.h>
+
+#include <jsfriendapi.h>
+#include <string.h>
+
+/* Whether numeric C arrays are returned to JS as typed arrays rather
+ * than as plain arrays; -1 until GJS_TYPED_ARRAY_RESULTS is checked */
+static int typed_array_results = -1;
+
+/* Turned on for the calls made by the function passed to
+ * System.withTypedArrayResults(), and off again for JS called back
+ * from C while it runs, see gjs_set_typed_array_results_scope() */
+static gboolean typed_array_results_scope = FALSE;
+
+void
+gjs_set_typed_array_results(gboolean enabled)
+{
+    typed_array_results = enabled ? 1 : 0;
+}
+
+/* Returns the previous value, to be restored when the scope ends */
+gboolean
+gjs_set_typed_array_results_scope(gboolean enabled)
+{
+    gboolean previous = typed_array_results_scope;
+
+    typed_array_results_scope = enabled;
+    return previous;
+}
+
+gboolean
+gjs_get_typed_array_results(void)
+{
+    if (typed_array_results_scope)
+        return TRUE;
+
+    if (G_UNLIKELY(typed_array_results < 0))
+        typed_array_results = gjs_environment_variable_is_set("GJS_TYPED_ARRAY_RESULTS") ? 1 : 0;
+
+    return typed_array_results;
+}
 
 JSBool
 _gjs_flags_value_is_valid(JSContext   *context,
@@ -278,12 +320,12 @@ gjs_array_to_g_list(JSContext   *context,
                     GSList     **slist_p)
 {
     guint32 i;
-    GList *list;
-    GSList *slist;
+    GList *list, *list_tail;
+    GSList *slist, *slist_tail;
     jsval elem;
 
-    list = NULL;
-    slist = NULL;
+    list = list_tail = NULL;
+    slist = slist_tail = NULL;
 
     if (transfer == GI_TRANSFER_CONTAINER) {
         if (type_needs_release (param_info, g_type_info_get_tag(param_info))) {
@@ -326,18 +368,32 @@ gjs_array_to_g_list(JSContext   *context,
             return JS_FALSE;
         }
 
+        /* Append through the tail pointers, rather than prepending
+         * and reversing at the end */
         if (list_type == GI_TYPE_TAG_GLIST) {
             /* GList */
-            list = g_list_prepend(list, elem_arg.v_pointer);
+            GList *node = g_list_alloc();
+
+            node->data = elem_arg.v_pointer;
+            node->prev = list_tail;
+            if (list_tail)
+                list_tail->next = node;
+            else
+                list = node;
+            list_tail = node;
         } else {
             /* GSList */
-            slist = g_slist_prepend(slist, elem_arg.v_pointer);
+            GSList *node = g_slist_alloc();
+
+            node->data = elem_arg.v_pointer;
+            if (slist_tail)
+                slist_tail->next = node;
+            else
+                slist = node;
+            slist_tail = node;
         }
     }
 
-    list = g_list_reverse(list);
-    slist = g_slist_reverse(slist);
-
     *list_p = list;
     *slist_p = slist;
 
@@ -507,6 +563,91 @@ gjs_array_to_strv(JSContext   *context,
     return JS_TRUE;
 }
 
+/* Like gjs_string_to_utf8(), but the result is allocated from @arena
+ * and must not be freed. Interned strings are copied from the runtime's
+ * cache of their UTF-8 form; other strings are encoded from UTF-16
+ * directly into the arena, except for the rare ones with unpaired
+ * surrogates that go through gjs_string_to_utf8() so that they are
+ * handled the same way.
+ */
+JSBool
+gjs_string_to_utf8_in_arena(JSContext  *context,
+                            jsval       value,
+                            GjsArena   *arena,
+                            char      **utf8_string_p)
+{
+    const jschar *chars;
+    const char *interned;
+    size_t n_chars, i;
+    gsize len;
+    char *bytes, *p;
+
+    if (!JSVAL_IS_STRING(value)) {
+        gjs_throw(context,
+                  "Value is not a string, cannot convert to UTF-8");
+        return JS_FALSE;
+    }
+
+    if (!gjs_runtime_lookup_interned_utf8(context, JSVAL_TO_STRING(value), &interned))
+        return JS_FALSE;
+
+    if (interned != NULL) {
+        len = strlen(interned) + 1;
+        *utf8_string_p = (char *) memcpy(gjs_arena_alloc(arena, len), interned, len);
+        return JS_TRUE;
+    }
+
+    chars = JS_GetStringCharsAndLength(context, JSVAL_TO_STRING(value), &n_chars);
+    if (chars == NULL)
+        return JS_FALSE;
+
+    len = 0;
+    for (i = 0; i < n_chars; i++) {
+        jschar c = chars[i];
+
+        if (c < 0x80) {
+            len += 1;
+        } else if (c < 0x800) {
+            len += 2;
+        } else if (c >= 0xD800 && c <= 0xDBFF &&
+                   i + 1 < n_chars && chars[i + 1] >= 0xDC00 && chars[i + 1] <= 0xDFFF) {
+            len += 4;
+            i++;
+        } else if (c >= 0xD800 && c <= 0xDFFF) {
+            char *tmp;
+
+            if (!gjs_string_to_utf8(context, value, &tmp))
+                return JS_FALSE;
+            len = strlen(tmp) + 1;
+            *utf8_string_p = (char *) memcpy(gjs_arena_alloc(arena, len), tmp, len);
+            g_free(tmp);
+            return JS_TRUE;
+        } else {
+            len += 3;
+        }
+    }
+
+    bytes = p = (char *) gjs_arena_alloc(arena, len + 1);
+    for (i = 0; i < n_chars; i++) {
+        gunichar c = chars[i];
+
+        if (c < 0x80) {
+            *p++ = c;
+            continue;
+        }
+
+        if (c >= 0xD800 && c <= 0xDBFF) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (chars[i + 1] - 0xDC00);
+            i++;
+        }
+        p += g_unichar_to_utf8(c, p);
+    }
+    *p = '\0';
+
+    *utf8_string_p = bytes;
+    return JS_TRUE;
+}
+
 static JSBool
 gjs_string_to_intarray(JSContext   *context,
                        jsval        string_val,
@@ -545,6 +686,125 @@ gjs_string_to_intarray(JSContext   *context,
     }
 }
 
+static gboolean
+typed_array_has_element_type(JSObject  *obj,
+                             GITypeTag  element_type)
+{
+    JSArrayBufferViewType view_type;
+
+    if (!JS_IsTypedArrayObject(obj))
+        return FALSE;
+
+    view_type = JS_GetArrayBufferViewType(obj);
+
+    switch (element_type) {
+    case GI_TYPE_TAG_INT8:
+        return view_type == js::ArrayBufferView::TYPE_INT8;
+    case GI_TYPE_TAG_UINT8:
+        return view_type == js::ArrayBufferView::TYPE_UINT8 ||
+            view_type == js::ArrayBufferView::TYPE_UINT8_CLAMPED;
+    case GI_TYPE_TAG_INT16:
+        return view_type == js::ArrayBufferView::TYPE_INT16;
+    case GI_TYPE_TAG_UINT16:
+        return view_type == js::ArrayBufferView::TYPE_UINT16;
+    case GI_TYPE_TAG_INT32:
+        return view_type == js::ArrayBufferView::TYPE_INT32;
+    case GI_TYPE_TAG_UINT32:
+        return view_type == js::ArrayBufferView::TYPE_UINT32;
+    case GI_TYPE_TAG_FLOAT:
+        return view_type == js::ArrayBufferView::TYPE_FLOAT32;
+    case GI_TYPE_TAG_DOUBLE:
+        return view_type == js::ArrayBufferView::TYPE_FLOAT64;
+    default:
+        return FALSE;
+    }
+}
+
+/* Returns the element type of a C array argument whose contents can be
+ * taken straight from a typed array's storage, or GI_TYPE_TAG_VOID if
+ * it has to be converted. Zero-terminated arrays need an extra element
+ * that a typed array doesn't have. */
+GITypeTag
+gjs_array_get_borrowable_element_type(GITypeInfo *type_info)
+{
+    GITypeInfo *param_info;
+    GITypeTag element_type;
+
+    if (g_type_info_get_tag(type_info) != GI_TYPE_TAG_ARRAY ||
+        g_type_info_get_array_type(type_info) != GI_ARRAY_TYPE_C ||
+        g_type_info_is_zero_terminated(type_info))
+        return GI_TYPE_TAG_VOID;
+
+    param_info = g_type_info_get_param_type(type_info, 0);
+    element_type = g_type_info_get_tag(param_info);
+    g_base_info_unref((GIBaseInfo*) param_info);
+
+    switch (element_type) {
+    case GI_TYPE_TAG_INT8:
+    case GI_TYPE_TAG_UINT8:
+    case GI_TYPE_TAG_INT16:
+    case GI_TYPE_TAG_UINT16:
+    case GI_TYPE_TAG_INT32:
+    case GI_TYPE_TAG_UINT32:
+    case GI_TYPE_TAG_FLOAT:
+    case GI_TYPE_TAG_DOUBLE:
+        return element_type;
+    default:
+        return GI_TYPE_TAG_VOID;
+    }
+}
+
+/* If @value is a typed array of @element_type holding at least
+ * @fixed_size elements (when that is not -1), points *data_p at its
+ * storage without copying. The storage stays owned by @value, so this
+ * is only safe for (transfer none) arguments while @value is rooted.
+ */
+gboolean
+gjs_typed_array_peek_data(jsval       value,
+                          GITypeTag   element_type,
+                          gint        fixed_size,
+                          gpointer   *data_p,
+                          gsize      *length_p)
+{
+    JSObject *obj;
+    guint32 length;
+
+    if (!JSVAL_IS_OBJECT(value) || JSVAL_IS_NULL(value))
+        return FALSE;
+
+    obj = JSVAL_TO_OBJECT(value);
+    if (!typed_array_has_element_type(obj, element_type))
+        return FALSE;
+
+    length = JS_GetTypedArrayLength(obj);
+    if (fixed_size >= 0 && length < (guint32) fixed_size)
+        return FALSE;
+
+    *data_p = JS_GetArrayBufferViewData(obj);
+    *length_p = length;
+    return TRUE;
+}
+
+/* Copies the contents of a typed array of @element_type into @result,
+ * which has room for @length elements of @element_size bytes. */
+static gboolean
+copy_from_typed_array(jsval       array_value,
+                      GITypeTag   element_type,
+                      unsigned    length,
+                      gsize       element_size,
+                      void       *result)
+{
+    JSObject *obj = JSVAL_TO_OBJECT(array_value);
+
+    if (!typed_array_has_element_type(obj, element_type) ||
+        JS_GetTypedArrayLength(obj) < length)
+        return FALSE;
+
+    if (length > 0)
+        memcpy(result, JS_GetArrayBufferViewData(obj), length * element_size);
+    return TRUE;
+}
+
 static JSBool
 gjs_array_to_intarray(JSContext   *context,
                       jsval        array_value,
@@ -556,11 +816,28 @@ gjs_array_to_intarray(JSContext   *context,
     /* nasty union types in an attempt to unify the various int types */
     union { guint32 u; gint32 i; } intval;
     void *result;
+    GITypeTag element_type;
     unsigned i;
 
     /* add one so we're always zero terminated */
     result = g_malloc0((length+1) * intsize);
 
+    switch (intsize) {
+    case 1:
+        element_type = is_signed ? GI_TYPE_TAG_INT8 : GI_TYPE_TAG_UINT8; break;
+    case 2:
+        element_type = is_signed ? GI_TYPE_TAG_INT16 : GI_TYPE_TAG_UINT16; break;
+    case 4:
+        element_type = is_signed ? GI_TYPE_TAG_INT32 : GI_TYPE_TAG_UINT32; break;
+    default:
+        g_assert_not_reached();
+    }
+
+    if (copy_from_typed_array(array_value, element_type, length, intsize, result)) {
+        *arr_p = result;
+        return JS_TRUE;
+    }
+
     for (i = 0; i < length; ++i) {
         jsval elem;
         JSBool success;
@@ -661,6 +938,15 @@ gjs_array_to_floatarray(JSContext   *context,
     /* add one so we're always zero terminated */
     result = g_malloc0((length+1) * (is_double ? sizeof(double) : sizeof(float)));
 
+    if (copy_from_typed_array(array_value,
+                              is_double ? GI_TYPE_TAG_DOUBLE : GI_TYPE_TAG_FLOAT,
+                              length,
+                              is_double ? sizeof(double) : sizeof(float),
+                              result)) {
+        *arr_p = result;
+        return JS_TRUE;
+    }
+
     for (i = 0; i < length; ++i) {
         jsval elem;
         double val;
@@ -1969,6 +2255,73 @@ gjs_value_to_explicit_array (JSContext  *context,
                                                 length_p);
 }
 
+/* How the pointer elements of a list or hash table are converted to JS;
+ * decided once per container instead of going through the full type
+ * switch in gjs_value_from_g_argument() for every element. */
+typedef enum {
+    POINTER_ELEMENT_GENERIC,
+    POINTER_ELEMENT_UTF8,
+    POINTER_ELEMENT_OBJECT
+} PointerElementKind;
+
+static PointerElementKind
+get_pointer_element_kind(GITypeInfo *param_info)
+{
+    GIBaseInfo *interface_info;
+    GIInfoType interface_type;
+
+    switch (g_type_info_get_tag(param_info)) {
+    case GI_TYPE_TAG_UTF8:
+        return POINTER_ELEMENT_UTF8;
+    case GI_TYPE_TAG_INTERFACE:
+        interface_info = g_type_info_get_interface(param_info);
+        interface_type = g_base_info_get_type(interface_info);
+        g_base_info_unref(interface_info);
+
+        if (interface_type == GI_INFO_TYPE_OBJECT ||
+            interface_type == GI_INFO_TYPE_INTERFACE)
+            return POINTER_ELEMENT_OBJECT;
+        return POINTER_ELEMENT_GENERIC;
+    default:
+        return POINTER_ELEMENT_GENERIC;
+    }
+}
+
+static JSBool
+gjs_value_from_pointer_element(JSContext          *context,
+                               jsval              *value_p,
+                               PointerElementKind  kind,
+                               GITypeInfo         *param_info,
+                               gpointer            data)
+{
+    GArgument arg;
+
+    if (data == NULL && kind != POINTER_ELEMENT_GENERIC) {
+        *value_p = JSVAL_NULL;
+        return JS_TRUE;
+    }
+
+    switch (kind) {
+    case POINTER_ELEMENT_UTF8:
+        return gjs_string_from_utf8(context, (const char *) data, -1, value_p);
+    case POINTER_ELEMENT_OBJECT:
+        /* Interfaces can also be implemented by fundamentals */
+        if (G_IS_OBJECT(data)) {
+            JSObject *obj = gjs_object_from_g_object(context, G_OBJECT(data));
+
+            if (obj == NULL)
+                return JS_FALSE;
+            *value_p = OBJECT_TO_JSVAL(obj);
+            return JS_TRUE;
+        }
+        /* fall through */
+    case POINTER_ELEMENT_GENERIC:
+    default:
+        arg.v_pointer = data;
+        return gjs_value_from_g_argument(context, value_p, param_info, &arg, TRUE);
+    }
+}
+
 static JSBool
 gjs_array_from_g_list (JSContext  *context,
                        jsval      *value_p,
@@ -1978,12 +2331,17 @@ gjs_array_from_g_list (JSContext  *context,
                        GSList     *slist)
 {
     JSObject *obj;
-    unsigned int i;
+    unsigned int i, length;
+    PointerElementKind kind;
     jsval elem;
-    GArgument arg;
     JSBool result;
 
-    obj = JS_NewArrayObject(context, 0, NULL);
+    length = list_tag == GI_TYPE_TAG_GLIST ?
+        g_list_length(list) : g_slist_length(slist);
+
+    /* Created with its final length, so that filling it in order
+     * never has to grow the elements */
+    obj = JS_NewArrayObject(context, length, NULL);
     if (obj == NULL)
         return JS_FALSE;
 
@@ -1993,40 +2351,26 @@ gjs_array_from_g_list (JSContext  *context,
     JS_AddValueRoot(context, &elem);
 
     result = JS_FALSE;
+    kind = get_pointer_element_kind(param_info);
 
-    i = 0;
-    if (list_tag == GI_TYPE_TAG_GLIST) {
-        for ( ; list != NULL; list = list->next) {
-            arg.v_pointer = list->data;
-
-            if (!gjs_value_from_g_argument(context, &elem,
-                                           param_info, &arg,
-                                           TRUE))
-                goto out;
+    for (i = 0; i < length; ++i) {
+        gpointer data;
 
-            if (!JS_DefineElement(context, obj,
-                                  i, elem,
-                                  NULL, NULL, JSPROP_ENUMERATE)) {
-                goto out;
-            }
-            ++i;
+        if (list_tag == GI_TYPE_TAG_GLIST) {
+            data = list->data;
+            list = list->next;
+        } else {
+            data = slist->data;
+            slist = slist->next;
         }
-    } else {
-        for ( ; slist != NULL; slist = slist->next) {
-            arg.v_pointer = slist->data;
 
-            if (!gjs_value_from_g_argument(context, &elem,
-                                           param_info, &arg,
-                                           TRUE))
-                goto out;
+        if (!gjs_value_from_pointer_element(context, &elem, kind,
+                                            param_info, data))
+            goto out;
 
-            if (!JS_DefineElement(context, obj,
-                                  i, elem,
-                                  NULL, NULL, JSPROP_ENUMERATE)) {
-                goto out;
-            }
-            ++i;
-        }
+        if (!JS_DefineElement(context, obj, i, elem,
+                              NULL, NULL, JSPROP_ENUMERATE))
+            goto out;
     }
 
     result = JS_TRUE;
@@ -2037,6 +2381,67 @@ gjs_array_from_g_list (JSContext  *context,
     return result;
 }
 
+/* Creates a typed array holding a copy of @array. If there is no typed
+ * array for @element_type, returns FALSE with *handled_p set to FALSE.
+ * 64-bit integers are left out since they don't fit in any of them.
+ */
+static JSBool
+gjs_typed_array_from_carray(JSContext  *context,
+                            jsval      *value_p,
+                            GITypeTag   element_type,
+                            guint       length,
+                            gpointer    array,
+                            gboolean   *handled_p)
+{
+    JSObject *obj;
+    gsize element_size;
+
+    *handled_p = TRUE;
+
+    switch (element_type) {
+    case GI_TYPE_TAG_INT8:
+        obj = JS_NewInt8Array(context, length);
+        element_size = sizeof(gint8);
+        break;
+    case GI_TYPE_TAG_INT16:
+        obj = JS_NewInt16Array(context, length);
+        element_size = sizeof(gint16);
+        break;
+    case GI_TYPE_TAG_UINT16:
+        obj = JS_NewUint16Array(context, length);
+        element_size = sizeof(guint16);
+        break;
+    case GI_TYPE_TAG_INT32:
+        obj = JS_NewInt32Array(context, length);
+        element_size = sizeof(gint32);
+        break;
+    case GI_TYPE_TAG_UINT32:
+        obj = JS_NewUint32Array(context, length);
+        element_size = sizeof(guint32);
+        break;
+    case GI_TYPE_TAG_FLOAT:
+        obj = JS_NewFloat32Array(context, length);
+        element_size = sizeof(gfloat);
+        break;
+    case GI_TYPE_TAG_DOUBLE:
+        obj = JS_NewFloat64Array(context, length);
+        element_size = sizeof(gdouble);
+        break;
+    default:
+        *handled_p = FALSE;
+        return JS_FALSE;
+    }
+
+    if (obj == NULL)
+        return JS_FALSE;
+
+    if (length > 0)
+        memcpy(JS_GetArrayBufferViewData(obj), array, length * element_size);
+
+    *value_p = OBJECT_TO_JSVAL(obj);
+    return JS_TRUE;
+}
+
 static JSBool
 gjs_array_from_carray_internal (JSContext  *context,
                                 jsval      *value_p,
@@ -2072,6 +2477,15 @@ gjs_array_from_carray_internal (JSContext  *context,
         return JS_TRUE;
     } 
 
+    if (gjs_get_typed_array_results()) {
+        gboolean handled;
+
+        result = gjs_typed_array_from_carray(context, value_p, element_type,
+                                             length, array, &handled);
+        if (handled)
+            return result;
+    }
+
     obj = JS_NewArrayObject(context, 0, NULL);
     if (obj == NULL)
       return JS_FALSE;
@@ -2349,6 +2763,7 @@ gjs_object_from_g_hash (JSContext  *context,
     char     *keyutf8 = NULL;
     jsval     keyjs,  valjs;
     GArgument keyarg, valarg;
+    PointerElementKind key_kind, val_kind;
     JSBool result;
 
     // a NULL hash table becomes a null JS value
@@ -2375,27 +2790,38 @@ gjs_object_from_g_hash (JSContext  *context,
 
     result = JS_FALSE;
 
+    key_kind = get_pointer_element_kind(key_param_info);
+    val_kind = get_pointer_element_kind(val_param_info);
+
     g_hash_table_iter_init(&iter, hash);
     while (g_hash_table_iter_next
            (&iter, &keyarg.v_pointer, &valarg.v_pointer)) {
-        if (!gjs_value_from_g_argument(context, &keyjs,
-                                       key_param_info, &keyarg,
-                                       TRUE))
-            goto out;
+        const char *key;
 
-        keystr = JS_ValueToString(context, keyjs);
-        if (!keystr)
-            goto out;
+        if (key_kind == POINTER_ELEMENT_UTF8 && keyarg.v_pointer != NULL) {
+            /* Already the property name we want, no need to go
+             * through a JS string and back */
+            key = (const char *) keyarg.v_pointer;
+        } else {
+            if (!gjs_value_from_pointer_element(context, &keyjs, key_kind,
+                                                key_param_info, keyarg.v_pointer))
+                goto out;
 
-        if (!gjs_string_to_utf8(context, STRING_TO_JSVAL(keystr), &keyutf8))
-            goto out;
+            keystr = JS_ValueToString(context, keyjs);
+            if (!keystr)
+                goto out;
+
+            if (!gjs_string_to_utf8(context, STRING_TO_JSVAL(keystr), &keyutf8))
+                goto out;
+
+            key = keyutf8;
+        }
 
-        if (!gjs_value_from_g_argument(context, &valjs,
-                                       val_param_info, &valarg,
-                                       TRUE))
+        if (!gjs_value_from_pointer_element(context, &valjs, val_kind,
+                                            val_param_info, valarg.v_pointer))
             goto out;
 
-        if (!JS_DefineProperty(context, obj, keyutf8, valjs,
+        if (!JS_DefineProperty(context, obj, key, valjs,
                                NULL, NULL, JSPROP_ENUMERATE))
             goto out;
 
@@ -111,6 +111,25 @@ JSBool gjs_array_from_strv (JSContext   *context,
                             jsval       *value_p,
                             const char **strv);
 
+/* See util/arena.h */
+struct _GjsArena;
+
+JSBool gjs_string_to_utf8_in_arena (JSContext        *context,
+                                    jsval             value,
+                                    struct _GjsArena *arena,
+                                    char            **utf8_string_p);
+
+void     gjs_set_typed_array_results (gboolean enabled);
+gboolean gjs_set_typed_array_results_scope (gboolean enabled);
+gboolean gjs_get_typed_array_results (void);
+
+GITypeTag gjs_array_get_borrowable_element_type (GITypeInfo *type_info);
+gboolean  gjs_typed_array_peek_data             (jsval       value,
+                                                 GITypeTag   element_type,
+                                                 gint        fixed_size,
+                                                 gpointer   *data_p,
+                                                 gsize      *length_p);
+
 JSBool gjs_array_to_strv (JSContext   *context,
                           jsval        array_value,
                           unsigned int length,
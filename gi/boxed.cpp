@@ -39,6 +39,33 @@
 
 #include <girepository.h>
 
+/* What the field getter and setter need to know about a field, worked
+ * out once per type in define_boxed_class_fields() */
+typedef struct {
+    GIFieldInfo *info;
+    GITypeInfo *type_info;
+    /* Embedded struct or boxed, NULL otherwise */
+    GIBaseInfo *interface_info;
+    gint offset;
+    /* Tag of a readable and writable scalar field, read and written
+     * in place; GI_TYPE_TAG_VOID for all other fields */
+    GITypeTag scalar_tag;
+    guint nested_is_simple : 1;
+} BoxedField;
+
+/* The fields a constructor's field hash resolves to, for one list of
+ * keys. Structs tend to be constructed with the same keys over and
+ * over, so a few of these are kept per prototype. The keys are always
+ * field names, which are interned, so their jsids stay valid.
+ */
+typedef struct {
+    guint n_fields;
+    gsize *ids;          /* JSID_BITS() of the keys, in enumeration order */
+    BoxedField **fields;
+} BoxedInitShape;
+
+#define MAX_INIT_SHAPES 4
+
 typedef struct {
     /* prototype info */
     GIBoxedInfo *info;
@@ -47,6 +74,10 @@ typedef struct {
     jsid zero_args_constructor_name;
     gint default_constructor; /* -1 if none */
     jsid default_constructor_name;
+    BoxedField *fields; /* shared with the instances */
+    guint n_fields;
+    GHashTable *field_map; /* JSID_BITS() of field name -> BoxedField */
+    GPtrArray *init_shapes; /* BoxedInitShape, most recently added last */
 
     /* instance info */
     void *gboxed; /* NULL if we are the prototype and not an instance */
@@ -55,13 +86,44 @@ typedef struct {
     guint allocated_directly : 1;
     guint not_owning_gboxed : 1; /* if set, the JS wrapper does not own
                                     the reference to the C gboxed */
+    guint owns_fields : 1; /* only set on the prototype */
+
+    /* size class for instances that store the struct inline, 0 if
+     * they can't, see boxed_alloc() */
+    guint inline_class : 2;
+    /* size class this Boxed was allocated with */
+    guint alloc_class : 2;
+    guint allocated_inline : 1; /* gboxed points into this Boxed */
 } Boxed;
 
+/* Small simple structs are stored right after their Boxed, in one
+ * allocation of the smallest size class that fits them. Simple structs
+ * are plain memory to us, registered boxed types included: boxed_new()
+ * has always allocated those directly and freed them without going
+ * through g_boxed_free(). Freed Boxed are kept on a free list per size
+ * class for the next wrapper, up to BOXED_FREE_LIST_MAX each. The free
+ * lists belong to the runtime, see get_free_lists(), and are emptied
+ * when a context is disposed. Like the rest of GJS this is not
+ * thread-safe; all wrappers are created and finalized on the JS
+ * thread.
+ */
+#define BOXED_N_ALLOC_CLASSES 4
+#define BOXED_FREE_LIST_MAX 256
+#define BOXED_INLINE_OFFSET ((sizeof(Boxed) + 15) & ~(gsize) 15)
+
+typedef struct {
+    gpointer heads[BOXED_N_ALLOC_CLASSES];
+    guint lengths[BOXED_N_ALLOC_CLASSES];
+} BoxedFreeLists;
+
+static const gsize inline_class_sizes[BOXED_N_ALLOC_CLASSES] = { 0, 16, 32, 64 };
+static GjsBoxedAllocStats alloc_stats;
+
 static gboolean struct_is_simple(GIStructInfo *info);
 
 static JSBool boxed_set_field_from_value(JSContext   *context,
                                          Boxed       *priv,
-                                         GIFieldInfo *field_info,
+                                         BoxedField  *field,
                                          jsval        value);
 
 extern struct JSClass gjs_boxed_class;
@@ -214,40 +276,219 @@ boxed_get_copy_source(JSContext *context,
     return JS_TRUE;
 }
 
+static gsize
+boxed_alloc_size(guint alloc_class)
+{
+    if (alloc_class == 0)
+        return sizeof(Boxed);
+    return BOXED_INLINE_OFFSET + inline_class_sizes[alloc_class];
+}
+
+static void
+free_lists_clear(BoxedFreeLists *lists)
+{
+    guint i;
+
+    for (i = 0; i < BOXED_N_ALLOC_CLASSES; i++) {
+        while (lists->heads[i] != NULL) {
+            gpointer block = lists->heads[i];
+
+            lists->heads[i] = *(gpointer *) block;
+            g_slice_free1(boxed_alloc_size(i), block);
+        }
+        lists->lengths[i] = 0;
+    }
+}
+
+static void
+free_lists_destroy(gpointer data)
+{
+    BoxedFreeLists *lists = (BoxedFreeLists *) data;
+
+    free_lists_clear(lists);
+    g_slice_free(BoxedFreeLists, lists);
+}
+
+static BoxedFreeLists *
+get_free_lists(JSRuntime *runtime)
+{
+    BoxedFreeLists *lists;
+
+    lists = (BoxedFreeLists *) gjs_runtime_get_data(runtime, GJS_RUNTIME_DATA_BOXED_FREE_LISTS);
+    if (G_UNLIKELY(lists == NULL)) {
+        lists = g_slice_new0(BoxedFreeLists);
+        gjs_runtime_set_data(runtime, GJS_RUNTIME_DATA_BOXED_FREE_LISTS,
+                             lists, free_lists_destroy);
+    }
+
+    return lists;
+}
+
+/* Returns a zeroed Boxed, with room for a struct of alloc_class after
+ * it unless alloc_class is 0 */
+static Boxed *
+boxed_alloc(JSContext *context,
+            guint      alloc_class)
+{
+    BoxedFreeLists *lists = get_free_lists(JS_GetRuntime(context));
+    Boxed *priv;
+
+    alloc_stats.wrappers++;
+
+    if (lists->heads[alloc_class] != NULL) {
+        priv = (Boxed *) lists->heads[alloc_class];
+        lists->heads[alloc_class] = *(gpointer *) priv;
+        lists->lengths[alloc_class]--;
+    } else {
+        priv = (Boxed *) g_slice_alloc(boxed_alloc_size(alloc_class));
+        alloc_stats.slab_allocs++;
+    }
+
+    memset(priv, 0, sizeof(Boxed));
+    priv->alloc_class = alloc_class;
+
+    return priv;
+}
+
+static void
+boxed_free(JSRuntime *runtime,
+           Boxed     *priv)
+{
+    BoxedFreeLists *lists = get_free_lists(runtime);
+    guint alloc_class = priv->alloc_class;
+
+    if (lists->lengths[alloc_class] < BOXED_FREE_LIST_MAX) {
+        *(gpointer *) priv = lists->heads[alloc_class];
+        lists->heads[alloc_class] = priv;
+        lists->lengths[alloc_class]++;
+    } else {
+        g_slice_free1(boxed_alloc_size(alloc_class), priv);
+    }
+}
+
+/* Copies the prototype info into a newly allocated instance */
+static void
+boxed_init_instance(Boxed *priv,
+                    Boxed *proto_priv)
+{
+    guint alloc_class = priv->alloc_class;
+
+    *priv = *proto_priv;
+    priv->alloc_class = alloc_class;
+    priv->owns_fields = FALSE;
+    g_base_info_ref( (GIBaseInfo*) priv->info);
+}
+
+/* The size class that a simple struct of @info fits in, or 0 */
+static guint
+get_inline_class(GIStructInfo *info)
+{
+    gsize size = g_struct_info_get_size(info);
+    guint i;
+
+    if (g_getenv("GJS_DISABLE_BOXED_INLINE") != NULL)
+        return 0;
+
+    for (i = 1; i < BOXED_N_ALLOC_CLASSES; i++) {
+        if (size <= inline_class_sizes[i])
+            return i;
+    }
+
+    return 0;
+}
+
+void
+gjs_boxed_get_alloc_stats(GjsBoxedAllocStats *stats)
+{
+    *stats = alloc_stats;
+}
+
+/* Gives the memory of the free lists of @runtime back to the slice
+ * allocator */
+void
+gjs_boxed_release_free_lists(JSRuntime *runtime)
+{
+    BoxedFreeLists *lists;
+
+    lists = (BoxedFreeLists *) gjs_runtime_get_data(runtime, GJS_RUNTIME_DATA_BOXED_FREE_LISTS);
+    if (lists != NULL)
+        free_lists_clear(lists);
+}
+
 static void
 boxed_new_direct(Boxed       *priv)
 {
     g_assert(priv->can_allocate_directly);
 
-    priv->gboxed = g_slice_alloc0(g_struct_info_get_size (priv->info));
-    priv->allocated_directly = TRUE;
+    if (priv->alloc_class != 0) {
+        priv->gboxed = ((char *) priv) + BOXED_INLINE_OFFSET;
+        memset(priv->gboxed, 0, g_struct_info_get_size (priv->info));
+        priv->allocated_inline = TRUE;
+        alloc_stats.inline_structs++;
+    } else {
+        priv->gboxed = g_slice_alloc0(g_struct_info_get_size (priv->info));
+        priv->allocated_directly = TRUE;
+        alloc_stats.struct_allocs++;
+    }
 
     gjs_debug_lifecycle(GJS_DEBUG_GBOXED,
                         "JSObject created by directly allocating %s",
                         g_base_info_get_name ((GIBaseInfo *)priv->info));
 }
 
-/* When initializing a boxed object from a hash of properties, we don't want
- * to do n O(n) lookups, so put temporarily put the fields into a hash table
- * for fast lookup. We could also do this ahead of time and store it on proto->priv.
- */
-static GHashTable *
-get_field_map(GIStructInfo *struct_info)
+static void
+boxed_init_shape_free(gpointer data)
 {
-    GHashTable *result;
-    int n_fields;
-    int i;
+    BoxedInitShape *shape = (BoxedInitShape *) data;
 
-    result = g_hash_table_new_full(g_str_hash, g_str_equal,
-                                   NULL, (GDestroyNotify)g_base_info_unref);
-    n_fields = g_struct_info_get_n_fields(struct_info);
+    g_free(shape->ids);
+    g_free(shape->fields);
+    g_slice_free(BoxedInitShape, shape);
+}
 
-    for (i = 0; i < n_fields; i++) {
-        GIFieldInfo *field_info = g_struct_info_get_field(struct_info, i);
-        g_hash_table_insert(result, (char *)g_base_info_get_name((GIBaseInfo *)field_info), field_info);
+/* Returns NULL with an exception set if one of @ids is not a field */
+static BoxedInitShape *
+lookup_init_shape(JSContext *context,
+                  Boxed     *priv,
+                  gsize     *ids,
+                  guint      n_ids)
+{
+    BoxedInitShape *shape;
+    guint i;
+
+    for (i = priv->init_shapes->len; i > 0; i--) {
+        shape = (BoxedInitShape *) g_ptr_array_index(priv->init_shapes, i - 1);
+        if (shape->n_fields == n_ids &&
+            memcmp(shape->ids, ids, n_ids * sizeof(gsize)) == 0)
+            return shape;
     }
 
-    return result;
+    shape = g_slice_new0(BoxedInitShape);
+    shape->n_fields = n_ids;
+    shape->ids = (gsize *) g_memdup(ids, n_ids * sizeof(gsize));
+    shape->fields = g_new0(BoxedField *, n_ids);
+
+    for (i = 0; i < n_ids; i++) {
+        shape->fields[i] = (BoxedField *) g_hash_table_lookup(priv->field_map,
+                                                              (gpointer) ids[i]);
+        if (shape->fields[i] == NULL) {
+            char *name;
+
+            if (gjs_get_string_id(context, JSID_FROM_BITS(ids[i]), &name)) {
+                gjs_throw(context, "No field %s on boxed type %s",
+                          name, g_base_info_get_name((GIBaseInfo *)priv->info));
+                g_free(name);
+            }
+            boxed_init_shape_free(shape);
+            return NULL;
+        }
+    }
+
+    if (priv->init_shapes->len >= MAX_INIT_SHAPES)
+        g_ptr_array_remove_index(priv->init_shapes, 0);
+    g_ptr_array_add(priv->init_shapes, shape);
+
+    return shape;
 }
 
 /* Initialize a newly created Boxed from an object that is a "hash" of
@@ -263,8 +504,10 @@ boxed_init_from_props(JSContext   *context,
     JSObject *props;
     JSObject *iter;
     jsid prop_id;
-    GHashTable *field_map;
+    GArray *ids;
+    BoxedInitShape *shape;
     gboolean success;
+    guint i;
 
     success = FALSE;
 
@@ -281,46 +524,46 @@ boxed_init_from_props(JSContext   *context,
         return JS_FALSE;
     }
 
-    field_map = get_field_map(priv->info);
+    ids = g_array_new(FALSE, FALSE, sizeof(gsize));
 
     prop_id = JSID_VOID;
     if (!JS_NextProperty(context, iter, &prop_id))
         goto out;
 
     while (!JSID_IS_VOID(prop_id)) {
-        GIFieldInfo *field_info;
-        char *name;
-        jsval value;
+        gsize bits = JSID_BITS(prop_id);
 
-        if (!gjs_get_string_id(context, prop_id, &name))
-            goto out;
+        g_array_append_val(ids, bits);
 
-        field_info = (GIFieldInfo *) g_hash_table_lookup(field_map, name);
-        if (field_info == NULL) {
-            gjs_throw(context, "No field %s on boxed type %s",
-                      name, g_base_info_get_name((GIBaseInfo *)priv->info));
-            g_free(name);
+        prop_id = JSID_VOID;
+        if (!JS_NextProperty(context, iter, &prop_id))
             goto out;
-        }
+    }
 
-        if (!gjs_object_require_property(context, props, "property list", prop_id, &value)) {
-            g_free(name);
-            goto out;
-        }
-        g_free(name);
+    if (ids->len == 0) {
+        success = TRUE;
+        goto out;
+    }
+
+    shape = lookup_init_shape(context, priv, (gsize *) ids->data, ids->len);
+    if (shape == NULL)
+        goto out;
+
+    for (i = 0; i < shape->n_fields; i++) {
+        jsval value;
 
-        if (!boxed_set_field_from_value(context, priv, field_info, value))
+        if (!gjs_object_require_property(context, props, "property list",
+                                         JSID_FROM_BITS(shape->ids[i]), &value))
             goto out;
 
-        prop_id = JSID_VOID;
-        if (!JS_NextProperty(context, iter, &prop_id))
+        if (!boxed_set_field_from_value(context, priv, shape->fields[i], value))
             goto out;
     }
 
     success = TRUE;
 
  out:
-    g_hash_table_destroy(field_map);
+    g_array_free(ids, TRUE);
 
     return success;
 }
@@ -389,6 +632,7 @@ boxed_new(JSContext   *context,
         g_base_info_unref((GIBaseInfo*) func_info);
 
         priv->gboxed = rval.v_pointer;
+        alloc_stats.struct_allocs++;
 
         gjs_debug_lifecycle(GJS_DEBUG_GBOXED,
                             "JSObject created with boxed instance %p type %s",
@@ -436,16 +680,7 @@ GJS_NATIVE_CONSTRUCTOR_DECLARE(boxed)
 
     GJS_NATIVE_CONSTRUCTOR_PRELUDE(boxed);
 
-    priv = g_slice_new0(Boxed);
-
-    GJS_INC_COUNTER(boxed);
-
     g_assert(priv_from_js(context, object) == NULL);
-    JS_SetPrivate(object, priv);
-
-    gjs_debug_lifecycle(GJS_DEBUG_GBOXED,
-                        "boxed constructor, obj %p priv %p",
-                        object, priv);
 
     JS_GetPrototype(context, object, &proto);
     gjs_debug_lifecycle(GJS_DEBUG_GBOXED, "boxed instance __proto__ is %p", proto);
@@ -460,15 +695,33 @@ GJS_NATIVE_CONSTRUCTOR_DECLARE(boxed)
         return JS_FALSE;
     }
 
-    *priv = *proto_priv;
-    g_base_info_ref( (GIBaseInfo*) priv->info);
+    /* Only room for the struct if boxed_new() will allocate it directly */
+    priv = boxed_alloc(context, proto_priv->zero_args_constructor < 0 ? proto_priv->inline_class : 0);
+
+    GJS_INC_COUNTER(boxed);
+
+    JS_SetPrivate(object, priv);
+
+    gjs_debug_lifecycle(GJS_DEBUG_GBOXED,
+                        "boxed constructor, obj %p priv %p",
+                        object, priv);
+
+    boxed_init_instance(priv, proto_priv);
 
     /* Short-circuit copy-construction in the case where we can use g_boxed_copy or memcpy */
     if (argc == 1 &&
         boxed_get_copy_source(context, priv, argv[0], &source_priv)) {
 
-        if (g_type_is_a (priv->gtype, G_TYPE_BOXED)) {
+        if (priv->alloc_class != 0) {
+            boxed_new_direct (priv);
+            memcpy(priv->gboxed, source_priv->gboxed,
+                   g_struct_info_get_size (priv->info));
+
+            GJS_NATIVE_CONSTRUCTOR_FINISH(boxed);
+            return JS_TRUE;
+        } else if (g_type_is_a (priv->gtype, G_TYPE_BOXED)) {
             priv->gboxed = g_boxed_copy(priv->gtype, source_priv->gboxed);
+            alloc_stats.struct_allocs++;
 
             GJS_NATIVE_CONSTRUCTOR_FINISH(boxed);
             return JS_TRUE;
@@ -517,7 +770,9 @@ boxed_finalize(JSFreeOp *fop,
         return; /* wrong class? */
 
     if (priv->gboxed && !priv->not_owning_gboxed) {
-        if (priv->allocated_directly) {
+        if (priv->allocated_inline) {
+            /* freed along with priv */
+        } else if (priv->allocated_directly) {
             g_slice_free1(g_struct_info_get_size (priv->info), priv->gboxed);
         } else {
             if (g_type_is_a (priv->gtype, G_TYPE_BOXED))
@@ -531,70 +786,82 @@ boxed_finalize(JSFreeOp *fop,
         priv->gboxed = NULL;
     }
 
+    if (priv->owns_fields) {
+        guint i;
+
+        for (i = 0; i < priv->n_fields; i++) {
+            BoxedField *field = &priv->fields[i];
+
+            g_base_info_unref((GIBaseInfo *)field->info);
+            g_base_info_unref((GIBaseInfo *)field->type_info);
+            if (field->interface_info)
+                g_base_info_unref(field->interface_info);
+        }
+        g_free(priv->fields);
+        priv->fields = NULL;
+
+        g_hash_table_destroy(priv->field_map);
+        priv->field_map = NULL;
+        g_ptr_array_free(priv->init_shapes, TRUE);
+        priv->init_shapes = NULL;
+    }
+
     if (priv->info) {
         g_base_info_unref( (GIBaseInfo*) priv->info);
         priv->info = NULL;
     }
 
     GJS_DEC_COUNTER(boxed);
-    g_slice_free(Boxed, priv);
+    boxed_free(fop->runtime(), priv);
 }
 
-static GIFieldInfo *
-get_field_info (JSContext *context,
-                Boxed     *priv,
-                jsid       id)
+static BoxedField *
+get_field (JSContext *context,
+           Boxed     *priv,
+           jsid       id)
 {
     int field_index;
-    jsval id_val;
 
-    if (!JS_IdToValue(context, id, &id_val))
-        return JS_FALSE;
-
-    if (!JSVAL_IS_INT (id_val)) {
+    /* Fields are defined with their index as tiny id */
+    if (!JSID_IS_INT (id)) {
         gjs_throw(context, "Field index for %s is not an integer",
                   g_base_info_get_name ((GIBaseInfo *)priv->info));
         return NULL;
     }
 
-    field_index = JSVAL_TO_INT(id_val);
-    if (field_index < 0 || field_index >= g_struct_info_get_n_fields (priv->info)) {
+    field_index = JSID_TO_INT(id);
+    if (field_index < 0 || (guint) field_index >= priv->n_fields) {
         gjs_throw(context, "Bad field index %d for %s", field_index,
                   g_base_info_get_name ((GIBaseInfo *)priv->info));
         return NULL;
     }
 
-    return g_struct_info_get_field (priv->info, field_index);
+    return &priv->fields[field_index];
 }
 
 static JSBool
 get_nested_interface_object (JSContext   *context,
                              JSObject    *parent_obj,
                              Boxed       *parent_priv,
-                             GIFieldInfo *field_info,
-                             GITypeInfo  *type_info,
-                             GIBaseInfo  *interface_info,
+                             BoxedField  *field,
                              jsval       *value)
 {
     JSObject *obj;
     JSObject *proto;
-    int offset;
     Boxed *priv;
     Boxed *proto_priv;
 
-    if (!struct_is_simple ((GIStructInfo *)interface_info)) {
+    if (!field->nested_is_simple) {
         gjs_throw(context, "Reading field %s.%s is not supported",
                   g_base_info_get_name ((GIBaseInfo *)parent_priv->info),
-                  g_base_info_get_name ((GIBaseInfo *)field_info));
+                  g_base_info_get_name ((GIBaseInfo *)field->info));
 
         return JS_FALSE;
     }
 
-    proto = gjs_lookup_generic_prototype(context, (GIBoxedInfo*) interface_info);
+    proto = gjs_lookup_generic_prototype(context, (GIBoxedInfo*) field->interface_info);
     proto_priv = priv_from_js(context, proto);
 
-    offset = g_field_info_get_offset (field_info);
-
     obj = JS_NewObjectWithGivenProto(context,
                                      JS_GetClass(proto), proto,
                                      gjs_get_import_global (context));
@@ -603,15 +870,19 @@ get_nested_interface_object (JSContext   *context,
         return JS_FALSE;
 
     GJS_INC_COUNTER(boxed);
-    priv = g_slice_new0(Boxed);
+    priv = boxed_alloc(context, 0);
     JS_SetPrivate(obj, priv);
-    priv->info = (GIBoxedInfo*) interface_info;
+    priv->info = (GIBoxedInfo*) field->interface_info;
     g_base_info_ref( (GIBaseInfo*) priv->info);
-    priv->gtype = g_registered_type_info_get_g_type ((GIRegisteredTypeInfo*) interface_info);
+    priv->gtype = g_registered_type_info_get_g_type ((GIRegisteredTypeInfo*) field->interface_info);
     priv->can_allocate_directly = proto_priv->can_allocate_directly;
+    priv->fields = proto_priv->fields;
+    priv->n_fields = proto_priv->n_fields;
+    priv->field_map = proto_priv->field_map;
+    priv->init_shapes = proto_priv->init_shapes;
 
     /* A structure nested inside a parent object; doesn't have an independent allocation */
-    priv->gboxed = ((char *)parent_priv->gboxed) + offset;
+    priv->gboxed = ((char *)parent_priv->gboxed) + field->offset;
     priv->not_owning_gboxed = TRUE;
 
     /* We never actually read the reserved slot, but we put the parent object
@@ -624,6 +895,88 @@ get_nested_interface_object (JSContext   *context,
     return JS_TRUE;
 }
 
+/* Same conversions as gjs_value_from_g_argument(), without going
+ * through the typelib */
+static JSBool
+scalar_field_to_value (JSContext  *context,
+                       BoxedField *field,
+                       void       *mem,
+                       jsval      *value)
+{
+    switch (field->scalar_tag) {
+    case GI_TYPE_TAG_BOOLEAN:
+        *value = BOOLEAN_TO_JSVAL(!!*(gboolean *)mem);
+        return JS_TRUE;
+    case GI_TYPE_TAG_INT8:
+        return JS_NewNumberValue(context, *(gint8 *)mem, value);
+    case GI_TYPE_TAG_UINT8:
+        return JS_NewNumberValue(context, *(guint8 *)mem, value);
+    case GI_TYPE_TAG_INT16:
+        return JS_NewNumberValue(context, *(gint16 *)mem, value);
+    case GI_TYPE_TAG_UINT16:
+        return JS_NewNumberValue(context, *(guint16 *)mem, value);
+    case GI_TYPE_TAG_INT32:
+        return JS_NewNumberValue(context, *(gint32 *)mem, value);
+    case GI_TYPE_TAG_UINT32:
+        return JS_NewNumberValue(context, *(guint32 *)mem, value);
+    case GI_TYPE_TAG_INT64:
+        return JS_NewNumberValue(context, *(gint64 *)mem, value);
+    case GI_TYPE_TAG_UINT64:
+        return JS_NewNumberValue(context, *(guint64 *)mem, value);
+    case GI_TYPE_TAG_FLOAT:
+        return JS_NewNumberValue(context, *(gfloat *)mem, value);
+    case GI_TYPE_TAG_DOUBLE:
+        return JS_NewNumberValue(context, *(gdouble *)mem, value);
+    default:
+        g_assert_not_reached();
+        return JS_FALSE;
+    }
+}
+
+static void
+scalar_field_from_arg (BoxedField *field,
+                       void       *mem,
+                       GArgument  *arg)
+{
+    switch (field->scalar_tag) {
+    case GI_TYPE_TAG_BOOLEAN:
+        *(gboolean *)mem = arg->v_boolean;
+        break;
+    case GI_TYPE_TAG_INT8:
+        *(gint8 *)mem = arg->v_int8;
+        break;
+    case GI_TYPE_TAG_UINT8:
+        *(guint8 *)mem = arg->v_uint8;
+        break;
+    case GI_TYPE_TAG_INT16:
+        *(gint16 *)mem = arg->v_int16;
+        break;
+    case GI_TYPE_TAG_UINT16:
+        *(guint16 *)mem = arg->v_uint16;
+        break;
+    case GI_TYPE_TAG_INT32:
+        *(gint32 *)mem = arg->v_int32;
+        break;
+    case GI_TYPE_TAG_UINT32:
+        *(guint32 *)mem = arg->v_uint32;
+        break;
+    case GI_TYPE_TAG_INT64:
+        *(gint64 *)mem = arg->v_int64;
+        break;
+    case GI_TYPE_TAG_UINT64:
+        *(guint64 *)mem = arg->v_uint64;
+        break;
+    case GI_TYPE_TAG_FLOAT:
+        *(gfloat *)mem = arg->v_float;
+        break;
+    case GI_TYPE_TAG_DOUBLE:
+        *(gdouble *)mem = arg->v_double;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
 static JSBool
 boxed_field_getter (JSContext              *context,
                     JS::HandleObject        obj,
@@ -631,92 +984,65 @@ boxed_field_getter (JSContext              *context,
                     JS::MutableHandleValue  value)
 {
     Boxed *priv;
-    GIFieldInfo *field_info;
-    GITypeInfo *type_info;
+    BoxedField *field;
     GArgument arg;
-    gboolean success = FALSE;
 
     priv = priv_from_js(context, obj);
     if (!priv)
         return JS_FALSE;
 
-    field_info = get_field_info(context, priv, id);
-    if (!field_info)
+    field = get_field(context, priv, id);
+    if (!field)
         return JS_FALSE;
 
-    type_info = g_field_info_get_type (field_info);
-
     if (priv->gboxed == NULL) { /* direct access to proto field */
         gjs_throw(context, "Can't get field %s.%s from a prototype",
                   g_base_info_get_name ((GIBaseInfo *)priv->info),
-                  g_base_info_get_name ((GIBaseInfo *)field_info));
-        goto out;
+                  g_base_info_get_name ((GIBaseInfo *)field->info));
+        return JS_FALSE;
     }
 
-    if (!g_type_info_is_pointer (type_info) &&
-        g_type_info_get_tag (type_info) == GI_TYPE_TAG_INTERFACE) {
-
-        GIBaseInfo *interface_info = g_type_info_get_interface(type_info);
-
-        if (g_base_info_get_type (interface_info) == GI_INFO_TYPE_STRUCT ||
-            g_base_info_get_type (interface_info) == GI_INFO_TYPE_BOXED) {
-
-            success = get_nested_interface_object (context, obj, priv,
-                                                   field_info, type_info, interface_info,
-                                                   value.address());
-
-            g_base_info_unref ((GIBaseInfo *)interface_info);
-
-            goto out;
-        }
+    if (field->scalar_tag != GI_TYPE_TAG_VOID)
+        return scalar_field_to_value(context, field,
+                                     ((char *)priv->gboxed) + field->offset,
+                                     value.address());
 
-        g_base_info_unref ((GIBaseInfo *)interface_info);
-    }
+    if (field->interface_info != NULL)
+        return get_nested_interface_object (context, obj, priv, field,
+                                            value.address());
 
-    if (!g_field_info_get_field (field_info, priv->gboxed, &arg)) {
+    if (!g_field_info_get_field (field->info, priv->gboxed, &arg)) {
         gjs_throw(context, "Reading field %s.%s is not supported",
                   g_base_info_get_name ((GIBaseInfo *)priv->info),
-                  g_base_info_get_name ((GIBaseInfo *)field_info));
-        goto out;
+                  g_base_info_get_name ((GIBaseInfo *)field->info));
+        return JS_FALSE;
     }
 
-    if (!gjs_value_from_g_argument (context, value.address(),
-                                    type_info,
-                                    &arg,
-                                    TRUE))
-        goto out;
-
-    success = TRUE;
-
-out:
-    g_base_info_unref ((GIBaseInfo *)field_info);
-    g_base_info_unref ((GIBaseInfo *)type_info);
-
-    return success;
+    return gjs_value_from_g_argument (context, value.address(),
+                                      field->type_info,
+                                      &arg,
+                                      TRUE);
 }
 
 static JSBool
 set_nested_interface_object (JSContext   *context,
                              Boxed       *parent_priv,
-                             GIFieldInfo *field_info,
-                             GITypeInfo  *type_info,
-                             GIBaseInfo  *interface_info,
+                             BoxedField  *field,
                              jsval        value)
 {
     JSObject *proto;
-    int offset;
     Boxed *proto_priv;
     Boxed *source_priv;
 
-    if (!struct_is_simple ((GIStructInfo *)interface_info)) {
+    if (!field->nested_is_simple) {
         gjs_throw(context, "Writing field %s.%s is not supported",
                   g_base_info_get_name ((GIBaseInfo *)parent_priv->info),
-                  g_base_info_get_name ((GIBaseInfo *)field_info));
+                  g_base_info_get_name ((GIBaseInfo *)field->info));
 
         return JS_FALSE;
     }
 
-    proto = gjs_lookup_generic_prototype(context, (GIBoxedInfo*) interface_info);
+    proto = gjs_lookup_generic_prototype(context, (GIBoxedInfo*) field->interface_info);
     proto_priv = priv_from_js(context, proto);
 
     /* If we can't directly copy from the source object we need
@@ -732,8 +1058,7 @@ set_nested_interface_object (JSContext   *context,
             return JS_FALSE;
     }
 
-    offset = g_field_info_get_offset (field_info);
-    memcpy(((char *)parent_priv->gboxed) + offset,
+    memcpy(((char *)parent_priv->gboxed) + field->offset,
            source_priv->gboxed,
            g_struct_info_get_size (source_priv->info));
 
@@ -743,63 +1068,42 @@ set_nested_interface_object (JSContext   *context,
 static JSBool
 boxed_set_field_from_value(JSContext   *context,
                            Boxed       *priv,
-                           GIFieldInfo *field_info,
+                           BoxedField  *field,
                            jsval        value)
 {
-    GITypeInfo *type_info;
     GArgument arg;
     gboolean success = FALSE;
-    gboolean need_release = FALSE;
-
-    type_info = g_field_info_get_type (field_info);
-
-    if (!g_type_info_is_pointer (type_info) &&
-        g_type_info_get_tag (type_info) == GI_TYPE_TAG_INTERFACE) {
 
-        GIBaseInfo *interface_info = g_type_info_get_interface(type_info);
-
-        if (g_base_info_get_type (interface_info) == GI_INFO_TYPE_STRUCT ||
-            g_base_info_get_type (interface_info) == GI_INFO_TYPE_BOXED) {
-
-            success = set_nested_interface_object (context, priv,
-                                                   field_info, type_info,
-                                                   interface_info, value);
-
-            g_base_info_unref ((GIBaseInfo *)interface_info);
-
-            goto out;
-        }
-
-        g_base_info_unref ((GIBaseInfo *)interface_info);
-
-    }
+    if (field->interface_info != NULL)
+        return set_nested_interface_object (context, priv, field, value);
 
     if (!gjs_value_to_g_argument(context, value,
-                                 type_info,
-                                 g_base_info_get_name ((GIBaseInfo *)field_info),
+                                 field->type_info,
+                                 g_base_info_get_name ((GIBaseInfo *)field->info),
                                  GJS_ARGUMENT_FIELD,
                                  GI_TRANSFER_NOTHING,
                                  TRUE, &arg))
-        goto out;
+        return JS_FALSE;
 
-    need_release = TRUE;
+    /* Scalars need no release */
+    if (field->scalar_tag != GI_TYPE_TAG_VOID) {
+        scalar_field_from_arg(field, ((char *)priv->gboxed) + field->offset, &arg);
+        return JS_TRUE;
+    }
 
-    if (!g_field_info_set_field (field_info, priv->gboxed, &arg)) {
+    if (!g_field_info_set_field (field->info, priv->gboxed, &arg)) {
         gjs_throw(context, "Writing field %s.%s is not supported",
                   g_base_info_get_name ((GIBaseInfo *)priv->info),
-                  g_base_info_get_name ((GIBaseInfo *)field_info));
+                  g_base_info_get_name ((GIBaseInfo *)field->info));
         goto out;
     }
 
     success = TRUE;
 
 out:
-    if (need_release)
-        gjs_g_argument_release (context, GI_TRANSFER_NOTHING,
-                                type_info,
-                                &arg);
-
-    g_base_info_unref ((GIBaseInfo *)type_info);
+    gjs_g_argument_release (context, GI_TRANSFER_NOTHING,
+                            field->type_info,
+                            &arg);
 
     return success;
 }
@@ -812,29 +1116,76 @@ boxed_field_setter (JSContext              *context,
                     JS::MutableHandleValue  value)
 {
     Boxed *priv;
-    GIFieldInfo *field_info;
-    gboolean success = FALSE;
+    BoxedField *field;
 
     priv = priv_from_js(context, obj);
     if (!priv)
         return JS_FALSE;
-    field_info = get_field_info(context, priv, id);
-    if (!field_info)
+    field = get_field(context, priv, id);
+    if (!field)
         return JS_FALSE;
 
     if (priv->gboxed == NULL) { /* direct access to proto field */
         gjs_throw(context, "Can't set field %s.%s on prototype",
                   g_base_info_get_name ((GIBaseInfo *)priv->info),
-                  g_base_info_get_name ((GIBaseInfo *)field_info));
-        goto out;
+                  g_base_info_get_name ((GIBaseInfo *)field->info));
+        return JS_FALSE;
     }
 
-    success = boxed_set_field_from_value (context, priv, field_info, value);
-
-out:
-    g_base_info_unref ((GIBaseInfo *)field_info);
+    return boxed_set_field_from_value (context, priv, field, value);
+}
 
-    return success;
+/* Fills in the parts of @field that don't depend on an instance */
+static void
+init_boxed_field (BoxedField  *field,
+                  GIFieldInfo *field_info)
+{
+    GIFieldInfoFlags flags;
+    GITypeTag tag;
+
+    field->info = field_info;
+    field->type_info = g_field_info_get_type (field_info);
+    field->offset = g_field_info_get_offset (field_info);
+    field->scalar_tag = GI_TYPE_TAG_VOID;
+
+    if (g_type_info_is_pointer (field->type_info))
+        return;
+
+    tag = g_type_info_get_tag (field->type_info);
+    flags = g_field_info_get_flags (field_info);
+
+    switch (tag) {
+    case GI_TYPE_TAG_BOOLEAN:
+    case GI_TYPE_TAG_INT8:
+    case GI_TYPE_TAG_UINT8:
+    case GI_TYPE_TAG_INT16:
+    case GI_TYPE_TAG_UINT16:
+    case GI_TYPE_TAG_INT32:
+    case GI_TYPE_TAG_UINT32:
+    case GI_TYPE_TAG_INT64:
+    case GI_TYPE_TAG_UINT64:
+    case GI_TYPE_TAG_FLOAT:
+    case GI_TYPE_TAG_DOUBLE:
+        /* Others go through g_field_info_get_field(), which throws */
+        if ((flags & GI_FIELD_IS_READABLE) && (flags & GI_FIELD_IS_WRITABLE))
+            field->scalar_tag = tag;
+        break;
+    case GI_TYPE_TAG_INTERFACE:
+        {
+            GIBaseInfo *interface_info = g_type_info_get_interface (field->type_info);
+
+            if (g_base_info_get_type (interface_info) == GI_INFO_TYPE_STRUCT ||
+                g_base_info_get_type (interface_info) == GI_INFO_TYPE_BOXED) {
+                field->interface_info = interface_info;
+                field->nested_is_simple = struct_is_simple ((GIStructInfo *)interface_info);
+            } else {
+                g_base_info_unref (interface_info);
+            }
+        }
+        break;
+    default:
+        break;
+    }
 }
 
 static JSBool
@@ -865,6 +1216,26 @@ define_boxed_class_fields (JSContext *context,
      * as well if doing it ahead of time caused to much start-up
      * memory overhead.
      */
+
+    /* Offsets, types and nested struct infos for all fields, so the
+     * getter and setter don't need the typelib for every access */
+    priv->fields = g_new0(BoxedField, n_fields);
+    priv->n_fields = n_fields;
+    priv->owns_fields = TRUE;
+    priv->field_map = g_hash_table_new(NULL, NULL);
+    priv->init_shapes = g_ptr_array_new_with_free_func(boxed_init_shape_free);
+    for (i = 0; i < n_fields; i++) {
+        BoxedField *field = &priv->fields[i];
+        jsid name_id;
+
+        init_boxed_field (field, g_struct_info_get_field (priv->info, i));
+
+        /* For boxed_init_from_props(); interning keeps the id valid */
+        name_id = gjs_intern_string_to_id(context,
+                                          g_base_info_get_name ((GIBaseInfo *)field->info));
+        g_hash_table_insert(priv->field_map, (gpointer) JSID_BITS(name_id), field);
+    }
+
     if (n_fields > 256) {
         g_warning("Only defining the first 256 fields in boxed type '%s'",
                   g_base_info_get_name ((GIBaseInfo *)priv->info));
@@ -872,18 +1243,12 @@ define_boxed_class_fields (JSContext *context,
     }
 
     for (i = 0; i < n_fields; i++) {
-        GIFieldInfo *field = g_struct_info_get_field (priv->info, i);
-        const char *field_name = g_base_info_get_name ((GIBaseInfo *)field);
-        gboolean result;
-
-        result = JS_DefinePropertyWithTinyId(context, proto, field_name, i,
-                                             JSVAL_NULL,
-                                             boxed_field_getter, boxed_field_setter,
-                                             JSPROP_PERMANENT | JSPROP_SHARED);
+        const char *field_name = g_base_info_get_name ((GIBaseInfo *)priv->fields[i].info);
 
-        g_base_info_unref ((GIBaseInfo *)field);
-
-        if (!result)
+        if (!JS_DefinePropertyWithTinyId(context, proto, field_name, i,
+                                         JSVAL_NULL,
+                                         boxed_field_getter, boxed_field_setter,
+                                         JSPROP_PERMANENT | JSPROP_SHARED))
             return JS_FALSE;
     }
 
@@ -1169,7 +1534,7 @@ gjs_define_boxed_class(JSContext    *context,
     }
 
     GJS_INC_COUNTER(boxed);
-    priv = g_slice_new0(Boxed);
+    priv = boxed_alloc(context, 0);
     priv->info = info;
     boxed_fill_prototype_info(context, priv);
 
@@ -1181,6 +1546,8 @@ gjs_define_boxed_class(JSContext    *context,
               constructor_name, prototype, JS_GetClass(prototype), in_object);
 
     priv->can_allocate_directly = struct_is_simple (priv->info);
+    if (priv->can_allocate_directly)
+        priv->inline_class = get_inline_class (priv->info);
 
     define_boxed_class_fields (context, priv, prototype);
     gjs_define_static_methods (context, constructor, priv->gtype, priv->info);
@@ -1216,10 +1583,8 @@ gjs_boxed_from_c_struct(JSContext             *context,
                                      gjs_get_import_global (context));
 
     GJS_INC_COUNTER(boxed);
-    priv = g_slice_new0(Boxed);
-
-    *priv = *proto_priv;
-    g_base_info_ref( (GIBaseInfo*) priv->info);
+    priv = boxed_alloc(context, (flags & GJS_BOXED_CREATION_NO_COPY) ? 0 : proto_priv->inline_class);
+    boxed_init_instance(priv, proto_priv);
 
     JS_SetPrivate(obj, priv);
 
@@ -1231,8 +1596,14 @@ gjs_boxed_from_c_struct(JSContext             *context,
         priv->gboxed = gboxed;
         priv->not_owning_gboxed = TRUE;
     } else {
-        if (priv->gtype != G_TYPE_NONE && g_type_is_a (priv->gtype, G_TYPE_BOXED)) {
+        if (priv->alloc_class != 0) {
+            /* A simple struct, copied into the same allocation as
+             * priv, like boxed_new() allocates it directly */
+            boxed_new_direct(priv);
+            memcpy(priv->gboxed, gboxed, g_struct_info_get_size (priv->info));
+        } else if (priv->gtype != G_TYPE_NONE && g_type_is_a (priv->gtype, G_TYPE_BOXED)) {
             priv->gboxed = g_boxed_copy(priv->gtype, gboxed);
+            alloc_stats.struct_allocs++;
         } else if (priv->gtype == G_TYPE_VARIANT) {
             priv->gboxed = g_variant_ref_sink ((GVariant *) gboxed);
         } else if (priv->can_allocate_directly) {
@@ -37,6 +37,13 @@ typedef enum {
     GJS_BOXED_CREATION_NO_COPY = (1 << 0)
 } GjsBoxedCreationFlags;
 
+typedef struct {
+    guint64 wrappers;       /* Boxed instances handed out */
+    guint64 slab_allocs;    /* of those, newly allocated rather than recycled */
+    guint64 struct_allocs;  /* separate allocations for struct memory */
+    guint64 inline_structs; /* structs stored inline in their Boxed */
+} GjsBoxedAllocStats;
+
 /* Hack for now... why doesn't gobject-introspection have this? */
 typedef GIStructInfo GIBoxedInfo;
 
@@ -57,6 +64,9 @@ JSBool    gjs_typecheck_boxed          (JSContext             *context,
                                         GType                  expected_type,
                                         JSBool                 throw_error);
 
+void      gjs_boxed_get_alloc_stats    (GjsBoxedAllocStats    *stats);
+void      gjs_boxed_release_free_lists (JSRuntime             *runtime);
+
 G_END_DECLS
 
 #endif  /* __GJS_BOXED_H__ */
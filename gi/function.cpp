@@ -34,38 +34,413 @@
 #include <cjs/compat.h>
 
 #include <util/log.h>
+#include <util/misc.h>
+#include <util/arena.h>
 
 #include <girepository.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 /* We use guint8 for arguments; functions can't
  * have more than this.
  */
 #define GJS_ARG_INDEX_INVALID G_MAXUINT8
 
+typedef struct _GjsArgPlan GjsArgPlan;
+
+/* @arena holds (transfer none) temporaries for the duration of the
+ * call; it may be NULL for marshallers that never use it */
+typedef JSBool (*GjsArgInMarshaller) (JSContext  *context,
+                                      GjsArgPlan *plan,
+                                      jsval       value,
+                                      GjsArena   *arena,
+                                      GArgument  *arg);
+
+/* Everything gjs_invoke_c_function() needs to know about one argument,
+ * compiled from the typelib once in init_cached_function_data() so
+ * that the invoke loop never has to query GIRepository.
+ *
+ * @arg_info and @type_info are "stack" infos loaded in place; they
+ * are not refcounted and stay valid as long as Function->info does.
+ */
+struct _GjsArgPlan {
+    GIArgInfo arg_info;
+    GITypeInfo type_info;
+    const char *name;
+
+    GjsParamType param_type;
+    GIDirection direction;
+    GITypeTag type_tag;
+    GITransfer transfer;
+    GIScopeType scope;
+    GjsArgumentType argument_type;
+    gboolean may_be_null;
+    gboolean caller_allocates;
+
+    /* Size of the struct or union allocated for (out caller-allocates),
+     * or 0 if the type is not supported */
+    gsize caller_allocates_size;
+
+    /* Index into the plan of the array length, callback user_data and
+     * GDestroyNotify arguments, or -1 */
+    gint array_length_pos;
+    gint closure_pos;
+    gint destroy_pos;
+
+    /* Number of elements of a fixed-size C array, or -1 */
+    gint array_fixed_size;
+
+    /* For (in) (transfer none) C arrays of numbers, the element type a
+     * typed array must have for its storage to be passed as-is;
+     * GI_TYPE_TAG_VOID otherwise. Only set if the array has a length
+     * argument or a fixed size, since C can't know how long it is
+     * otherwise */
+    GITypeTag borrow_element_type;
+
+    /* Converts the JS value for PARAM_NORMAL in and inout arguments */
+    GjsArgInMarshaller marshal_in;
+
+    /* marshal_in allocates from the per-call arena, so there is
+     * nothing to release after the call */
+    gboolean in_arena;
+};
+
+/* Optional per-function call statistics, see gjs_function_dump_call_stats().
+ * Entries are keyed by qualified name rather than hung off Function so
+ * that they outlive the function objects feeding them; they are never
+ * freed, only reset.
+ */
+#define GJS_CALL_STATS_N_BUCKETS 32
+
+typedef struct {
+    char *name;
+    char *ns;
+    guint64 n_calls;
+    guint64 total_ns;
+    /* histogram[i] counts the calls that took [2^i, 2^(i+1)) ns */
+    guint64 histogram[GJS_CALL_STATS_N_BUCKETS];
+} GjsCallStats;
+
+static gboolean call_stats_enabled = FALSE;
+static GHashTable *call_stats_table = NULL; /* name -> GjsCallStats */
+
+/* Whether functions are kept off gjs_invoke_c_function_simple(); -1
+ * until GJS_DISABLE_SIMPLE_INVOKE is checked */
+static int simple_invoke_disabled = -1;
+
 typedef struct {
     GIFunctionInfo *info;
 
-    GjsParamType *param_types;
+    GjsArgPlan *arg_plan;
 
+    GITypeInfo return_info;
+    GITypeTag return_tag;
+    GITransfer return_transfer;
+    gint return_array_length_pos;
+
+    guint8 gi_argc;
     guint8 expected_js_argc;
     guint8 js_out_argc;
+    guint is_method : 1;
+    guint can_throw_gerror : 1;
+    /* Only scalar or object in-arguments and a scalar or void return,
+     * see function_is_simple() */
+    guint is_simple : 1;
     GIFunctionInvoker invoker;
+
+    /* Resolved on the first call made while statistics are enabled */
+    GjsCallStats *call_stats;
 } Function;
 
 extern struct JSClass gjs_function_class;
 
+/* How to marshal one argument of a callback, see GjsCallbackPlan */
+typedef struct {
+    GIArgInfo arg_info;
+    GITypeInfo type_info;
+    GIDirection direction;
+    GjsParamType param_type;
+    gint array_length_pos;  /* for PARAM_ARRAY */
+    guint is_void : 1;      /* void * arguments are skipped */
+} GjsCallbackArgPlan;
+
+/* What gjs_callback_closure() needs to know about a callback
+ * signature, worked out once instead of on every call. Trampolines for
+ * the same callback type share one plan, and so do the trampolines of
+ * all classes overriding the same virtual function.
+ */
+struct _GjsCallbackPlan {
+    gint ref_count;
+    GICallableInfo *info;
+    char *vfunc_name;          /* "Namespace.Type.vfunc", NULL if not a vfunc */
+    int n_args;
+    int n_outargs;
+    GjsCallbackArgPlan *args;
+    GITypeInfo return_info;
+    guint return_is_void : 1;
+    guint64 n_calls;           /* only counted for vfuncs */
+};
+
+static GHashTable *vfunc_plans = NULL;  /* vfunc name -> GjsCallbackPlan */
+
+/* Returns NULL with an exception set if the callback can't be
+ * marshalled */
+static GjsCallbackPlan *
+callback_plan_new(JSContext      *context,
+                  GICallableInfo *callable_info)
+{
+    GjsCallbackPlan *plan;
+    int i;
+
+    plan = g_slice_new0(GjsCallbackPlan);
+    plan->ref_count = 1;
+    plan->info = (GICallableInfo *) g_base_info_ref((GIBaseInfo *) callable_info);
+    plan->n_args = g_callable_info_get_n_args(callable_info);
+    plan->args = g_new0(GjsCallbackArgPlan, plan->n_args);
+
+    g_callable_info_load_return_type(callable_info, &plan->return_info);
+    plan->return_is_void = g_type_info_get_tag(&plan->return_info) == GI_TYPE_TAG_VOID;
+
+    /* Load everything first, since array arguments mark their
+     * length arguments as skipped */
+    for (i = 0; i < plan->n_args; i++) {
+        GjsCallbackArgPlan *arg = &plan->args[i];
+
+        g_callable_info_load_arg(callable_info, i, &arg->arg_info);
+        g_arg_info_load_type(&arg->arg_info, &arg->type_info);
+        arg->direction = g_arg_info_get_direction(&arg->arg_info);
+        arg->is_void = g_type_info_get_tag(&arg->type_info) == GI_TYPE_TAG_VOID;
+        arg->array_length_pos = -1;
+
+        if (!arg->is_void && arg->direction != GI_DIRECTION_IN)
+            plan->n_outargs++;
+    }
+
+    /* Analyze param types and directions, similarly to init_cached_function_data */
+    for (i = 0; i < plan->n_args; i++) {
+        GjsCallbackArgPlan *arg = &plan->args[i];
+        GITypeTag type_tag;
+
+        if (arg->param_type == PARAM_SKIPPED)
+            continue;
+
+        if (arg->direction != GI_DIRECTION_IN) {
+            /* INOUT and OUT arguments are handled differently. */
+            continue;
+        }
+
+        type_tag = g_type_info_get_tag(&arg->type_info);
+
+        if (type_tag == GI_TYPE_TAG_INTERFACE) {
+            GIBaseInfo* interface_info;
+            GIInfoType interface_type;
+
+            interface_info = g_type_info_get_interface(&arg->type_info);
+            interface_type = g_base_info_get_type(interface_info);
+            g_base_info_unref(interface_info);
+            if (interface_type == GI_INFO_TYPE_CALLBACK) {
+                gjs_throw(context, "Callback accepts another callback as a parameter. This is not supported");
+                goto fail;
+            }
+        } else if (type_tag == GI_TYPE_TAG_ARRAY) {
+            if (g_type_info_get_array_type(&arg->type_info) == GI_ARRAY_TYPE_C) {
+                int array_length_pos = g_type_info_get_array_length(&arg->type_info);
+
+                if (array_length_pos >= 0 && array_length_pos < plan->n_args) {
+                    if (plan->args[array_length_pos].direction != arg->direction) {
+                        gjs_throw(context, "Callback has an array with different-direction length arg, not supported");
+                        goto fail;
+                    }
+
+                    plan->args[array_length_pos].param_type = PARAM_SKIPPED;
+                    arg->param_type = PARAM_ARRAY;
+                    arg->array_length_pos = array_length_pos;
+                }
+            }
+        }
+    }
+
+    return plan;
+
+ fail:
+    g_base_info_unref((GIBaseInfo *) plan->info);
+    g_free(plan->args);
+    g_slice_free(GjsCallbackPlan, plan);
+    return NULL;
+}
+
+static void
+callback_plan_unref(GjsCallbackPlan *plan)
+{
+    plan->ref_count--;
+    if (plan->ref_count > 0)
+        return;
+
+    g_base_info_unref((GIBaseInfo *) plan->info);
+    g_free(plan->args);
+    g_free(plan->vfunc_name);
+    g_slice_free(GjsCallbackPlan, plan);
+}
+
 /* Because we can't free the mmap'd data for a callback
- * while it's in use, this list keeps track of ones that
- * will be freed the next time we invoke a C function.
+ * while it's in use, completed async trampolines are queued
+ * here and released from an idle handler, at most
+ * TRAMPOLINE_RECLAIM_BATCH_SIZE per main loop iteration.
+ */
+#define TRAMPOLINE_RECLAIM_BATCH_SIZE 64
+
+static GQueue completed_trampolines = G_QUEUE_INIT;  /* GjsCallbackTrampoline */
+static guint reclaim_trampolines_idle_id = 0;
+
+/* Released callback trampolines are kept here, keyed by callback type
+ * ("Namespace.Callback"), so that their ffi closure and cif can be
+ * reused for the next JS function passed for the same callback type
+ * instead of allocating a new executable closure every time.
  */
-static GSList *completed_trampolines = NULL;  /* GjsCallbackTrampoline */
+#define TRAMPOLINE_POOL_DEFAULT_SIZE 128
+
+static GHashTable *trampoline_pool = NULL;  /* pool key -> GQueue of GjsCallbackTrampoline */
+static GjsTrampolinePoolStats trampoline_pool_stats;
 
 GJS_DEFINE_PRIV_FROM_JS(Function, gjs_function_class)
 
+static guint
+get_trampoline_pool_max_size(void)
+{
+    static gsize max_size_plus_one = 0;
+
+    if (g_once_init_enter(&max_size_plus_one)) {
+        const char *env = g_getenv("GJS_TRAMPOLINE_POOL_SIZE");
+        gsize max_size = TRAMPOLINE_POOL_DEFAULT_SIZE;
+
+        if (env != NULL)
+            max_size = strtoul(env, NULL, 10);
+
+        g_once_init_leave(&max_size_plus_one, max_size + 1);
+    }
+
+    return max_size_plus_one - 1;
+}
+
+/* Returns NULL for trampolines that can't be pooled */
+static char *
+get_trampoline_pool_key(GICallableInfo *callable_info,
+                        gboolean        is_vfunc)
+{
+    const char *name;
+
+    /* vfunc trampolines live as long as their class */
+    if (is_vfunc)
+        return NULL;
+
+    name = g_base_info_get_name((GIBaseInfo *) callable_info);
+    if (name == NULL)
+        return NULL;
+
+    return g_strdup_printf("%s.%s",
+                           g_base_info_get_namespace((GIBaseInfo *) callable_info),
+                           name);
+}
+
+static GjsCallbackTrampoline *
+trampoline_pool_take(const char *pool_key)
+{
+    GQueue *queue;
+    GjsCallbackTrampoline *trampoline;
+
+    if (trampoline_pool == NULL)
+        return NULL;
+
+    queue = (GQueue *) g_hash_table_lookup(trampoline_pool, pool_key);
+    if (queue == NULL)
+        return NULL;
+
+    trampoline = (GjsCallbackTrampoline *) g_queue_pop_head(queue);
+    if (trampoline != NULL)
+        trampoline_pool_stats.size--;
+
+    return trampoline;
+}
+
+static gboolean
+trampoline_pool_give(GjsCallbackTrampoline *trampoline)
+{
+    GQueue *queue;
+
+    if (trampoline->pool_key == NULL ||
+        trampoline_pool_stats.size >= get_trampoline_pool_max_size())
+        return FALSE;
+
+    if (trampoline_pool == NULL)
+        trampoline_pool = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                g_free, (GDestroyNotify) g_queue_free);
+
+    queue = (GQueue *) g_hash_table_lookup(trampoline_pool, trampoline->pool_key);
+    if (queue == NULL) {
+        queue = g_queue_new();
+        g_hash_table_insert(trampoline_pool, g_strdup(trampoline->pool_key), queue);
+    }
+
+    g_queue_push_head(queue, trampoline);
+
+    trampoline_pool_stats.size++;
+    if (trampoline_pool_stats.size > trampoline_pool_stats.high_water)
+        trampoline_pool_stats.high_water = trampoline_pool_stats.size;
+
+    return TRUE;
+}
+
+static void
+callback_trampoline_free(GjsCallbackTrampoline *trampoline)
+{
+    g_callable_info_free_closure(trampoline->info, trampoline->closure);
+    g_base_info_unref( (GIBaseInfo*) trampoline->info);
+    callback_plan_unref(trampoline->plan);
+    g_free (trampoline->pool_key);
+    g_slice_free(GjsCallbackTrampoline, trampoline);
+}
+
+/**
+ * gjs_callback_trampoline_release_pool:
+ *
+ * Frees the pooled trampolines and their closures. Meant for context
+ * teardown, since pooled trampolines still point to the context they
+ * were last used with.
+ */
+void
+gjs_callback_trampoline_release_pool(void)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    if (trampoline_pool == NULL)
+        return;
+
+    g_hash_table_iter_init(&iter, trampoline_pool);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        GQueue *queue = (GQueue *) value;
+        GjsCallbackTrampoline *trampoline;
+
+        while ((trampoline = (GjsCallbackTrampoline *) g_queue_pop_head(queue)))
+            callback_trampoline_free(trampoline);
+    }
+
+    g_hash_table_destroy(trampoline_pool);
+    trampoline_pool = NULL;
+    trampoline_pool_stats.size = 0;
+}
+
+void
+gjs_callback_trampoline_get_pool_stats(GjsTrampolinePoolStats *stats)
+{
+    *stats = trampoline_pool_stats;
+    stats->max_size = get_trampoline_pool_max_size();
+}
+
 void
 gjs_callback_trampoline_ref(GjsCallbackTrampoline *trampoline)
 {
@@ -86,11 +461,14 @@ gjs_callback_trampoline_unref(GjsCallbackTrampoline *trampoline)
             JS_RemoveValueRoot(context, &trampoline->js_function);
             JS_EndRequest(context);
         }
+        trampoline->js_function = JSVAL_NULL;
+
+        /* The closure keeps pointing at this trampoline and its cif,
+         * so a pooled trampoline only needs a new JS function */
+        if (trampoline_pool_give(trampoline))
+            return;
 
-        g_callable_info_free_closure(trampoline->info, trampoline->closure);
-        g_base_info_unref( (GIBaseInfo*) trampoline->info);
-        g_free (trampoline->param_types);
-        g_slice_free(GjsCallbackTrampoline, trampoline);
+        callback_trampoline_free(trampoline);
     }
 }
 
@@ -153,6 +531,72 @@ set_return_ffi_arg_from_giargument (GITypeInfo  *ret_type,
     }
 }
 
+/* Releases at most TRAMPOLINE_RECLAIM_BATCH_SIZE completed trampolines */
+static void
+reclaim_trampoline_batch(void)
+{
+    guint i;
+
+    for (i = 0; i < TRAMPOLINE_RECLAIM_BATCH_SIZE; i++) {
+        GjsCallbackTrampoline *trampoline;
+
+        trampoline = (GjsCallbackTrampoline *) g_queue_pop_head(&completed_trampolines);
+        if (trampoline == NULL)
+            break;
+
+        gjs_callback_trampoline_unref(trampoline);
+    }
+}
+
+static gboolean
+reclaim_completed_trampolines(gpointer data)
+{
+    reclaim_trampoline_batch();
+
+    if (g_queue_is_empty(&completed_trampolines)) {
+        reclaim_trampolines_idle_id = 0;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+queue_completed_trampoline(GjsCallbackTrampoline *trampoline)
+{
+    g_queue_push_tail(&completed_trampolines, trampoline);
+
+    if (reclaim_trampolines_idle_id == 0)
+        reclaim_trampolines_idle_id = g_idle_add(reclaim_completed_trampolines, NULL);
+}
+
+/**
+ * gjs_callback_trampoline_reclaim_all:
+ *
+ * Releases every queued async trampoline right away, without waiting
+ * for the idle handler. Must not be called from inside a callback;
+ * this is meant for context teardown.
+ */
+void
+gjs_callback_trampoline_reclaim_all(void)
+{
+    GjsCallbackTrampoline *trampoline;
+
+    if (reclaim_trampolines_idle_id != 0) {
+        g_source_remove(reclaim_trampolines_idle_id);
+        reclaim_trampolines_idle_id = 0;
+    }
+
+    while ((trampoline = (GjsCallbackTrampoline *) g_queue_pop_head(&completed_trampolines)))
+        gjs_callback_trampoline_unref(trampoline);
+}
+
+guint
+gjs_callback_trampoline_get_n_pending(void)
+{
+    return g_queue_get_length(&completed_trampolines);
+}
+
 /* This is our main entry point for ffi_closure callbacks.
  * ffi_prep_closure is doing pure magic and replaces the original
  * function call with this one which gives us the ffi arguments,
@@ -170,17 +614,19 @@ gjs_callback_closure(ffi_cif *cif,
     JSRuntime *runtime;
     JSObject *global;
     GjsCallbackTrampoline *trampoline;
+    GjsCallbackPlan *plan;
     int i, n_args, n_jsargs, n_outargs;
     jsval *jsargs, rval;
     JSObject *this_object;
-    GITypeInfo ret_type;
     gboolean success = FALSE;
-    gboolean ret_type_is_void;
+    gboolean saved_typed_array_scope;
 
     trampoline = (GjsCallbackTrampoline *) data;
     g_assert(trampoline);
     gjs_callback_trampoline_ref(trampoline);
 
+    plan = trampoline->plan;
+
     context = trampoline->context;
     runtime = JS_GetRuntime(context);
     if (G_UNLIKELY (gjs_runtime_is_sweeping(runtime))) {
@@ -198,63 +644,50 @@ gjs_callback_closure(ffi_cif *cif,
         return;
     }
 
+    if (plan->vfunc_name != NULL)
+        plan->n_calls++;
+
     JS_BeginRequest(context);
+    /* The callback is not part of a withTypedArrayResults() scope */
+    saved_typed_array_scope = gjs_set_typed_array_results_scope(FALSE);
     global = JS_GetGlobalObject(context);
     JSAutoCompartment ac(context, global);
 
-    n_args = g_callable_info_get_n_args(trampoline->info);
+    n_args = plan->n_args;
+    n_outargs = plan->n_outargs;
 
-    g_assert(n_args >= 0);
-
-    n_outargs = 0;
     jsargs = (jsval*)g_newa(jsval, n_args);
     for (i = 0, n_jsargs = 0; i < n_args; i++) {
-        GIArgInfo arg_info;
-        GITypeInfo type_info;
-        GjsParamType param_type;
-
-        g_callable_info_load_arg(trampoline->info, i, &arg_info);
-        g_arg_info_load_type(&arg_info, &type_info);
+        GjsCallbackArgPlan *arg = &plan->args[i];
 
         /* Skip void * arguments */
-        if (g_type_info_get_tag(&type_info) == GI_TYPE_TAG_VOID)
+        if (arg->is_void)
             continue;
 
-        if (g_arg_info_get_direction(&arg_info) == GI_DIRECTION_OUT) {
-            n_outargs++;
+        if (arg->direction == GI_DIRECTION_OUT)
             continue;
-        }
 
-        if (g_arg_info_get_direction(&arg_info) == GI_DIRECTION_INOUT)
-            n_outargs++;
-
-        param_type = trampoline->param_types[i];
-
-        switch (param_type) {
+        switch (arg->param_type) {
             case PARAM_SKIPPED:
                 continue;
             case PARAM_ARRAY: {
-                gint array_length_pos = g_type_info_get_array_length(&type_info);
-                GIArgInfo array_length_arg;
-                GITypeInfo arg_type_info;
+                GjsCallbackArgPlan *length_arg = &plan->args[arg->array_length_pos];
                 jsval length;
 
-                g_callable_info_load_arg(trampoline->info, array_length_pos, &array_length_arg);
-                g_arg_info_load_type(&array_length_arg, &arg_type_info);
                 if (!gjs_value_from_g_argument(context, &length,
-                                               &arg_type_info,
-                                               (GArgument *) args[array_length_pos], TRUE))
+                                               &length_arg->type_info,
+                                               (GArgument *) args[arg->array_length_pos], TRUE))
                     goto out;
 
                 if (!gjs_value_from_explicit_array(context, &jsargs[n_jsargs++],
-                                                   &type_info, (GArgument*) args[i], JSVAL_TO_INT(length)))
+                                                   &arg->type_info, (GArgument*) args[i], JSVAL_TO_INT(length)))
                     goto out;
                 break;
             }
             case PARAM_NORMAL:
                 if (!gjs_value_from_g_argument(context,
                                                &jsargs[n_jsargs++],
-                                               &type_info,
+                                               &arg->type_info,
                                                (GArgument *) args[i], FALSE))
                     goto out;
                 break;
@@ -281,17 +714,14 @@ gjs_callback_closure(ffi_cif *cif,
         goto out;
     }
 
-    g_callable_info_load_return_type(trampoline->info, &ret_type);
-    ret_type_is_void = g_type_info_get_tag (&ret_type) == GI_TYPE_TAG_VOID;
-
-    if (n_outargs == 0 && !ret_type_is_void) {
+    if (n_outargs == 0 && !plan->return_is_void) {
         GIArgument argument;
 
         /* non-void return value, no out args. Should
          * be a single return value. */
         if (!gjs_value_to_g_argument(context,
                                      rval,
-                                     &ret_type,
+                                     &plan->return_info,
                                      "callback",
                                      GJS_ARGUMENT_RETURN_VALUE,
                                      GI_TRANSFER_NOTHING,
@@ -299,23 +729,21 @@ gjs_callback_closure(ffi_cif *cif,
                                      &argument))
             goto out;
 
-        set_return_ffi_arg_from_giargument(&ret_type,
+        set_return_ffi_arg_from_giargument(&plan->return_info,
                                            result,
                                            &argument);
-    } else if (n_outargs == 1 && ret_type_is_void) {
+    } else if (n_outargs == 1 && plan->return_is_void) {
         /* void return value, one out args. Should
          * be a single return value. */
         for (i = 0; i < n_args; i++) {
-            GIArgInfo arg_info;
-            GITypeInfo type_info;
-            g_callable_info_load_arg(trampoline->info, i, &arg_info);
-            if (g_arg_info_get_direction(&arg_info) == GI_DIRECTION_IN)
+            GjsCallbackArgPlan *arg = &plan->args[i];
+
+            if (arg->direction == GI_DIRECTION_IN)
                 continue;
 
-            g_arg_info_load_type(&arg_info, &type_info);
             if (!gjs_value_to_g_argument(context,
                                          rval,
-                                         &type_info,
+                                         &arg->type_info,
                                          "callback",
                                          GJS_ARGUMENT_ARGUMENT,
                                          GI_TRANSFER_NOTHING,
@@ -331,7 +759,7 @@ gjs_callback_closure(ffi_cif *cif,
         /* more than one of a return value or an out argument.
          * Should be an array of output values. */
 
-        if (!ret_type_is_void) {
+        if (!plan->return_is_void) {
             GIArgument argument;
 
             if (!JS_GetElement(context, JSVAL_TO_OBJECT(rval), elem_idx, &elem))
@@ -339,7 +767,7 @@ gjs_callback_closure(ffi_cif *cif,
 
             if (!gjs_value_to_g_argument(context,
                                          elem,
-                                         &ret_type,
+                                         &plan->return_info,
                                          "callback",
                                          GJS_ARGUMENT_ARGUMENT,
                                          GI_TRANSFER_NOTHING,
@@ -347,7 +775,7 @@ gjs_callback_closure(ffi_cif *cif,
                                          &argument))
                 goto out;
 
-            set_return_ffi_arg_from_giargument(&ret_type,
+            set_return_ffi_arg_from_giargument(&plan->return_info,
                                                result,
                                                &argument);
 
@@ -355,19 +783,17 @@ gjs_callback_closure(ffi_cif *cif,
         }
 
         for (i = 0; i < n_args; i++) {
-            GIArgInfo arg_info;
-            GITypeInfo type_info;
-            g_callable_info_load_arg(trampoline->info, i, &arg_info);
-            if (g_arg_info_get_direction(&arg_info) == GI_DIRECTION_IN)
+            GjsCallbackArgPlan *arg = &plan->args[i];
+
+            if (arg->direction == GI_DIRECTION_IN)
                 continue;
 
-            g_arg_info_load_type(&arg_info, &type_info);
             if (!JS_GetElement(context, JSVAL_TO_OBJECT(rval), elem_idx, &elem))
                 goto out;
 
             if (!gjs_value_to_g_argument(context,
                                          elem,
-                                         &type_info,
+                                         &arg->type_info,
                                          "callback",
                                          GJS_ARGUMENT_ARGUMENT,
                                          GI_TRANSFER_NOTHING,
@@ -386,15 +812,15 @@ out:
         gjs_log_exception (context);
 
         /* Fill in the result with some hopefully neutral value */
-        g_callable_info_load_return_type(trampoline->info, &ret_type);
-        gjs_g_argument_init_default (context, &ret_type, (GArgument *) result);
+        gjs_g_argument_init_default (context, &plan->return_info, (GArgument *) result);
     }
 
     if (trampoline->scope == GI_SCOPE_TYPE_ASYNC) {
-        completed_trampolines = g_slist_prepend(completed_trampolines, trampoline);
+        queue_completed_trampoline(trampoline);
     }
 
     gjs_callback_trampoline_unref(trampoline);
+    gjs_set_typed_array_results_scope(saved_typed_array_scope);
     JS_EndRequest(context);
 }
 
@@ -410,6 +836,37 @@ gjs_destroy_notify_callback(gpointer data)
     gjs_callback_trampoline_unref(trampoline);
 }
 
+/* Takes over the reference on @plan */
+static GjsCallbackTrampoline *
+callback_trampoline_new_for_plan(JSContext       *context,
+                                 jsval            function,
+                                 GjsCallbackPlan *plan,
+                                 char            *pool_key,
+                                 GIScopeType      scope,
+                                 gboolean         is_vfunc)
+{
+    GjsCallbackTrampoline *trampoline;
+
+    trampoline = g_slice_new(GjsCallbackTrampoline);
+    trampoline->pool_key = pool_key;
+    trampoline->ref_count = 1;
+    trampoline->context = context;
+    trampoline->info = plan->info;
+    g_base_info_ref((GIBaseInfo*)trampoline->info);
+    trampoline->plan = plan;
+    trampoline->js_function = function;
+    if (!is_vfunc)
+        JS_AddValueRoot(context, &trampoline->js_function);
+
+    trampoline->closure = g_callable_info_prepare_closure(trampoline->info, &trampoline->cif,
+                                                          gjs_callback_closure, trampoline);
+
+    trampoline->scope = scope;
+    trampoline->is_vfunc = is_vfunc;
+
+    return trampoline;
+}
+
 GjsCallbackTrampoline*
 gjs_callback_trampoline_new(JSContext      *context,
                             jsval           function,
@@ -418,7 +875,8 @@ gjs_callback_trampoline_new(JSContext      *context,
                             gboolean        is_vfunc)
 {
     GjsCallbackTrampoline *trampoline;
-    int n_args, i;
+    GjsCallbackPlan *plan;
+    char *pool_key;
 
     if (JSVAL_IS_NULL(function)) {
         return NULL;
@@ -426,78 +884,86 @@ gjs_callback_trampoline_new(JSContext      *context,
 
     g_assert(JS_TypeOfValue(context, function) == JSTYPE_FUNCTION);
 
-    trampoline = g_slice_new(GjsCallbackTrampoline);
-    trampoline->ref_count = 1;
-    trampoline->context = context;
-    trampoline->info = callable_info;
-    g_base_info_ref((GIBaseInfo*)trampoline->info);
-    trampoline->js_function = function;
-    if (!is_vfunc)
-        JS_AddValueRoot(context, &trampoline->js_function);
-
-    /* Analyze param types and directions, similarly to init_cached_function_data */
-    n_args = g_callable_info_get_n_args(trampoline->info);
-    trampoline->param_types = g_new0(GjsParamType, n_args);
-
-    for (i = 0; i < n_args; i++) {
-        GIDirection direction;
-        GIArgInfo arg_info;
-        GITypeInfo type_info;
-        GITypeTag type_tag;
-
-        if (trampoline->param_types[i] == PARAM_SKIPPED)
-            continue;
-
-        g_callable_info_load_arg(trampoline->info, i, &arg_info);
-        g_arg_info_load_type(&arg_info, &type_info);
+    pool_key = get_trampoline_pool_key(callable_info, is_vfunc);
+    if (pool_key != NULL) {
+        trampoline = trampoline_pool_take(pool_key);
+        if (trampoline != NULL) {
+            g_free(pool_key);
+            trampoline_pool_stats.hits++;
 
-        direction = g_arg_info_get_direction(&arg_info);
-        type_tag = g_type_info_get_tag(&type_info);
+            trampoline->ref_count = 1;
+            trampoline->context = context;
+            trampoline->js_function = function;
+            JS_AddValueRoot(context, &trampoline->js_function);
+            trampoline->scope = scope;
 
-        if (direction != GI_DIRECTION_IN) {
-            /* INOUT and OUT arguments are handled differently. */
-            continue;
+            return trampoline;
         }
+    }
 
-        if (type_tag == GI_TYPE_TAG_INTERFACE) {
-            GIBaseInfo* interface_info;
-            GIInfoType interface_type;
+    trampoline_pool_stats.misses++;
 
-            interface_info = g_type_info_get_interface(&type_info);
-            interface_type = g_base_info_get_type(interface_info);
-            if (interface_type == GI_INFO_TYPE_CALLBACK) {
-                gjs_throw(context, "Callback accepts another callback as a parameter. This is not supported");
-                g_base_info_unref(interface_info);
-                return NULL;
-            }
-            g_base_info_unref(interface_info);
-        } else if (type_tag == GI_TYPE_TAG_ARRAY) {
-            if (g_type_info_get_array_type(&type_info) == GI_ARRAY_TYPE_C) {
-                int array_length_pos = g_type_info_get_array_length(&type_info);
+    plan = callback_plan_new(context, callable_info);
+    if (plan == NULL) {
+        g_free(pool_key);
+        return NULL;
+    }
+
+    return callback_trampoline_new_for_plan(context, function, plan, pool_key,
+                                            scope, is_vfunc);
+}
 
-                if (array_length_pos >= 0 && array_length_pos < n_args) {
-                    GIArgInfo length_arg_info;
+/**
+ * gjs_vfunc_trampoline_new:
+ * @function: the JS implementation
+ * @callback_info: the type of the vtable field being overridden
+ * @vfunc_info: the virtual function being overridden
+ *
+ * Like gjs_callback_trampoline_new() for a vfunc, but the marshalling
+ * plan is shared by every class that overrides @vfunc_info, and calls
+ * through it are counted, see gjs_function_dump_vfunc_stats().
+ */
+GjsCallbackTrampoline*
+gjs_vfunc_trampoline_new(JSContext      *context,
+                         jsval           function,
+                         GICallableInfo *callback_info,
+                         GIVFuncInfo    *vfunc_info)
+{
+    GjsCallbackPlan *plan;
+    GIBaseInfo *container;
+    char *vfunc_name;
 
-                    g_callable_info_load_arg(trampoline->info, array_length_pos, &length_arg_info);
-                    if (g_arg_info_get_direction(&length_arg_info) != direction) {
-                        gjs_throw(context, "Callback has an array with different-direction length arg, not supported");
-                        return NULL;
-                    }
+    g_assert(JS_TypeOfValue(context, function) == JSTYPE_FUNCTION);
 
-                    trampoline->param_types[array_length_pos] = PARAM_SKIPPED;
-                    trampoline->param_types[i] = PARAM_ARRAY;
-                }
-            }
+    container = g_base_info_get_container((GIBaseInfo *) vfunc_info);
+    vfunc_name = g_strdup_printf("%s.%s.%s",
+                                 g_base_info_get_namespace((GIBaseInfo *) vfunc_info),
+                                 container ? g_base_info_get_name(container) : "",
+                                 g_base_info_get_name((GIBaseInfo *) vfunc_info));
+
+    if (vfunc_plans == NULL)
+        vfunc_plans = g_hash_table_new(g_str_hash, g_str_equal);
+
+    plan = (GjsCallbackPlan *) g_hash_table_lookup(vfunc_plans, vfunc_name);
+    if (plan == NULL) {
+        plan = callback_plan_new(context, callback_info);
+        if (plan == NULL) {
+            g_free(vfunc_name);
+            return NULL;
         }
-    }
 
-    trampoline->closure = g_callable_info_prepare_closure(callable_info, &trampoline->cif,
-                                                          gjs_callback_closure, trampoline);
+        /* The table keeps the first reference; vfunc plans are never
+         * freed, like the classes they are used by */
+        plan->vfunc_name = vfunc_name;
+        g_hash_table_insert(vfunc_plans, plan->vfunc_name, plan);
+    } else {
+        g_free(vfunc_name);
+    }
 
-    trampoline->scope = scope;
-    trampoline->is_vfunc = is_vfunc;
+    plan->ref_count++;
 
-    return trampoline;
+    return callback_trampoline_new_for_plan(context, function, plan, NULL,
+                                            GI_SCOPE_TYPE_NOTIFIED, TRUE);
 }
 
 /* an helper function to retrieve array lengths from a GArgument
@@ -615,12 +1081,18 @@ gjs_invoke_c_function(JSContext      *context,
      * @ffi_arg_pointers: For passing data to FFI, we need to create another layer
      *  of indirection; this array is a pointer to an element in in_arg_cvalues
      *  or out_arg_cvalues.
+     * @borrowed_arrays: Whether an in array points into a typed array's
+     *  storage, in which case it must not be released.
+     * @arena: Holds (transfer none) temporaries and caller-allocated out
+     *  structs, all freed together once the call is done.
      * @return_value: The actual return value of the C function, i.e. not an (out) param
      */
     GArgument *in_arg_cvalues;
     GArgument *out_arg_cvalues;
     GArgument *inout_original_arg_cvalues;
     gpointer *ffi_arg_pointers;
+    gboolean *borrowed_arrays;
+    GjsArena arena;
     GIFFIReturnValue return_value;
     gpointer return_value_p; /* Will point inside the union return_value */
     GArgument return_gargument;
@@ -635,30 +1107,20 @@ gjs_invoke_c_function(JSContext      *context,
     gboolean failed, postinvoke_release_failed;
 
     gboolean is_method;
-    GITypeInfo return_info;
     GITypeTag return_tag;
     jsval *return_values = NULL;
     guint8 next_rval = 0; /* index into return_values */
-    GSList *iter;
 
-    /* Because we can't free a closure while we're in it, we defer
-     * freeing until the next time a C function is invoked.  What
-     * we should really do instead is queue it for a GC thread.
-     */
-    if (completed_trampolines) {
-        for (iter = completed_trampolines; iter; iter = iter->next) {
-            GjsCallbackTrampoline *trampoline = (GjsCallbackTrampoline *) iter->data;
-            gjs_callback_trampoline_unref(trampoline);
-        }
-        g_slist_free(completed_trampolines);
-        completed_trampolines = NULL;
-    }
+    /* For processes that don't iterate the main loop; bounded so that
+     * a burst of completed callbacks is spread over several calls */
+    if (G_UNLIKELY(!g_queue_is_empty(&completed_trampolines)))
+        reclaim_trampoline_batch();
 
-    is_method = g_callable_info_is_method(function->info);
-    can_throw_gerror = g_callable_info_can_throw_gerror(function->info);
+    is_method = function->is_method;
+    can_throw_gerror = function->can_throw_gerror;
 
     c_argc = function->invoker.cif.nargs;
-    gi_argc = g_callable_info_get_n_args( (GICallableInfo*) function->info);
+    gi_argc = function->gi_argc;
 
     /* @c_argc is the number of arguments that the underlying C
      * function takes. @gi_argc is the number of arguments the
@@ -683,13 +1145,15 @@ gjs_invoke_c_function(JSContext      *context,
         return JS_FALSE;
     }
 
-    g_callable_info_load_return_type( (GICallableInfo*) function->info, &return_info);
-    return_tag = g_type_info_get_tag(&return_info);
+    return_tag = function->return_tag;
 
     in_arg_cvalues = g_newa(GArgument, c_argc);
     ffi_arg_pointers = g_newa(gpointer, c_argc);
     out_arg_cvalues = g_newa(GArgument, c_argc);
     inout_original_arg_cvalues = g_newa(GArgument, c_argc);
+    borrowed_arrays = g_newa(gboolean, c_argc);
+    memset(borrowed_arrays, 0, c_argc * sizeof(gboolean));
+    gjs_arena_init(&arena);
 
     failed = FALSE;
     c_arg_pos = 0; /* index into in_arg_cvalues, etc */
@@ -705,83 +1169,45 @@ gjs_invoke_c_function(JSContext      *context,
 
     processed_c_args = c_arg_pos;
     for (gi_arg_pos = 0; gi_arg_pos < gi_argc; gi_arg_pos++, c_arg_pos++) {
+        GjsArgPlan *plan = &function->arg_plan[gi_arg_pos];
         GIDirection direction;
-        GIArgInfo arg_info;
         gboolean arg_removed = FALSE;
 
         /* gjs_debug(GJS_DEBUG_GFUNCTION, "gi_arg_pos: %d c_arg_pos: %d js_arg_pos: %d", gi_arg_pos, c_arg_pos, js_arg_pos); */
 
-        g_callable_info_load_arg( (GICallableInfo*) function->info, gi_arg_pos, &arg_info);
-        direction = g_arg_info_get_direction(&arg_info);
+        direction = plan->direction;
 
         g_assert_cmpuint(c_arg_pos, <, c_argc);
         ffi_arg_pointers[c_arg_pos] = &in_arg_cvalues[c_arg_pos];
 
         if (direction == GI_DIRECTION_OUT) {
-            if (g_arg_info_is_caller_allocates(&arg_info)) {
-                GITypeTag type_tag;
-                GITypeInfo ainfo;
-
-                g_arg_info_load_type(&arg_info, &ainfo);
-                type_tag = g_type_info_get_tag(&ainfo);
-
-                switch (type_tag) {
-                case GI_TYPE_TAG_INTERFACE:
-                    {
-                        GIBaseInfo* interface_info;
-                        GIInfoType interface_type;
-                        gsize size;
-
-                        interface_info = g_type_info_get_interface(&ainfo);
-                        g_assert(interface_info != NULL);
-
-                        interface_type = g_base_info_get_type(interface_info);
-
-                        if (interface_type == GI_INFO_TYPE_STRUCT) {
-                            size = g_struct_info_get_size((GIStructInfo*)interface_info);
-                        } else if (interface_type == GI_INFO_TYPE_UNION) {
-                            size = g_union_info_get_size((GIUnionInfo*)interface_info);
-                        } else {
-                            failed = TRUE;
-                        }
-
-                        g_base_info_unref((GIBaseInfo*)interface_info);
-
-                        if (!failed) {
-                            in_arg_cvalues[c_arg_pos].v_pointer = g_slice_alloc0(size);
-                            out_arg_cvalues[c_arg_pos].v_pointer = in_arg_cvalues[c_arg_pos].v_pointer;
-                        }
-                        break;
-                    }
-                default:
+            if (plan->caller_allocates) {
+                if (plan->caller_allocates_size == 0) {
+                    gjs_throw(context, "Unsupported type %s for (out caller-allocates)",
+                              g_type_tag_to_string(plan->type_tag));
                     failed = TRUE;
+                } else {
+                    in_arg_cvalues[c_arg_pos].v_pointer = gjs_arena_alloc0(&arena, plan->caller_allocates_size);
+                    out_arg_cvalues[c_arg_pos].v_pointer = in_arg_cvalues[c_arg_pos].v_pointer;
                 }
-                if (failed)
-                    gjs_throw(context, "Unsupported type %s for (out caller-allocates)", g_type_tag_to_string(type_tag));
             } else {
                 out_arg_cvalues[c_arg_pos].v_pointer = NULL;
                 in_arg_cvalues[c_arg_pos].v_pointer = &out_arg_cvalues[c_arg_pos];
             }
         } else {
             GArgument *in_value;
-            GITypeInfo ainfo;
-            GjsParamType param_type;
-
-            g_arg_info_load_type(&arg_info, &ainfo);
 
             in_value = &in_arg_cvalues[c_arg_pos];
 
-            param_type = function->param_types[gi_arg_pos];
-
-            switch (param_type) {
+            switch (plan->param_type) {
             case PARAM_CALLBACK: {
                 GICallableInfo *callable_info;
-                GIScopeType scope = g_arg_info_get_scope(&arg_info);
+                GIScopeType scope = plan->scope;
                 GjsCallbackTrampoline *trampoline;
                 ffi_closure *closure;
                 jsval value = js_argv[js_arg_pos];
 
-                if (JSVAL_IS_NULL(value) && g_arg_info_may_be_null(&arg_info)) {
+                if (JSVAL_IS_NULL(value) && plan->may_be_null) {
                     closure = NULL;
                     trampoline = NULL;
                 } else {
@@ -789,33 +1215,37 @@ gjs_invoke_c_function(JSContext      *context,
                         gjs_throw(context, "Error invoking %s.%s: Expected function for callback argument %s, got %s",
                                   g_base_info_get_namespace( (GIBaseInfo*) function->info),
                                   g_base_info_get_name( (GIBaseInfo*) function->info),
-                                  g_base_info_get_name( (GIBaseInfo*) &arg_info),
+                                  plan->name,
                                   JS_GetTypeName(context,
                                                  JS_TypeOfValue(context, value)));
                         failed = TRUE;
                         break;
                     }
 
-                    callable_info = (GICallableInfo*) g_type_info_get_interface(&ainfo);
+                    callable_info = (GICallableInfo*) g_type_info_get_interface(&plan->type_info);
                     trampoline = gjs_callback_trampoline_new(context,
                                                              value,
                                                              callable_info,
                                                              scope,
                                                              FALSE);
-                    closure = trampoline->closure;
                     g_base_info_unref(callable_info);
+                    if (trampoline == NULL) {
+                        failed = TRUE;
+                        break;
+                    }
+                    closure = trampoline->closure;
                 }
 
-                gint destroy_pos = g_arg_info_get_destroy(&arg_info);
-                gint closure_pos = g_arg_info_get_closure(&arg_info);
+                gint destroy_pos = plan->destroy_pos;
+                gint closure_pos = plan->closure_pos;
                 if (destroy_pos >= 0) {
                     gint c_pos = is_method ? destroy_pos + 1 : destroy_pos;
-                    g_assert (function->param_types[destroy_pos] == PARAM_SKIPPED);
+                    g_assert (function->arg_plan[destroy_pos].param_type == PARAM_SKIPPED);
                     in_arg_cvalues[c_pos].v_pointer = trampoline ? (gpointer) gjs_destroy_notify_callback : NULL;
                 }
                 if (closure_pos >= 0) {
                     gint c_pos = is_method ? closure_pos + 1 : closure_pos;
-                    g_assert (function->param_types[closure_pos] == PARAM_SKIPPED);
+                    g_assert (function->arg_plan[closure_pos].param_type == PARAM_SKIPPED);
                     in_arg_cvalues[c_pos].v_pointer = trampoline;
                 }
 
@@ -831,22 +1261,26 @@ gjs_invoke_c_function(JSContext      *context,
                 arg_removed = TRUE;
                 break;
             case PARAM_ARRAY: {
-                GIArgInfo array_length_arg;
-
-                gint array_length_pos = g_type_info_get_array_length(&ainfo);
+                GjsArgPlan *length_plan;
+                gint array_length_pos = plan->array_length_pos;
                 gsize length;
 
-                if (!gjs_value_to_explicit_array(context, js_argv[js_arg_pos], &arg_info,
-                                                 in_value, &length)) {
+                if (plan->borrow_element_type != GI_TYPE_TAG_VOID &&
+                    gjs_typed_array_peek_data(js_argv[js_arg_pos],
+                                              plan->borrow_element_type, -1,
+                                              &in_value->v_pointer, &length)) {
+                    borrowed_arrays[c_arg_pos] = TRUE;
+                } else if (!gjs_value_to_explicit_array(context, js_argv[js_arg_pos], &plan->arg_info,
+                                                        in_value, &length)) {
                     failed = TRUE;
                     break;
                 }
 
-                g_callable_info_load_arg(function->info, array_length_pos, &array_length_arg);
+                length_plan = &function->arg_plan[array_length_pos];
 
                 array_length_pos += is_method ? 1 : 0;
-                if (!gjs_value_to_arg(context, INT_TO_JSVAL(length), &array_length_arg,
-                                      in_arg_cvalues + array_length_pos)) {
+                if (!length_plan->marshal_in(context, length_plan, INT_TO_JSVAL(length), &arena,
+                                             in_arg_cvalues + array_length_pos)) {
                     failed = TRUE;
                     break;
                 }
@@ -870,8 +1304,21 @@ gjs_invoke_c_function(JSContext      *context,
             case PARAM_NORMAL:
                 /* Ok, now just convert argument normally */
                 g_assert_cmpuint(js_arg_pos, <, js_argc);
-                if (!gjs_value_to_arg(context, js_argv[js_arg_pos], &arg_info,
-                                      in_value)) {
+                if (plan->borrow_element_type != GI_TYPE_TAG_VOID &&
+                    plan->array_fixed_size >= 0) {
+                    gsize length;
+
+                    /* Fixed-size C array */
+                    if (gjs_typed_array_peek_data(js_argv[js_arg_pos],
+                                                  plan->borrow_element_type,
+                                                  plan->array_fixed_size,
+                                                  &in_value->v_pointer, &length)) {
+                        borrowed_arrays[c_arg_pos] = TRUE;
+                        break;
+                    }
+                }
+                if (!plan->marshal_in(context, plan, js_argv[js_arg_pos],
+                                      &arena, in_value)) {
                     failed = TRUE;
                     break;
                 }
@@ -947,31 +1394,28 @@ gjs_invoke_c_function(JSContext      *context,
         gjs_root_value_locations(context, return_values, function->js_out_argc);
 
         if (return_tag != GI_TYPE_TAG_VOID) {
-            GITransfer transfer = g_callable_info_get_caller_owns((GICallableInfo*) function->info);
+            GITransfer transfer = function->return_transfer;
             gboolean arg_failed = FALSE;
             gint array_length_pos;
 
             g_assert_cmpuint(next_rval, <, function->js_out_argc);
 
-            gi_type_info_extract_ffi_return_value(&return_info, &return_value, &return_gargument);
+            gi_type_info_extract_ffi_return_value(&function->return_info, &return_value, &return_gargument);
 
-            array_length_pos = g_type_info_get_array_length(&return_info);
+            array_length_pos = function->return_array_length_pos;
             if (array_length_pos >= 0) {
-                GIArgInfo array_length_arg;
-                GITypeInfo arg_type_info;
+                GjsArgPlan *length_plan = &function->arg_plan[array_length_pos];
                 jsval length;
 
-                g_callable_info_load_arg(function->info, array_length_pos, &array_length_arg);
-                g_arg_info_load_type(&array_length_arg, &arg_type_info);
                 array_length_pos += is_method ? 1 : 0;
                 arg_failed = !gjs_value_from_g_argument(context, &length,
-                                                        &arg_type_info,
+                                                        &length_plan->type_info,
                                                         &out_arg_cvalues[array_length_pos],
                                                         TRUE);
                 if (!arg_failed && js_rval) {
                     arg_failed = !gjs_value_from_explicit_array(context,
                                                                 &return_values[next_rval],
-                                                                &return_info,
+                                                                &function->return_info,
                                                                 &return_gargument,
                                                                 JSVAL_TO_INT(length));
                 }
@@ -979,21 +1423,21 @@ gjs_invoke_c_function(JSContext      *context,
                     !r_value &&
                     !gjs_g_argument_release_out_array(context,
                                                       transfer,
-                                                      &return_info,
+                                                      &function->return_info,
                                                       JSVAL_TO_INT(length),
                                                       &return_gargument))
                     failed = TRUE;
             } else {
                 if (js_rval)
                     arg_failed = !gjs_value_from_g_argument(context, &return_values[next_rval],
-                                                            &return_info, &return_gargument,
+                                                            &function->return_info, &return_gargument,
                                                             TRUE);
                 /* Free GArgument, the jsval should have ref'd or copied it */
                 if (!arg_failed &&
                     !r_value &&
                     !gjs_g_argument_release(context,
                                             transfer,
-                                            &return_info,
+                                            &function->return_info,
                                             &return_gargument))
                     failed = TRUE;
             }
@@ -1011,16 +1455,12 @@ release:
     c_arg_pos = is_method ? 1 : 0;
     postinvoke_release_failed = FALSE;
     for (gi_arg_pos = 0; gi_arg_pos < gi_argc && c_arg_pos < processed_c_args; gi_arg_pos++, c_arg_pos++) {
+        GjsArgPlan *plan = &function->arg_plan[gi_arg_pos];
         GIDirection direction;
-        GIArgInfo arg_info;
-        GITypeInfo arg_type_info;
         GjsParamType param_type;
 
-        g_callable_info_load_arg( (GICallableInfo*) function->info, gi_arg_pos, &arg_info);
-        direction = g_arg_info_get_direction(&arg_info);
-
-        g_arg_info_load_type(&arg_info, &arg_type_info);
-        param_type = function->param_types[gi_arg_pos];
+        direction = plan->direction;
+        param_type = plan->param_type;
 
         if (direction == GI_DIRECTION_IN || direction == GI_DIRECTION_INOUT) {
             GArgument *arg;
@@ -1028,7 +1468,7 @@ release:
 
             if (direction == GI_DIRECTION_IN) {
                 arg = &in_arg_cvalues[c_arg_pos];
-                transfer = g_arg_info_get_ownership_transfer(&arg_info);
+                transfer = plan->transfer;
             } else {
                 arg = &inout_original_arg_cvalues[c_arg_pos];
                 /* For inout, transfer refers to what we get back from the function; for
@@ -1037,7 +1477,9 @@ release:
                  */
                 transfer = GI_TRANSFER_NOTHING;
             }
-            if (param_type == PARAM_CALLBACK) {
+            if (borrowed_arrays[c_arg_pos] || plan->in_arena) {
+                /* Owned by the typed array or the arena */
+            } else if (param_type == PARAM_CALLBACK) {
                 ffi_closure *closure = (ffi_closure *) arg->v_pointer;
                 if (closure) {
                     GjsCallbackTrampoline *trampoline = (GjsCallbackTrampoline *) closure->user_data;
@@ -1049,23 +1491,16 @@ release:
                 }
             } else if (param_type == PARAM_ARRAY) {
                 gsize length;
-                GIArgInfo array_length_arg;
-                GITypeInfo array_length_type;
-                gint array_length_pos = g_type_info_get_array_length(&arg_type_info);
+                gint array_length_pos = plan->array_length_pos;
 
                 g_assert(array_length_pos >= 0);
 
-                g_callable_info_load_arg(function->info, array_length_pos, &array_length_arg);
-                g_arg_info_load_type(&array_length_arg, &array_length_type);
-
-                array_length_pos += is_method ? 1 : 0;
-
-                length = get_length_from_arg(in_arg_cvalues + array_length_pos,
-                                             g_type_info_get_tag(&array_length_type));
+                length = get_length_from_arg(in_arg_cvalues + array_length_pos + (is_method ? 1 : 0),
+                                             function->arg_plan[array_length_pos].type_tag);
 
                 if (!gjs_g_argument_release_in_array(context,
                                                      transfer,
-                                                     &arg_type_info,
+                                                     &plan->type_info,
                                                      length,
                                                      arg)) {
                     postinvoke_release_failed = TRUE;
@@ -1073,7 +1508,7 @@ release:
             } else if (param_type == PARAM_NORMAL) {
                 if (!gjs_g_argument_release_in_arg(context,
                                                    transfer,
-                                                   &arg_type_info,
+                                                   &plan->type_info,
                                                    arg)) {
                     postinvoke_release_failed = TRUE;
                 }
@@ -1092,37 +1527,33 @@ release:
             gboolean arg_failed = FALSE;
             gint array_length_pos;
             jsval array_length;
-            GITransfer transfer;
 
             g_assert(next_rval < function->js_out_argc);
 
             arg = &out_arg_cvalues[c_arg_pos];
 
-            array_length_pos = g_type_info_get_array_length(&arg_type_info);
+            array_length_pos = plan->array_length_pos;
 
             if (js_rval) {
                 if (array_length_pos >= 0) {
-                    GIArgInfo array_length_arg;
-                    GITypeInfo array_length_type_info;
+                    GjsArgPlan *length_plan = &function->arg_plan[array_length_pos];
 
-                    g_callable_info_load_arg(function->info, array_length_pos, &array_length_arg);
-                    g_arg_info_load_type(&array_length_arg, &array_length_type_info);
                     array_length_pos += is_method ? 1 : 0;
                     arg_failed = !gjs_value_from_g_argument(context, &array_length,
-                                                            &array_length_type_info,
+                                                            &length_plan->type_info,
                                                             &out_arg_cvalues[array_length_pos],
                                                             TRUE);
                     if (!arg_failed) {
                         arg_failed = !gjs_value_from_explicit_array(context,
                                                                     &return_values[next_rval],
-                                                                    &arg_type_info,
+                                                                    &plan->type_info,
                                                                     arg,
                                                                     JSVAL_TO_INT(array_length));
                     }
                 } else {
                     arg_failed = !gjs_value_from_g_argument(context,
                                                             &return_values[next_rval],
-                                                            &arg_type_info,
+                                                            &plan->type_info,
                                                             arg,
                                                             TRUE);
                 }
@@ -1132,49 +1563,26 @@ release:
                 postinvoke_release_failed = TRUE;
 
             /* For caller-allocates, what happens here is we allocate
-             * a structure above, then gjs_value_from_g_argument calls
-             * g_boxed_copy on it, and takes ownership of that.  So
-             * here we release the memory allocated above.  It would be
-             * better to special case this and directly hand JS the boxed
-             * object and tell gjs_boxed it owns the memory, but for now
-             * this works OK.  We could also alloca() the structure instead
-             * of slice allocating.
+             * a structure from the arena above, then
+             * gjs_value_from_g_argument calls g_boxed_copy on it, and
+             * takes ownership of that. The arena memory goes away with
+             * the rest of the arena below. It would be better to special
+             * case this and directly hand JS the boxed object and tell
+             * gjs_boxed it owns the memory, but for now this works OK.
              */
-            if (g_arg_info_is_caller_allocates(&arg_info)) {
-                GITypeTag type_tag;
-                GIBaseInfo* interface_info;
-                GIInfoType interface_type;
-                gsize size;
-
-                type_tag = g_type_info_get_tag(&arg_type_info);
-                g_assert(type_tag == GI_TYPE_TAG_INTERFACE);
-                interface_info = g_type_info_get_interface(&arg_type_info);
-                interface_type = g_base_info_get_type(interface_info);
-                if (interface_type == GI_INFO_TYPE_STRUCT) {
-                    size = g_struct_info_get_size((GIStructInfo*)interface_info);
-                } else if (interface_type == GI_INFO_TYPE_UNION) {
-                    size = g_union_info_get_size((GIUnionInfo*)interface_info);
-                } else {
-                    g_assert_not_reached();
-                }
-
-                g_slice_free1(size, out_arg_cvalues[c_arg_pos].v_pointer);
-                g_base_info_unref((GIBaseInfo*)interface_info);
-            }
 
             /* Free GArgument, the jsval should have ref'd or copied it */
-            transfer = g_arg_info_get_ownership_transfer(&arg_info);
             if (!arg_failed) {
                 if (array_length_pos >= 0) {
                     gjs_g_argument_release_out_array(context,
-                                                     transfer,
-                                                     &arg_type_info,
+                                                     plan->transfer,
+                                                     &plan->type_info,
                                                      JSVAL_TO_INT(array_length),
                                                      arg);
                 } else {
                     gjs_g_argument_release(context,
-                                           transfer,
-                                           &arg_type_info,
+                                           plan->transfer,
+                                           &plan->type_info,
                                            arg);
                 }
             }
@@ -1217,6 +1625,8 @@ release:
         }
     }
 
+    gjs_arena_clear(&arena);
+
     if (!failed && did_throw_gerror) {
         gjs_throw_g_error(context, local_error);
         return JS_FALSE;
@@ -1227,6 +1637,146 @@ release:
     }
 }
 
+/* Specialized version of gjs_invoke_c_function() for functions where
+ * function_is_simple() holds: there are no out arguments, nothing to
+ * release after the call, no callbacks and no GError, so all of that
+ * machinery can be skipped.
+ */
+static JSBool
+gjs_invoke_c_function_simple(JSContext      *context,
+                             Function       *function,
+                             JSObject       *obj, /* "this" object */
+                             unsigned        js_argc,
+                             jsval          *js_argv,
+                             jsval          *js_rval)
+{
+    GArgument *in_arg_cvalues;
+    gpointer *ffi_arg_pointers;
+    GIFFIReturnValue return_value;
+    gpointer return_value_p;
+    GArgument return_gargument;
+    guint8 gi_arg_pos, c_arg_pos;
+    guint8 c_argc;
+
+    if (js_argc < function->expected_js_argc) {
+        gjs_throw(context, "Too few arguments to %s %s.%s expected %d got %d",
+                  function->is_method ? "method" : "function",
+                  g_base_info_get_namespace( (GIBaseInfo*) function->info),
+                  g_base_info_get_name( (GIBaseInfo*) function->info),
+                  function->expected_js_argc,
+                  js_argc);
+        return JS_FALSE;
+    }
+
+    c_argc = function->invoker.cif.nargs;
+    in_arg_cvalues = g_newa(GArgument, c_argc);
+    ffi_arg_pointers = g_newa(gpointer, c_argc);
+
+    c_arg_pos = 0;
+    if (function->is_method) {
+        if (!gjs_fill_method_instance(context, obj,
+                                      function, &in_arg_cvalues[0]))
+            return JS_FALSE;
+        ffi_arg_pointers[0] = &in_arg_cvalues[0];
+        ++c_arg_pos;
+    }
+
+    /* Every argument is PARAM_NORMAL and (in), so GI, C and JS
+     * positions advance together */
+    for (gi_arg_pos = 0; gi_arg_pos < function->gi_argc; gi_arg_pos++, c_arg_pos++) {
+        GjsArgPlan *plan = &function->arg_plan[gi_arg_pos];
+
+        ffi_arg_pointers[c_arg_pos] = &in_arg_cvalues[c_arg_pos];
+        if (!plan->marshal_in(context, plan, js_argv[gi_arg_pos], NULL,
+                              &in_arg_cvalues[c_arg_pos]))
+            return JS_FALSE;
+    }
+
+    g_assert_cmpuint(c_arg_pos, ==, c_argc);
+
+    if (function->return_tag == GI_TYPE_TAG_FLOAT)
+        return_value_p = &return_value.v_float;
+    else if (function->return_tag == GI_TYPE_TAG_DOUBLE)
+        return_value_p = &return_value.v_double;
+    else if (function->return_tag == GI_TYPE_TAG_INT64 ||
+             function->return_tag == GI_TYPE_TAG_UINT64)
+        return_value_p = &return_value.v_uint64;
+    else
+        return_value_p = &return_value.v_long;
+    ffi_call(&(function->invoker.cif), FFI_FN(function->invoker.native_address), return_value_p, ffi_arg_pointers);
+
+    if (function->return_tag == GI_TYPE_TAG_VOID) {
+        *js_rval = JSVAL_VOID;
+        return JS_TRUE;
+    }
+
+    gi_type_info_extract_ffi_return_value(&function->return_info, &return_value, &return_gargument);
+    return gjs_value_from_g_argument(context, js_rval, &function->return_info,
+                                     &return_gargument, TRUE);
+}
+
+static guint64
+get_monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (guint64) ts.tv_sec * G_GUINT64_CONSTANT(1000000000) + ts.tv_nsec;
+}
+
+static GjsCallStats *
+lookup_call_stats(Function *function)
+{
+    GIBaseInfo *info = (GIBaseInfo *) function->info;
+    GIBaseInfo *container;
+    GjsCallStats *stats;
+    char *name;
+
+    container = g_base_info_get_container(info);
+    name = g_strdup_printf("%s.%s%s%s%s",
+                           g_base_info_get_namespace(info),
+                           container ? g_base_info_get_name(container) : "",
+                           container ? "." : "",
+                           g_base_info_get_type(info) == GI_INFO_TYPE_VFUNC ? "vfunc_" : "",
+                           g_base_info_get_name(info));
+
+    if (call_stats_table == NULL)
+        call_stats_table = g_hash_table_new(g_str_hash, g_str_equal);
+
+    stats = (GjsCallStats *) g_hash_table_lookup(call_stats_table, name);
+    if (stats != NULL) {
+        g_free(name);
+        return stats;
+    }
+
+    stats = g_slice_new0(GjsCallStats);
+    stats->name = name;
+    stats->ns = g_strdup(g_base_info_get_namespace(info));
+    g_hash_table_insert(call_stats_table, stats->name, stats);
+
+    return stats;
+}
+
+static void
+record_call_stats(Function *function,
+                  guint64   elapsed_ns)
+{
+    GjsCallStats *stats;
+    guint bucket;
+
+    if (function->call_stats == NULL)
+        function->call_stats = lookup_call_stats(function);
+    stats = function->call_stats;
+
+    bucket = g_bit_storage((gulong) elapsed_ns) - 1;
+    if (bucket >= GJS_CALL_STATS_N_BUCKETS)
+        bucket = GJS_CALL_STATS_N_BUCKETS - 1;
+
+    stats->n_calls++;
+    stats->total_ns += elapsed_ns;
+    stats->histogram[bucket]++;
+}
+
 static JSBool
 function_call(JSContext *context,
               unsigned   js_argc,
@@ -1248,7 +1798,20 @@ function_call(JSContext *context,
         return JS_TRUE; /* we are the prototype, or have the wrong class */
 
 
-    success = gjs_invoke_c_function(context, priv, object, js_argc, js_argv, &retval, NULL);
+    if (G_UNLIKELY(call_stats_enabled)) {
+        guint64 start = get_monotonic_ns();
+
+        if (priv->is_simple)
+            success = gjs_invoke_c_function_simple(context, priv, object, js_argc, js_argv, &retval);
+        else
+            success = gjs_invoke_c_function(context, priv, object, js_argc, js_argv, &retval, NULL);
+
+        record_call_stats(priv, get_monotonic_ns() - start);
+    } else if (priv->is_simple) {
+        success = gjs_invoke_c_function_simple(context, priv, object, js_argc, js_argv, &retval);
+    } else {
+        success = gjs_invoke_c_function(context, priv, object, js_argc, js_argv, &retval, NULL);
+    }
     if (success)
         JS_SET_RVAL(context, vp, retval);
 
@@ -1265,8 +1828,8 @@ uninit_cached_function_data (Function *function)
 {
     if (function->info)
         g_base_info_unref( (GIBaseInfo*) function->info);
-    if (function->param_types)
-        g_free(function->param_types);
+    if (function->arg_plan)
+        g_free(function->arg_plan);
 
     g_function_invoker_destroy(&function->invoker);
 }
@@ -1304,17 +1867,13 @@ get_num_arguments (JSContext *context,
     if (priv == NULL)
         return JS_FALSE;
 
-    n_args = g_callable_info_get_n_args(priv->info);
+    n_args = priv->gi_argc;
     n_jsargs = 0;
     for (i = 0; i < n_args; i++) {
-        GIArgInfo arg_info;
-
-        if (priv->param_types[i] == PARAM_SKIPPED)
+        if (priv->arg_plan[i].param_type == PARAM_SKIPPED)
             continue;
 
-        g_callable_info_load_arg(priv->info, i, &arg_info);
-
-        if (g_arg_info_get_direction(&arg_info) == GI_DIRECTION_OUT)
+        if (priv->arg_plan[i].direction == GI_DIRECTION_OUT)
             continue;
     }
 
@@ -1353,25 +1912,23 @@ function_to_string (JSContext *context,
 
     free = TRUE;
 
-    n_args = g_callable_info_get_n_args(priv->info);
+    n_args = priv->gi_argc;
     n_jsargs = 0;
     arg_names_str = g_string_new("");
     for (i = 0; i < n_args; i++) {
-        GIArgInfo arg_info;
+        GjsArgPlan *plan = &priv->arg_plan[i];
 
-        if (priv->param_types[i] == PARAM_SKIPPED)
+        if (plan->param_type == PARAM_SKIPPED)
             continue;
 
-        g_callable_info_load_arg(priv->info, i, &arg_info);
-
-        if (g_arg_info_get_direction(&arg_info) == GI_DIRECTION_OUT)
+        if (plan->direction == GI_DIRECTION_OUT)
             continue;
 
         if (n_jsargs > 0)
             g_string_append(arg_names_str, ", ");
 
         n_jsargs++;
-        g_string_append(arg_names_str, g_base_info_get_name(&arg_info));
+        g_string_append(arg_names_str, plan->name);
     }
     arg_names = g_string_free(arg_names_str, FALSE);
 
@@ -1435,6 +1992,236 @@ JSFunctionSpec gjs_function_proto_funcs[] = {
     JS_FS_END
 };
 
+static JSBool
+gjs_arg_plan_marshal_in_generic(JSContext  *context,
+                                GjsArgPlan *plan,
+                                jsval       value,
+                                GjsArena   *arena,
+                                GArgument  *arg)
+{
+    return gjs_value_to_g_argument(context, value,
+                                   &plan->type_info,
+                                   plan->name,
+                                   plan->argument_type,
+                                   plan->transfer,
+                                   plan->may_be_null,
+                                   arg);
+}
+
+static JSBool
+gjs_arg_plan_marshal_in_boolean(JSContext  *context,
+                                GjsArgPlan *plan,
+                                jsval       value,
+                                GjsArena   *arena,
+                                GArgument  *arg)
+{
+    return JS_ValueToBoolean(context, value, &arg->v_boolean);
+}
+
+static JSBool
+gjs_arg_plan_marshal_in_int32(JSContext  *context,
+                              GjsArgPlan *plan,
+                              jsval       value,
+                              GjsArena   *arena,
+                              GArgument  *arg)
+{
+    return JS_ValueToInt32(context, value, &arg->v_int);
+}
+
+static JSBool
+gjs_arg_plan_marshal_in_double(JSContext  *context,
+                               GjsArgPlan *plan,
+                               jsval       value,
+                               GjsArena   *arena,
+                               GArgument  *arg)
+{
+    return JS_ValueToNumber(context, value, &arg->v_double);
+}
+
+/* For (in) (transfer none) strings, which only need to live until the
+ * call returns */
+static JSBool
+gjs_arg_plan_marshal_in_utf8_arena(JSContext  *context,
+                                   GjsArgPlan *plan,
+                                   jsval       value,
+                                   GjsArena   *arena,
+                                   GArgument  *arg)
+{
+    if (!JSVAL_IS_STRING(value))
+        return gjs_arg_plan_marshal_in_generic(context, plan, value, arena, arg);
+
+    return gjs_string_to_utf8_in_arena(context, value, arena,
+                                       (char **) &arg->v_pointer);
+}
+
+static GjsArgInMarshaller
+get_in_marshaller(GITypeTag type_tag)
+{
+    /* These have no range checks or nullability to worry about,
+     * everything else goes through gjs_value_to_g_argument() */
+    switch (type_tag) {
+    case GI_TYPE_TAG_BOOLEAN:
+        return gjs_arg_plan_marshal_in_boolean;
+    case GI_TYPE_TAG_INT32:
+        return gjs_arg_plan_marshal_in_int32;
+    case GI_TYPE_TAG_DOUBLE:
+        return gjs_arg_plan_marshal_in_double;
+    default:
+        return gjs_arg_plan_marshal_in_generic;
+    }
+}
+
+static gboolean
+type_is_simple(GITypeInfo *type_info,
+               GITypeTag   type_tag,
+               gboolean    allow_objects)
+{
+    switch (type_tag) {
+    case GI_TYPE_TAG_BOOLEAN:
+    case GI_TYPE_TAG_INT8:
+    case GI_TYPE_TAG_UINT8:
+    case GI_TYPE_TAG_INT16:
+    case GI_TYPE_TAG_UINT16:
+    case GI_TYPE_TAG_INT32:
+    case GI_TYPE_TAG_UINT32:
+    case GI_TYPE_TAG_INT64:
+    case GI_TYPE_TAG_UINT64:
+    case GI_TYPE_TAG_FLOAT:
+    case GI_TYPE_TAG_DOUBLE:
+    case GI_TYPE_TAG_GTYPE:
+    case GI_TYPE_TAG_UNICHAR:
+        return TRUE;
+    case GI_TYPE_TAG_INTERFACE: {
+        GIBaseInfo *interface_info;
+        GIInfoType interface_type;
+        gboolean simple;
+
+        interface_info = g_type_info_get_interface(type_info);
+        interface_type = g_base_info_get_type(interface_info);
+
+        simple = interface_type == GI_INFO_TYPE_ENUM ||
+            interface_type == GI_INFO_TYPE_FLAGS ||
+            (allow_objects && (interface_type == GI_INFO_TYPE_OBJECT ||
+                               interface_type == GI_INFO_TYPE_INTERFACE));
+
+        g_base_info_unref(interface_info);
+        return simple;
+    }
+    default:
+        return FALSE;
+    }
+}
+
+/* A function is "simple" if it takes only scalar, enum or object
+ * (in) arguments and returns a scalar, an enum or nothing. None of
+ * those need releasing after the call, so gjs_invoke_c_function_simple()
+ * can be used.
+ */
+static gboolean
+function_is_simple(Function *function)
+{
+    guint8 i;
+
+    if (function->can_throw_gerror)
+        return FALSE;
+
+    if (function->return_tag != GI_TYPE_TAG_VOID &&
+        !type_is_simple(&function->return_info, function->return_tag, FALSE))
+        return FALSE;
+
+    for (i = 0; i < function->gi_argc; i++) {
+        GjsArgPlan *plan = &function->arg_plan[i];
+
+        if (plan->direction != GI_DIRECTION_IN ||
+            plan->param_type != PARAM_NORMAL ||
+            !type_is_simple(&plan->type_info, plan->type_tag, TRUE))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gsize
+get_caller_allocates_size(GITypeInfo *type_info)
+{
+    GIBaseInfo *interface_info;
+    gsize size;
+
+    if (g_type_info_get_tag(type_info) != GI_TYPE_TAG_INTERFACE)
+        return 0;
+
+    interface_info = g_type_info_get_interface(type_info);
+    g_assert(interface_info != NULL);
+
+    switch (g_base_info_get_type(interface_info)) {
+    case GI_INFO_TYPE_STRUCT:
+        size = g_struct_info_get_size((GIStructInfo*)interface_info);
+        break;
+    case GI_INFO_TYPE_UNION:
+        size = g_union_info_get_size((GIUnionInfo*)interface_info);
+        break;
+    default:
+        size = 0;
+        break;
+    }
+
+    g_base_info_unref(interface_info);
+    return size;
+}
+
+/* Loads everything the invoke loop needs from the typelib. Argument
+ * classification (param_type) is done afterwards by the caller, since
+ * it needs to look at other arguments.
+ */
+static void
+init_arg_plan(GICallableInfo *info,
+              guint8          index,
+              GjsArgPlan     *plan)
+{
+    g_callable_info_load_arg(info, index, &plan->arg_info);
+    g_arg_info_load_type(&plan->arg_info, &plan->type_info);
+
+    plan->name = g_base_info_get_name((GIBaseInfo*) &plan->arg_info);
+    plan->direction = g_arg_info_get_direction(&plan->arg_info);
+    plan->type_tag = g_type_info_get_tag(&plan->type_info);
+    plan->transfer = g_arg_info_get_ownership_transfer(&plan->arg_info);
+    plan->scope = g_arg_info_get_scope(&plan->arg_info);
+    plan->argument_type = g_arg_info_is_return_value(&plan->arg_info) ?
+        GJS_ARGUMENT_RETURN_VALUE : GJS_ARGUMENT_ARGUMENT;
+    plan->may_be_null = g_arg_info_may_be_null(&plan->arg_info);
+    plan->caller_allocates = plan->direction == GI_DIRECTION_OUT &&
+        g_arg_info_is_caller_allocates(&plan->arg_info);
+    plan->caller_allocates_size = plan->caller_allocates ?
+        get_caller_allocates_size(&plan->type_info) : 0;
+    plan->array_length_pos = -1;
+    plan->closure_pos = -1;
+    plan->destroy_pos = -1;
+    plan->array_fixed_size = -1;
+
+    if (plan->type_tag == GI_TYPE_TAG_ARRAY &&
+        g_type_info_get_array_type(&plan->type_info) == GI_ARRAY_TYPE_C) {
+        plan->array_length_pos = g_type_info_get_array_length(&plan->type_info);
+        plan->array_fixed_size = g_type_info_get_array_fixed_size(&plan->type_info);
+    }
+
+    if (plan->direction == GI_DIRECTION_IN &&
+        plan->transfer == GI_TRANSFER_NOTHING &&
+        (plan->array_length_pos >= 0 || plan->array_fixed_size >= 0))
+        plan->borrow_element_type = gjs_array_get_borrowable_element_type(&plan->type_info);
+    else
+        plan->borrow_element_type = GI_TYPE_TAG_VOID;
+
+    if (plan->type_tag == GI_TYPE_TAG_UTF8 &&
+        plan->direction == GI_DIRECTION_IN &&
+        plan->transfer == GI_TRANSFER_NOTHING) {
+        plan->marshal_in = gjs_arg_plan_marshal_in_utf8_arena;
+        plan->in_arena = TRUE;
+    } else {
+        plan->marshal_in = get_in_marshaller(plan->type_tag);
+        plan->in_arena = FALSE;
+    }
+}
+
 static gboolean
 init_cached_function_data (JSContext      *context,
                            Function       *function,
@@ -1444,7 +2231,6 @@ init_cached_function_data (JSContext      *context,
     guint8 i, n_args;
     int array_length_pos;
     GError *error = NULL;
-    GITypeInfo return_type;
     GIInfoType info_type;
 
     info_type = g_base_info_get_type((GIBaseInfo *)info);
@@ -1476,57 +2262,69 @@ init_cached_function_data (JSContext      *context,
         }
     }
 
-    g_callable_info_load_return_type((GICallableInfo*)info, &return_type);
-    if (g_type_info_get_tag(&return_type) != GI_TYPE_TAG_VOID)
+    function->is_method = g_callable_info_is_method(info);
+    function->can_throw_gerror = g_callable_info_can_throw_gerror(info);
+
+    g_callable_info_load_return_type(info, &function->return_info);
+    function->return_tag = g_type_info_get_tag(&function->return_info);
+    function->return_transfer = g_callable_info_get_caller_owns(info);
+    function->return_array_length_pos = -1;
+    if (function->return_tag != GI_TYPE_TAG_VOID)
         function->js_out_argc += 1;
 
-    n_args = g_callable_info_get_n_args((GICallableInfo*) info);
-    function->param_types = g_new0(GjsParamType, n_args);
+    n_args = g_callable_info_get_n_args(info);
+    function->gi_argc = n_args;
+    function->arg_plan = g_new0(GjsArgPlan, n_args);
 
-    array_length_pos = g_type_info_get_array_length(&return_type);
-    if (array_length_pos >= 0 && array_length_pos < n_args)
-        function->param_types[array_length_pos] = PARAM_SKIPPED;
+    for (i = 0; i < n_args; i++)
+        init_arg_plan(info, i, &function->arg_plan[i]);
+
+    array_length_pos = g_type_info_get_array_length(&function->return_info);
+    if (array_length_pos >= 0 && array_length_pos < n_args) {
+        function->arg_plan[array_length_pos].param_type = PARAM_SKIPPED;
+        function->return_array_length_pos = array_length_pos;
+    }
 
     for (i = 0; i < n_args; i++) {
+        GjsArgPlan *plan = &function->arg_plan[i];
         GIDirection direction;
-        GIArgInfo arg_info;
-        GITypeInfo type_info;
         int destroy = -1;
         int closure = -1;
         GITypeTag type_tag;
 
-        if (function->param_types[i] == PARAM_SKIPPED)
+        if (plan->param_type == PARAM_SKIPPED)
             continue;
 
-        g_callable_info_load_arg((GICallableInfo*) info, i, &arg_info);
-        g_arg_info_load_type(&arg_info, &type_info);
-
-        direction = g_arg_info_get_direction(&arg_info);
-        type_tag = g_type_info_get_tag(&type_info);
+        direction = plan->direction;
+        type_tag = plan->type_tag;
 
         if (type_tag == GI_TYPE_TAG_INTERFACE) {
             GIBaseInfo* interface_info;
             GIInfoType interface_type;
 
-            interface_info = g_type_info_get_interface(&type_info);
+            interface_info = g_type_info_get_interface(&plan->type_info);
             interface_type = g_base_info_get_type(interface_info);
             if (interface_type == GI_INFO_TYPE_CALLBACK) {
                 if (strcmp(g_base_info_get_name(interface_info), "DestroyNotify") == 0 &&
                     strcmp(g_base_info_get_namespace(interface_info), "GLib") == 0) {
                     /* Skip GDestroyNotify if they appear before the respective callback */
-                    function->param_types[i] = PARAM_SKIPPED;
+                    plan->param_type = PARAM_SKIPPED;
                 } else {
-                    function->param_types[i] = PARAM_CALLBACK;
+                    plan->param_type = PARAM_CALLBACK;
                     function->expected_js_argc += 1;
 
-                    destroy = g_arg_info_get_destroy(&arg_info);
-                    closure = g_arg_info_get_closure(&arg_info);
+                    destroy = g_arg_info_get_destroy(&plan->arg_info);
+                    closure = g_arg_info_get_closure(&plan->arg_info);
 
-                    if (destroy >= 0 && destroy < n_args)
-                        function->param_types[destroy] = PARAM_SKIPPED;
+                    if (destroy >= 0 && destroy < n_args) {
+                        function->arg_plan[destroy].param_type = PARAM_SKIPPED;
+                        plan->destroy_pos = destroy;
+                    }
 
-                    if (closure >= 0 && closure < n_args)
-                        function->param_types[closure] = PARAM_SKIPPED;
+                    if (closure >= 0 && closure < n_args) {
+                        function->arg_plan[closure].param_type = PARAM_SKIPPED;
+                        plan->closure_pos = closure;
+                    }
 
                     if (destroy >= 0 && closure < 0) {
                         gjs_throw(context, "Function %s.%s has a GDestroyNotify but no user_data, not supported",
@@ -1539,36 +2337,33 @@ init_cached_function_data (JSContext      *context,
             }
             g_base_info_unref(interface_info);
         } else if (type_tag == GI_TYPE_TAG_ARRAY) {
-            if (g_type_info_get_array_type(&type_info) == GI_ARRAY_TYPE_C) {
-                array_length_pos = g_type_info_get_array_length(&type_info);
-
-                if (array_length_pos >= 0 && array_length_pos < n_args) {
-                    GIArgInfo length_arg_info;
-
-                    g_callable_info_load_arg((GICallableInfo*) info, array_length_pos, &length_arg_info);
-                    if (g_arg_info_get_direction(&length_arg_info) != direction) {
-                        gjs_throw(context, "Function %s.%s has an array with different-direction length arg, not supported",
-                                  g_base_info_get_namespace( (GIBaseInfo*) info),
-                                  g_base_info_get_name( (GIBaseInfo*) info));
-                        return JS_FALSE;
-                    }
+            array_length_pos = plan->array_length_pos;
+
+            if (array_length_pos >= 0 && array_length_pos < n_args) {
+                if (function->arg_plan[array_length_pos].direction != direction) {
+                    gjs_throw(context, "Function %s.%s has an array with different-direction length arg, not supported",
+                              g_base_info_get_namespace( (GIBaseInfo*) info),
+                              g_base_info_get_name( (GIBaseInfo*) info));
+                    return JS_FALSE;
+                }
 
-                    function->param_types[array_length_pos] = PARAM_SKIPPED;
-                    function->param_types[i] = PARAM_ARRAY;
+                function->arg_plan[array_length_pos].param_type = PARAM_SKIPPED;
+                plan->param_type = PARAM_ARRAY;
 
-                    if (array_length_pos < i) {
-                        /* we already collected array_length_pos, remove it */
-                        if (direction == GI_DIRECTION_IN || direction == GI_DIRECTION_INOUT)
-                            function->expected_js_argc -= 1;
-                        if (direction == GI_DIRECTION_OUT || direction == GI_DIRECTION_INOUT)
-                            function->js_out_argc -= 1;
-                    }
+                if (array_length_pos < i) {
+                    /* we already collected array_length_pos, remove it */
+                    if (direction == GI_DIRECTION_IN || direction == GI_DIRECTION_INOUT)
+                        function->expected_js_argc -= 1;
+                    if (direction == GI_DIRECTION_OUT || direction == GI_DIRECTION_INOUT)
+                        function->js_out_argc -= 1;
                 }
+            } else {
+                plan->array_length_pos = -1;
             }
         }
 
-        if (function->param_types[i] == PARAM_NORMAL ||
-            function->param_types[i] == PARAM_ARRAY) {
+        if (plan->param_type == PARAM_NORMAL ||
+            plan->param_type == PARAM_ARRAY) {
             if (direction == GI_DIRECTION_IN || direction == GI_DIRECTION_INOUT)
                 function->expected_js_argc += 1;
             if (direction == GI_DIRECTION_OUT || direction == GI_DIRECTION_INOUT)
@@ -1576,6 +2371,10 @@ init_cached_function_data (JSContext      *context,
         }
     }
 
+    /* GJS_DISABLE_SIMPLE_INVOKE is mostly useful to compare both paths */
+    function->is_simple = !gjs_function_get_simple_invoke_disabled() &&
+        function_is_simple(function);
+
     function->info = info;
 
     g_base_info_ref((GIBaseInfo*) function->info);
@@ -1592,6 +2391,15 @@ function_new(JSContext      *context,
     JSObject *global;
     Function *priv;
     JSBool found;
+    static gsize call_stats_env_checked = 0;
+
+    /* The environment can only turn statistics on, so that an earlier
+     * System.setCallStatsEnabled(true) is not undone here */
+    if (g_once_init_enter(&call_stats_env_checked)) {
+        if (gjs_environment_variable_is_set("GJS_CALL_STATS"))
+            call_stats_enabled = TRUE;
+        g_once_init_leave(&call_stats_env_checked, 1);
+    }
 
     /* put constructor for GIRepositoryFunction() in the global namespace */
     global = gjs_get_import_global(context);
@@ -1741,3 +2549,294 @@ gjs_invoke_constructor_from_c (JSContext      *context,
 
     return gjs_invoke_c_function(context, priv, obj, argc, argv, NULL, rvalue);
 }
+
+/* Only affects functions defined afterwards */
+void
+gjs_function_set_simple_invoke_disabled(gboolean disabled)
+{
+    simple_invoke_disabled = disabled ? 1 : 0;
+}
+
+gboolean
+gjs_function_get_simple_invoke_disabled(void)
+{
+    if (G_UNLIKELY(simple_invoke_disabled < 0))
+        simple_invoke_disabled = g_getenv("GJS_DISABLE_SIMPLE_INVOKE") != NULL ? 1 : 0;
+
+    return simple_invoke_disabled;
+}
+
+void
+gjs_function_set_call_stats_enabled(gboolean enabled)
+{
+    call_stats_enabled = enabled;
+}
+
+gboolean
+gjs_function_get_call_stats_enabled(void)
+{
+    return call_stats_enabled;
+}
+
+void
+gjs_function_reset_call_stats(void)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    if (call_stats_table == NULL)
+        return;
+
+    g_hash_table_iter_init(&iter, call_stats_table);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        GjsCallStats *stats = (GjsCallStats *) value;
+
+        stats->n_calls = 0;
+        stats->total_ns = 0;
+        memset(stats->histogram, 0, sizeof(stats->histogram));
+    }
+}
+
+static gint
+compare_call_stats_by_time(gconstpointer a,
+                           gconstpointer b)
+{
+    const GjsCallStats *stats_a = *(const GjsCallStats **) a;
+    const GjsCallStats *stats_b = *(const GjsCallStats **) b;
+
+    if (stats_a->total_ns > stats_b->total_ns)
+        return -1;
+    if (stats_a->total_ns < stats_b->total_ns)
+        return 1;
+    return 0;
+}
+
+static JSBool
+define_number_property(JSContext  *context,
+                       JSObject   *obj,
+                       const char *name,
+                       double      number)
+{
+    jsval value;
+
+    if (!JS_NewNumberValue(context, number, &value))
+        return JS_FALSE;
+
+    return JS_DefineProperty(context, obj, name, value,
+                             NULL, NULL, JSPROP_ENUMERATE);
+}
+
+/* Converts the first @max_entries of @sorted into a JS array of
+ * { name, calls, time, histogram } objects, time being in milliseconds.
+ */
+static JSObject *
+call_stats_to_array(JSContext *context,
+                    GPtrArray *sorted,
+                    guint      max_entries,
+                    gboolean   with_histogram)
+{
+    JSObject *array;
+    guint i, j;
+
+    array = JS_NewArrayObject(context, 0, NULL);
+    if (array == NULL)
+        return NULL;
+
+    for (i = 0; i < sorted->len && i < max_entries; i++) {
+        GjsCallStats *stats = (GjsCallStats *) g_ptr_array_index(sorted, i);
+        JSObject *entry;
+        jsval name;
+
+        entry = JS_NewObject(context, NULL, NULL, NULL);
+        if (entry == NULL)
+            return NULL;
+
+        if (!JS_DefineElement(context, array, i, OBJECT_TO_JSVAL(entry),
+                              NULL, NULL, JSPROP_ENUMERATE))
+            return NULL;
+
+        if (!gjs_string_from_utf8(context, stats->name, -1, &name) ||
+            !JS_DefineProperty(context, entry, "name", name,
+                               NULL, NULL, JSPROP_ENUMERATE) ||
+            !define_number_property(context, entry, "calls", stats->n_calls) ||
+            !define_number_property(context, entry, "time", stats->total_ns / 1e6))
+            return NULL;
+
+        if (with_histogram) {
+            JSObject *histogram;
+
+            histogram = JS_NewArrayObject(context, 0, NULL);
+            if (histogram == NULL ||
+                !JS_DefineProperty(context, entry, "histogram",
+                                   OBJECT_TO_JSVAL(histogram),
+                                   NULL, NULL, JSPROP_ENUMERATE))
+                return NULL;
+
+            for (j = 0; j < GJS_CALL_STATS_N_BUCKETS; j++) {
+                jsval count;
+
+                if (!JS_NewNumberValue(context, stats->histogram[j], &count) ||
+                    !JS_DefineElement(context, histogram, j, count,
+                                      NULL, NULL, JSPROP_ENUMERATE))
+                    return NULL;
+            }
+        }
+    }
+
+    return array;
+}
+
+/**
+ * gjs_function_dump_call_stats:
+ * @context: the JS context
+ * @max_entries: how many functions and namespaces to report
+ * @value_p: return location for the result
+ *
+ * Returns an object with two arrays, "functions" and "namespaces",
+ * holding the @max_entries most expensive entries of each, sorted by
+ * cumulative time spent in C calls. Function entries also have a
+ * "histogram" array where element i counts the calls that took
+ * between 2^i and 2^(i+1) nanoseconds.
+ */
+JSBool
+gjs_function_dump_call_stats(JSContext *context,
+                             guint      max_entries,
+                             jsval     *value_p)
+{
+    GPtrArray *functions, *namespaces;
+    GHashTable *namespace_table;
+    GHashTableIter iter;
+    gpointer value;
+    JSObject *result, *functions_array, *namespaces_array;
+    JSBool ret = JS_FALSE;
+
+    functions = g_ptr_array_new();
+    namespaces = g_ptr_array_new_with_free_func(g_free);
+    namespace_table = g_hash_table_new(g_str_hash, g_str_equal);
+
+    if (call_stats_table != NULL) {
+        g_hash_table_iter_init(&iter, call_stats_table);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            GjsCallStats *stats = (GjsCallStats *) value;
+            GjsCallStats *ns_stats;
+
+            if (stats->n_calls == 0)
+                continue;
+
+            g_ptr_array_add(functions, stats);
+
+            ns_stats = (GjsCallStats *) g_hash_table_lookup(namespace_table, stats->ns);
+            if (ns_stats == NULL) {
+                ns_stats = g_new0(GjsCallStats, 1);
+                ns_stats->name = stats->ns;
+                g_hash_table_insert(namespace_table, stats->ns, ns_stats);
+                g_ptr_array_add(namespaces, ns_stats);
+            }
+            ns_stats->n_calls += stats->n_calls;
+            ns_stats->total_ns += stats->total_ns;
+        }
+    }
+
+    g_ptr_array_sort(functions, compare_call_stats_by_time);
+    g_ptr_array_sort(namespaces, compare_call_stats_by_time);
+
+    result = JS_NewObject(context, NULL, NULL, NULL);
+    if (result == NULL)
+        goto out;
+    *value_p = OBJECT_TO_JSVAL(result);
+
+    functions_array = call_stats_to_array(context, functions, max_entries, TRUE);
+    if (functions_array == NULL ||
+        !JS_DefineProperty(context, result, "functions",
+                           OBJECT_TO_JSVAL(functions_array),
+                           NULL, NULL, JSPROP_ENUMERATE))
+        goto out;
+
+    namespaces_array = call_stats_to_array(context, namespaces, max_entries, FALSE);
+    if (namespaces_array == NULL ||
+        !JS_DefineProperty(context, result, "namespaces",
+                           OBJECT_TO_JSVAL(namespaces_array),
+                           NULL, NULL, JSPROP_ENUMERATE))
+        goto out;
+
+    ret = JS_TRUE;
+
+ out:
+    g_hash_table_destroy(namespace_table);
+    g_ptr_array_free(namespaces, TRUE);
+    g_ptr_array_free(functions, TRUE);
+    return ret;
+}
+
+static gint
+compare_vfunc_plans_by_calls(gconstpointer a,
+                             gconstpointer b)
+{
+    const GjsCallbackPlan *plan_a = *(const GjsCallbackPlan **) a;
+    const GjsCallbackPlan *plan_b = *(const GjsCallbackPlan **) b;
+
+    if (plan_a->n_calls != plan_b->n_calls)
+        return plan_a->n_calls < plan_b->n_calls ? 1 : -1;
+    return strcmp(plan_a->vfunc_name, plan_b->vfunc_name);
+}
+
+/**
+ * gjs_function_dump_vfunc_stats:
+ * @context: the JS context
+ * @value_p: return location for the result
+ *
+ * Returns an array with an entry for every virtual function that has
+ * been overridden from JS, sorted by the number of calls. Each entry
+ * has the "name" of the vfunc, the number of "calls" into JS and the
+ * number of "overrides" sharing its marshalling plan.
+ */
+JSBool
+gjs_function_dump_vfunc_stats(JSContext *context,
+                              jsval     *value_p)
+{
+    GPtrArray *plans;
+    GHashTableIter iter;
+    gpointer value;
+    JSObject *array;
+    JSBool ret = JS_FALSE;
+    guint i;
+
+    plans = g_ptr_array_new();
+    if (vfunc_plans != NULL) {
+        g_hash_table_iter_init(&iter, vfunc_plans);
+        while (g_hash_table_iter_next(&iter, NULL, &value))
+            g_ptr_array_add(plans, value);
+    }
+    g_ptr_array_sort(plans, compare_vfunc_plans_by_calls);
+
+    array = JS_NewArrayObject(context, 0, NULL);
+    if (array == NULL)
+        goto out;
+    *value_p = OBJECT_TO_JSVAL(array);
+
+    for (i = 0; i < plans->len; i++) {
+        GjsCallbackPlan *plan = (GjsCallbackPlan *) g_ptr_array_index(plans, i);
+        JSObject *entry;
+        jsval name;
+
+        entry = JS_NewObject(context, NULL, NULL, NULL);
+        if (entry == NULL ||
+            !JS_DefineElement(context, array, i, OBJECT_TO_JSVAL(entry),
+                              NULL, NULL, JSPROP_ENUMERATE))
+            goto out;
+
+        /* The table holds one of the references */
+        if (!gjs_string_from_utf8(context, plan->vfunc_name, -1, &name) ||
+            !JS_DefineProperty(context, entry, "name", name,
+                               NULL, NULL, JSPROP_ENUMERATE) ||
+            !define_number_property(context, entry, "calls", plan->n_calls) ||
+            !define_number_property(context, entry, "overrides", plan->ref_count - 1))
+            goto out;
+    }
+
+    ret = JS_TRUE;
+
+ out:
+    g_ptr_array_free(plans, TRUE);
+    return ret;
+}
@@ -40,6 +40,8 @@ typedef enum {
     PARAM_CALLBACK
 } GjsParamType;
 
+typedef struct _GjsCallbackPlan GjsCallbackPlan;
+
 typedef struct {
     gint ref_count;
     JSContext *context;
@@ -49,18 +51,37 @@ typedef struct {
     ffi_closure *closure;
     GIScopeType scope;
     gboolean is_vfunc;
-    GjsParamType *param_types;
+    GjsCallbackPlan *plan;
+    char *pool_key;
 } GjsCallbackTrampoline;
 
+typedef struct {
+    guint size;        /* released trampolines currently pooled */
+    guint high_water;  /* largest size reached */
+    guint max_size;    /* GJS_TRAMPOLINE_POOL_SIZE, or 128 */
+    guint64 hits;      /* trampolines reused from the pool */
+    guint64 misses;    /* trampolines that needed a new ffi closure */
+} GjsTrampolinePoolStats;
+
 GjsCallbackTrampoline* gjs_callback_trampoline_new(JSContext      *context,
                                                    jsval           function,
                                                    GICallableInfo *callable_info,
                                                    GIScopeType     scope,
                                                    gboolean        is_vfunc);
 
+GjsCallbackTrampoline* gjs_vfunc_trampoline_new(JSContext      *context,
+                                                jsval           function,
+                                                GICallableInfo *callback_info,
+                                                GIVFuncInfo    *vfunc_info);
+
 void gjs_callback_trampoline_unref(GjsCallbackTrampoline *trampoline);
 void gjs_callback_trampoline_ref(GjsCallbackTrampoline *trampoline);
 
+void  gjs_callback_trampoline_reclaim_all   (void);
+void  gjs_callback_trampoline_release_pool  (void);
+guint gjs_callback_trampoline_get_n_pending (void);
+void  gjs_callback_trampoline_get_pool_stats (GjsTrampolinePoolStats *stats);
+
 JSObject* gjs_define_function   (JSContext      *context,
                                  JSObject       *in_object,
                                  GType           gtype,
@@ -82,6 +103,17 @@ JSBool    gjs_invoke_constructor_from_c (JSContext      *context,
 
 void     gjs_init_cinvoke_profiling (void);
 
+void     gjs_function_set_simple_invoke_disabled (gboolean disabled);
+gboolean gjs_function_get_simple_invoke_disabled (void);
+void     gjs_function_set_call_stats_enabled (gboolean   enabled);
+gboolean gjs_function_get_call_stats_enabled (void);
+void     gjs_function_reset_call_stats       (void);
+JSBool   gjs_function_dump_call_stats        (JSContext *context,
+                                              guint      max_entries,
+                                              jsval     *value_p);
+JSBool   gjs_function_dump_vfunc_stats       (JSContext *context,
+                                              jsval     *value_p);
+
 G_END_DECLS
 
 #endif  /* __GJS_FUNCTION_H__ */
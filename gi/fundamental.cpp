@@ -77,59 +77,83 @@ extern struct JSClass gjs_fundamental_instance_class;
 
 GJS_DEFINE_PRIV_FROM_JS(FundamentalInstance, gjs_fundamental_instance_class)
 
-static GQuark
-gjs_fundamental_table_quark (void)
+/* gfundamental -> JSObject wrapper, one table per runtime. The
+ * wrappers are not rooted by the table; entries of wrappers that are
+ * about to be finalized are dropped by sweep_wrapper_table() at the
+ * start of each GC sweep.
+ */
+static GjsFundamentalWrapperStats wrapper_stats;
+
+static void
+sweep_wrapper_table(JSRuntime *runtime,
+                    gpointer   data)
 {
-    static GQuark val = 0;
-    if (!val)
-        val = g_quark_from_static_string("gjs::fundamental-table");
+    GHashTable *table = (GHashTable *) data;
+    GHashTableIter iter;
+    gpointer value;
 
-    return val;
+    g_hash_table_iter_init(&iter, table);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        JSObject *object = (JSObject *) value;
+
+        if (JS_IsAboutToBeFinalized(&object)) {
+            g_hash_table_iter_remove(&iter);
+            wrapper_stats.swept++;
+        }
+    }
 }
 
 static GHashTable *
-_ensure_mapping_table(GjsContext *context)
+get_wrapper_table(JSRuntime *runtime)
 {
-    GHashTable *table =
-        (GHashTable *) g_object_get_qdata ((GObject *) context,
-                                           gjs_fundamental_table_quark());
+    GHashTable *table;
 
+    table = gjs_runtime_get_wrapper_table(runtime, GJS_WRAPPER_TABLE_FUNDAMENTAL);
     if (G_UNLIKELY(table == NULL)) {
-        table = g_hash_table_new_full(g_direct_hash,
-                                      g_direct_equal,
-                                      NULL,
-                                      NULL);
-        g_object_set_qdata_full((GObject *) context,
-                                gjs_fundamental_table_quark(),
-                                table,
-                                (GDestroyNotify) g_hash_table_unref);
+        table = g_hash_table_new(g_direct_hash, g_direct_equal);
+        gjs_runtime_set_wrapper_table(runtime, GJS_WRAPPER_TABLE_FUNDAMENTAL, table);
+        gjs_runtime_add_sweep_callback(runtime, sweep_wrapper_table, table);
     }
 
     return table;
 }
 
 static void
-_fundamental_add_object(void *native_object, JSObject *js_object)
+_fundamental_add_object(JSContext *context,
+                        void      *native_object,
+                        JSObject  *js_object)
 {
-    GHashTable *table = _ensure_mapping_table(gjs_context_get_current());
-
-    g_hash_table_insert(table, native_object, js_object);
+    g_hash_table_insert(get_wrapper_table(JS_GetRuntime(context)),
+                        native_object, js_object);
 }
 
 static void
-_fundamental_remove_object(void *native_object)
+_fundamental_remove_object(JSRuntime *runtime,
+                           void      *native_object,
+                           JSObject  *js_object)
 {
-    GHashTable *table = _ensure_mapping_table(gjs_context_get_current());
+    GHashTable *table = get_wrapper_table(runtime);
 
-    g_hash_table_remove(table, native_object);
+    /* Normally already swept; a new wrapper may have been created
+     * for the same fundamental since then */
+    if (g_hash_table_lookup(table, native_object) == js_object)
+        g_hash_table_remove(table, native_object);
 }
 
 static JSObject *
-_fundamental_lookup_object(void *native_object)
+_fundamental_lookup_object(JSContext *context,
+                           void      *native_object)
 {
-    GHashTable *table = _ensure_mapping_table(gjs_context_get_current());
+    return (JSObject *) g_hash_table_lookup(get_wrapper_table(JS_GetRuntime(context)),
+                                            native_object);
+}
 
-    return (JSObject *) g_hash_table_lookup(table, native_object);
+void
+gjs_fundamental_get_wrapper_stats(JSContext                  *context,
+                                  GjsFundamentalWrapperStats *stats)
+{
+    *stats = wrapper_stats;
+    stats->size = g_hash_table_size(get_wrapper_table(JS_GetRuntime(context)));
 }
 
 /**/
@@ -184,8 +208,8 @@ associate_js_instance_to_fundamental(JSContext *context,
     priv = priv_from_js(context, object);
     priv->gfundamental = gfundamental;
 
-    g_assert(_fundamental_lookup_object(gfundamental) == NULL);
-    _fundamental_add_object(gfundamental, object);
+    g_assert(_fundamental_lookup_object(context, gfundamental) == NULL);
+    _fundamental_add_object(context, gfundamental, object);
 
     gjs_debug_lifecycle(GJS_DEBUG_GFUNDAMENTAL,
                         "associated JSObject %p with fundamental %p",
@@ -511,7 +535,7 @@ fundamental_finalize(JSFreeOp  *fop,
 
     if (priv->prototype) {
         if (priv->gfundamental) {
-            _fundamental_remove_object(priv->gfundamental);
+            _fundamental_remove_object(fop->runtime(), priv->gfundamental, obj);
             priv->prototype->unref_function(priv->gfundamental);
             priv->gfundamental = NULL;
         }
@@ -794,9 +818,12 @@ gjs_object_from_g_fundamental(JSContext    *context,
     if (gfundamental == NULL)
         return NULL;
 
-    object = _fundamental_lookup_object(gfundamental);
-    if (object)
+    wrapper_stats.lookups++;
+    object = _fundamental_lookup_object(context, gfundamental);
+    if (object) {
+        wrapper_stats.hits++;
         return object;
+    }
 
     gjs_debug_marshal(GJS_DEBUG_GFUNDAMENTAL,
                       "Wrapping fundamental %s.%s %p with JSObject",
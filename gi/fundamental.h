@@ -31,6 +31,13 @@
 
 G_BEGIN_DECLS
 
+typedef struct {
+    guint   size;    /* live entries in the runtime's wrapper table */
+    guint64 lookups; /* wrapper lookups for a C fundamental */
+    guint64 hits;    /* of those, answered by an existing wrapper */
+    guint64 swept;   /* entries dropped during GC sweeps */
+} GjsFundamentalWrapperStats;
+
 JSBool gjs_define_fundamental_class          (JSContext     *context,
                                               JSObject      *in_object,
                                               GIObjectInfo  *info,
@@ -56,6 +63,9 @@ void*     gjs_fundamental_ref                (JSContext     *context,
 void      gjs_fundamental_unref              (JSContext     *context,
                                               void          *fobj);
 
+void      gjs_fundamental_get_wrapper_stats  (JSContext                  *context,
+                                              GjsFundamentalWrapperStats *stats);
+
 G_END_DECLS
 
 #endif  /* __GJS_FUNDAMENTAL_H__ */
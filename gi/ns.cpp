@@ -32,6 +32,9 @@
 #include <util/log.h>
 #include <girepository.h>
 
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 typedef struct {
@@ -42,6 +45,134 @@ extern struct JSClass gjs_ns_class;
 
 GJS_DEFINE_PRIV_FROM_JS(Ns, gjs_ns_class)
 
+/* A "warm set" is a list of names that a program is known to resolve
+ * from its namespaces, one "Namespace.Name" per line. If
+ * GJS_WARM_SET_FILE points at one, the names listed for a namespace are
+ * all defined when the namespace is imported, rather than one by one
+ * through ns_new_resolve(). Every listed name is defined even if the
+ * program never ends up touching it, so the list should only hold names
+ * it really uses. GJS_WARM_SET_RECORD names a file to write every lazily
+ * resolved name to, for producing such a list.
+ */
+
+/* namespace name -> GPtrArray of names, in file order */
+static GHashTable *warm_set = NULL;
+static char *warm_set_filename = NULL;
+
+static FILE *warm_set_record = NULL;
+static gboolean warm_set_record_checked = FALSE;
+static GHashTable *warm_set_recorded = NULL; /* "Namespace.Name" set */
+
+static void
+load_warm_set(const char *filename)
+{
+    char *contents;
+    char **lines;
+    GError *error = NULL;
+    int i;
+
+    if (warm_set != NULL)
+        g_hash_table_destroy(warm_set);
+    warm_set = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                     (GDestroyNotify) g_ptr_array_unref);
+    g_free(warm_set_filename);
+    warm_set_filename = g_strdup(filename);
+
+    if (!g_file_get_contents(filename, &contents, NULL, &error)) {
+        gjs_debug(GJS_DEBUG_GNAMESPACE, "Not using warm set: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    lines = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+
+    for (i = 0; lines[i] != NULL; i++) {
+        char *line = g_strstrip(lines[i]);
+        char *dot;
+        GPtrArray *names;
+
+        if (*line == '\0' || *line == '#')
+            continue;
+
+        dot = strchr(line, '.');
+        if (dot == NULL || dot == line || dot[1] == '\0')
+            continue;
+        *dot = '\0';
+
+        names = (GPtrArray *) g_hash_table_lookup(warm_set, line);
+        if (names == NULL) {
+            names = g_ptr_array_new_with_free_func(g_free);
+            g_hash_table_insert(warm_set, g_strdup(line), names);
+        }
+        g_ptr_array_add(names, g_strdup(dot + 1));
+    }
+
+    g_strfreev(lines);
+}
+
+static GPtrArray *
+lookup_warm_set(const char *ns_name)
+{
+    const char *filename = g_getenv("GJS_WARM_SET_FILE");
+
+    if (filename == NULL)
+        return NULL;
+
+    if (g_strcmp0(filename, warm_set_filename) != 0)
+        load_warm_set(filename);
+
+    return (GPtrArray *) g_hash_table_lookup(warm_set, ns_name);
+}
+
+static void
+close_warm_set_record(void)
+{
+    fclose(warm_set_record);
+    warm_set_record = NULL;
+    g_hash_table_destroy(warm_set_recorded);
+    warm_set_recorded = NULL;
+}
+
+/* Every context resolves the names it uses again, so each name is
+ * only written the first time */
+static void
+record_resolved_name(const char *ns_name,
+                     const char *name)
+{
+    char *full_name;
+
+    if (!warm_set_record_checked) {
+        const char *filename = g_getenv("GJS_WARM_SET_RECORD");
+
+        warm_set_record_checked = TRUE;
+        if (filename != NULL) {
+            warm_set_record = fopen(filename, "w");
+            if (warm_set_record == NULL) {
+                g_warning("Can't record warm set to %s: %s",
+                          filename, g_strerror(errno));
+            } else {
+                warm_set_recorded = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                          g_free, NULL);
+                atexit(close_warm_set_record);
+            }
+        }
+    }
+
+    if (warm_set_record == NULL)
+        return;
+
+    full_name = g_strdup_printf("%s.%s", ns_name, name);
+    if (g_hash_table_contains(warm_set_recorded, full_name)) {
+        g_free(full_name);
+        return;
+    }
+
+    fprintf(warm_set_record, "%s\n", full_name);
+    fflush(warm_set_record);
+    g_hash_table_add(warm_set_recorded, full_name);
+}
+
 /*
  * Like JSResolveOp, but flags provide contextual information as follows:
  *
@@ -110,6 +241,8 @@ ns_new_resolve(JSContext *context,
         g_base_info_unref(info);
         *objp = *obj; /* we defined the property in this object */
         ret = JS_TRUE;
+
+        record_resolved_name(priv->gi_namespace, name);
     } else {
         gjs_debug(GJS_DEBUG_GNAMESPACE,
                   "Failed to define info '%s'",
@@ -241,3 +374,56 @@ gjs_create_ns(JSContext    *context,
 {
     return ns_new(context, ns_name);
 }
+
+/* Defines all names the warm set lists for the namespace, see
+ * GJS_WARM_SET_FILE above. Names that no longer exist or fail to
+ * define are skipped; the latter will throw again if resolved lazily.
+ */
+void
+gjs_define_ns_warm_set(JSContext *context,
+                       JSObject  *ns)
+{
+    Ns *priv;
+    GPtrArray *names;
+    GIRepository *repo;
+    guint i, n_defined = 0;
+
+    priv = priv_from_js(context, ns);
+    names = lookup_warm_set(priv->gi_namespace);
+    if (names == NULL)
+        return;
+
+    JS_BeginRequest(context);
+
+    repo = g_irepository_get_default();
+
+    for (i = 0; i < names->len; i++) {
+        const char *name = (const char *) g_ptr_array_index(names, i);
+        GIBaseInfo *info;
+        JSBool found;
+
+        /* Defining a class also defines the classes it depends on */
+        if (!JS_AlreadyHasOwnProperty(context, ns, name, &found) || found)
+            continue;
+
+        info = g_irepository_find_by_name(repo, priv->gi_namespace, name);
+        if (info == NULL)
+            continue;
+
+        if (gjs_define_info(context, ns, info)) {
+            n_defined++;
+        } else {
+            gjs_debug(GJS_DEBUG_GNAMESPACE,
+                      "Failed to define warm set info '%s'", name);
+            JS_ClearPendingException(context);
+        }
+
+        g_base_info_unref(info);
+    }
+
+    gjs_debug(GJS_DEBUG_GNAMESPACE,
+              "Defined %u of %u warm set names in namespace '%s'",
+              n_defined, names->len, priv->gi_namespace);
+
+    JS_EndRequest(context);
+}
@@ -32,6 +32,8 @@ G_BEGIN_DECLS
 
 JSObject* gjs_create_ns(JSContext    *context,
                         const char   *ns_name);
+void      gjs_define_ns_warm_set(JSContext *context,
+                                 JSObject  *ns);
 
 G_END_DECLS
 
@@ -24,6 +24,8 @@
 #include <config.h>
 
 #include <string.h>
+#include <stdio.h>
+#include <errno.h>
 
 #include <cjs/gi.h>
 #include "object.h"
@@ -46,25 +48,43 @@
 
 #include <util/log.h>
 #include <util/hash-x32.h>
+#include <util/misc.h>
 #include <girepository.h>
 
+/* Wrapper counters for one GType, see gjs_object_dump_type_stats() */
+typedef struct {
+    GType gtype;
+    guint live;        /* wrappers not finalized yet */
+    guint rooted;      /* of those, kept alive by their GObject */
+    guint64 created;   /* wrappers ever associated with a GObject */
+} ObjectTypeStats;
+
 typedef struct {
     GIObjectInfo *info;
     GObject *gobj; /* NULL if we are the prototype and not an instance */
     JSObject *keep_alive; /* NULL if we are not added to it */
     GType gtype;
 
-    /* a list of all signal connections, used when tracing */
-    GList *signals;
+    /* all signal connections, used when tracing. An array of
+     * ConnectData, each knowing its own index so that it can be
+     * removed in constant time. NULL until the first connection. */
+    GPtrArray *signals;
 
     /* the GObjectClass wrapped by this JS Object (only used for
        prototypes) */
     GTypeClass *klass;
+
+    /* TRUE if this wrapper holds a plain reference on gobj rather than
+     * a toggle ref, see promote_handle_wrapper() */
+    gboolean is_handle;
+
+    /* counters for the type of gobj, NULL for prototypes */
+    ObjectTypeStats *type_stats;
 } ObjectInstance;
 
 typedef struct {
     ObjectInstance *obj;
-    GList *link;
+    guint index; /* in obj->signals */
     GClosure *closure;
 } ConnectData;
 
@@ -74,11 +94,13 @@ typedef enum
   TOGGLE_UP,
 } ToggleDirection;
 
-typedef struct
+typedef struct ToggleRefNotifyOperation
 {
+    struct ToggleRefNotifyOperation *next;
     GObject         *gobj;
     ToggleDirection  direction;
     guint            needs_unref : 1;
+    guint            cancelled : 1;
 } ToggleRefNotifyOperation;
 
 enum {
@@ -93,20 +115,37 @@ extern struct JSClass gjs_object_instance_class;
 static GThread *gjs_eval_thread;
 static volatile gint pending_idle_toggles;
 
+/* -1 until GJS_HANDLE_WRAPPERS has been checked */
+static int handle_wrappers = -1;
+static guint n_handle_wrappers;
+
+static GHashTable *type_stats_table;  /* GType -> ObjectTypeStats */
+
+/* Toggles notified from other threads. Producers push onto
+ * toggle_queue, a lock-free stack of ToggleRefNotifyOperation linked
+ * through ->next, newest first. The main thread takes it over all at
+ * once into toggle_batch, oldest first, and handles it from a single
+ * idle in batches of at most TOGGLE_BATCH_SIZE.
+ */
+#define TOGGLE_BATCH_SIZE 256
+static gpointer toggle_queue;
+static ToggleRefNotifyOperation *toggle_batch;
+static volatile gint toggle_idle_scheduled;
+
 GJS_DEFINE_PRIV_FROM_JS(ObjectInstance, gjs_object_instance_class)
 
-static JSObject*       peek_js_obj  (GObject   *gobj);
-static void            set_js_obj   (GObject   *gobj,
+static JSObject*       peek_js_obj  (JSRuntime *runtime,
+                                     GObject   *gobj);
+static void            set_js_obj   (JSRuntime *runtime,
+                                     GObject   *gobj,
                                      JSObject  *obj);
 
-static void            disassociate_js_gobject (GObject *gobj);
+static void            disassociate_js_gobject (JSRuntime *runtime,
+                                                GObject   *gobj);
 static void            invalidate_all_signals (ObjectInstance *priv);
-typedef enum {
-    SOME_ERROR_OCCURRED = JS_FALSE,
-    NO_SUCH_G_PROPERTY,
-    VALUE_WAS_SET
-} ValueFromPropertyResult;
-
+static void            promote_handle_wrapper (JSContext      *context,
+                                               JSObject       *object,
+                                               ObjectInstance *priv);
 static GQuark
 gjs_is_custom_type_quark (void)
 {
@@ -127,16 +166,6 @@ gjs_is_custom_property_quark (void)
     return val;
 }
 
-static GQuark
-gjs_object_priv_quark (void)
-{
-    static GQuark val = 0;
-    if (G_UNLIKELY (!val))
-        val = g_quark_from_static_string ("gjs::private");
-
-    return val;
-}
-
 static GQuark
 gjs_toggle_down_quark (void)
 {
@@ -181,69 +210,434 @@ throw_priv_is_null_error(JSContext *context)
               " up to the parent _init properly?");
 }
 
-static ValueFromPropertyResult
-init_g_param_from_property(JSContext  *context,
-                           const char *js_prop_name,
-                           jsval       js_value,
-                           GType       gtype,
-                           GParameter *parameter,
-                           gboolean    constructing)
+static inline ObjectInstance *
+proto_priv_from_js(JSContext *context,
+                   JSObject  *obj)
 {
-    char *gname;
-    GParamSpec *param_spec;
-    void *klass;
+    JSObject *proto;
+    JS_GetPrototype(context, obj, &proto);
+    return priv_from_js(context, proto);
+}
 
-    gname = gjs_hyphen_from_camel(js_prop_name);
-    gjs_debug_jsprop(GJS_DEBUG_GOBJECT,
-                     "Hyphen name %s on %s", gname, g_type_name(gtype));
+/* Direct conversions between jsval and a GValue of one fundamental
+ * type, see get_property_accessors() */
+typedef JSBool (*PropertyToJSFunc)   (JSContext    *context,
+                                      const GValue *gvalue,
+                                      jsval        *value_p);
+typedef JSBool (*PropertyFromJSFunc) (JSContext    *context,
+                                      jsval         value,
+                                      GValue       *gvalue);
 
-    klass = g_type_class_ref(gtype);
-    param_spec = g_object_class_find_property(G_OBJECT_CLASS(klass),
-                                              gname);
-    g_type_class_unref(klass);
-    g_free(gname);
+/* What a JS property name resolves to on a GObject class, cached by
+ * jsid so that property gets and sets don't need to convert the name
+ * and look it up again. A NULL @pspec means that the name is not a
+ * GObject property, which is the common case for JS expandos.
+ */
+typedef struct {
+    GParamSpec *pspec;
+    guint readable : 1;
+    guint writable : 1;
+    guint custom : 1;  /* overridden in JS, see gjs_is_custom_property_quark() */
+
+    /* For properties of fundamental types, the accessors and what
+     * g_object_get_property() would end up calling, so that it can be
+     * called directly. NULL otherwise. */
+    PropertyToJSFunc to_js;
+    PropertyFromJSFunc from_js;
+    GObjectClass *owner_class;
+    GParamSpec *vfunc_pspec;
+} PropertyCacheEntry;
+
+typedef struct {
+    /* jsid -> PropertyCacheEntry or SignalCacheEntry. Keys are only
+     * valid for the GC generation the entries were added in. */
+    GHashTable *entries;
+    guint gc_generation;
+} JSIdCache;
+
+/* What a signal name passed to connect() or emit() resolves to */
+typedef struct {
+    const GjsSignalQuery *query;
+    GQuark detail;
+} SignalCacheEntry;
+
+static GQuark
+gjs_property_cache_quark (void)
+{
+    static GQuark val = 0;
+    if (G_UNLIKELY (!val))
+        val = g_quark_from_static_string ("gjs::property-cache");
+
+    return val;
+}
+
+static GQuark
+gjs_signal_cache_quark (void)
+{
+    static GQuark val = 0;
+    if (G_UNLIKELY (!val))
+        val = g_quark_from_static_string ("gjs::signal-cache");
+
+    return val;
+}
+
+static void
+property_cache_entry_free(gpointer data)
+{
+    PropertyCacheEntry *entry = (PropertyCacheEntry *) data;
+
+    if (entry->pspec)
+        g_param_spec_unref(entry->pspec);
+    if (entry->owner_class)
+        g_type_class_unref(entry->owner_class);
+    g_slice_free(PropertyCacheEntry, entry);
+}
+
+static void
+signal_cache_entry_free(gpointer data)
+{
+    g_slice_free(SignalCacheEntry, data);
+}
 
-    if (param_spec == NULL) {
-        /* not a GObject prop, so nothing else to do */
-        return NO_SUCH_G_PROPERTY;
+/* The caches live on the GType rather than on the JS prototype, since
+ * instances of unintrospected subclasses share their parent's prototype
+ * but can have properties and signals of their own. They are never
+ * freed; like the class they describe, they live as long as the type
+ * does. */
+static JSIdCache *
+get_jsid_cache(JSContext     *context,
+               GType          gtype,
+               GQuark         quark,
+               GDestroyNotify entry_free)
+{
+    JSIdCache *cache;
+    guint gc_generation;
+
+    cache = (JSIdCache *) g_type_get_qdata(gtype, quark);
+    if (G_UNLIKELY(cache == NULL)) {
+        cache = g_new0(JSIdCache, 1);
+        cache->entries = g_hash_table_new_full(NULL, NULL, NULL, entry_free);
+        g_type_set_qdata(gtype, quark, cache);
     }
 
-    /* Do not set JS overridden properties through GObject, to avoid
-     * infinite recursion (but set them when constructing) */
-    if (!constructing &&
-        g_param_spec_get_qdata(param_spec, gjs_is_custom_property_quark()))
-        return NO_SUCH_G_PROPERTY;
+    gc_generation = gjs_runtime_get_gc_generation(JS_GetRuntime(context));
+    if (G_UNLIKELY(cache->gc_generation != gc_generation)) {
+        g_hash_table_remove_all(cache->entries);
+        cache->gc_generation = gc_generation;
+    }
 
+    return cache;
+}
 
-    if ((param_spec->flags & G_PARAM_WRITABLE) == 0) {
-        /* prevent setting the prop even in JS */
-        gjs_throw(context, "Property %s (GObject %s) is not writable",
-                     js_prop_name, param_spec->name);
-        return SOME_ERROR_OCCURRED;
+static JSBool
+property_boolean_to_js(JSContext    *context,
+                       const GValue *gvalue,
+                       jsval        *value_p)
+{
+    *value_p = BOOLEAN_TO_JSVAL(!!g_value_get_boolean(gvalue));
+    return JS_TRUE;
+}
+
+static JSBool
+property_int_to_js(JSContext    *context,
+                   const GValue *gvalue,
+                   jsval        *value_p)
+{
+    return JS_NewNumberValue(context, g_value_get_int(gvalue), value_p);
+}
+
+static JSBool
+property_uint_to_js(JSContext    *context,
+                    const GValue *gvalue,
+                    jsval        *value_p)
+{
+    return JS_NewNumberValue(context, g_value_get_uint(gvalue), value_p);
+}
+
+static JSBool
+property_double_to_js(JSContext    *context,
+                      const GValue *gvalue,
+                      jsval        *value_p)
+{
+    return JS_NewNumberValue(context, g_value_get_double(gvalue), value_p);
+}
+
+static JSBool
+property_float_to_js(JSContext    *context,
+                     const GValue *gvalue,
+                     jsval        *value_p)
+{
+    return JS_NewNumberValue(context, g_value_get_float(gvalue), value_p);
+}
+
+static JSBool
+property_string_to_js(JSContext    *context,
+                      const GValue *gvalue,
+                      jsval        *value_p)
+{
+    const char *v = g_value_get_string(gvalue);
+
+    if (v == NULL) {
+        *value_p = JSVAL_NULL;
+        return JS_TRUE;
     }
+    return gjs_string_from_utf8(context, v, -1, value_p);
+}
 
-    gjs_debug_jsprop(GJS_DEBUG_GOBJECT,
-                     "Syncing %s to GObject prop %s",
-                     js_prop_name, param_spec->name);
+/* Enums and flags need their GType's introspection data in some cases,
+ * so they keep going through the generic conversion. */
+static JSBool
+property_generic_to_js(JSContext    *context,
+                       const GValue *gvalue,
+                       jsval        *value_p)
+{
+    return gjs_value_from_g_value(context, value_p, gvalue);
+}
 
-    g_value_init(&parameter->value, G_PARAM_SPEC_VALUE_TYPE(param_spec));
-    if (!gjs_value_to_g_value(context, js_value, &parameter->value)) {
-        g_value_unset(&parameter->value);
-        return SOME_ERROR_OCCURRED;
+static JSBool
+property_boolean_from_js(JSContext *context,
+                         jsval      value,
+                         GValue    *gvalue)
+{
+    JSBool b;
+
+    if (!JS_ValueToBoolean(context, value, &b)) {
+        gjs_throw(context, "Wrong type %s; boolean expected",
+                  gjs_get_type_name(value));
+        return JS_FALSE;
     }
+    g_value_set_boolean(gvalue, b);
+    return JS_TRUE;
+}
 
-    parameter->name = param_spec->name;
+static JSBool
+property_int_from_js(JSContext *context,
+                     jsval      value,
+                     GValue    *gvalue)
+{
+    gint32 i;
 
-    return VALUE_WAS_SET;
+    if (!JS_ValueToInt32(context, value, &i)) {
+        gjs_throw(context, "Wrong type %s; integer expected",
+                  gjs_get_type_name(value));
+        return JS_FALSE;
+    }
+    g_value_set_int(gvalue, i);
+    return JS_TRUE;
 }
 
-static inline ObjectInstance *
-proto_priv_from_js(JSContext *context,
-                   JSObject  *obj)
+static JSBool
+property_uint_from_js(JSContext *context,
+                      jsval      value,
+                      GValue    *gvalue)
 {
-    JSObject *proto;
-    JS_GetPrototype(context, obj, &proto);
-    return priv_from_js(context, proto);
+    guint32 i;
+
+    if (!JS_ValueToECMAUint32(context, value, &i)) {
+        gjs_throw(context, "Wrong type %s; unsigned integer expected",
+                  gjs_get_type_name(value));
+        return JS_FALSE;
+    }
+    g_value_set_uint(gvalue, i);
+    return JS_TRUE;
+}
+
+static JSBool
+property_double_from_js(JSContext *context,
+                        jsval      value,
+                        GValue    *gvalue)
+{
+    double d;
+
+    if (!JS_ValueToNumber(context, value, &d)) {
+        gjs_throw(context, "Wrong type %s; double expected",
+                  gjs_get_type_name(value));
+        return JS_FALSE;
+    }
+    g_value_set_double(gvalue, d);
+    return JS_TRUE;
+}
+
+static JSBool
+property_float_from_js(JSContext *context,
+                       jsval      value,
+                       GValue    *gvalue)
+{
+    double d;
+
+    if (!JS_ValueToNumber(context, value, &d)) {
+        gjs_throw(context, "Wrong type %s; float expected",
+                  gjs_get_type_name(value));
+        return JS_FALSE;
+    }
+    g_value_set_float(gvalue, d);
+    return JS_TRUE;
+}
+
+static JSBool
+property_string_from_js(JSContext *context,
+                        jsval      value,
+                        GValue    *gvalue)
+{
+    char *utf8_string;
+
+    /* Like gjs_value_to_g_value(), don't toString() everything */
+    if (JSVAL_IS_NULL(value)) {
+        g_value_set_string(gvalue, NULL);
+        return JS_TRUE;
+    }
+
+    if (!JSVAL_IS_STRING(value)) {
+        gjs_throw(context, "Wrong type %s; string expected",
+                  gjs_get_type_name(value));
+        return JS_FALSE;
+    }
+
+    if (!gjs_string_to_utf8(context, value, &utf8_string))
+        return JS_FALSE;
+
+    g_value_take_string(gvalue, utf8_string);
+    return JS_TRUE;
+}
+
+static JSBool
+property_generic_from_js(JSContext *context,
+                         jsval      value,
+                         GValue    *gvalue)
+{
+    return gjs_value_to_g_value(context, value, gvalue);
+}
+
+/* Fills in the direct accessors of @entry, if its property has one of
+ * the fundamental types we have them for. */
+static void
+get_property_accessors(PropertyCacheEntry *entry)
+{
+    GParamSpec *pspec = entry->pspec;
+    GType value_type = G_PARAM_SPEC_VALUE_TYPE(pspec);
+    GObjectClass *owner_class;
+    GParamSpec *redirect;
+
+    switch (G_TYPE_FUNDAMENTAL(value_type)) {
+    case G_TYPE_BOOLEAN:
+        entry->to_js = property_boolean_to_js;
+        entry->from_js = property_boolean_from_js;
+        break;
+    case G_TYPE_INT:
+        entry->to_js = property_int_to_js;
+        entry->from_js = property_int_from_js;
+        break;
+    case G_TYPE_UINT:
+        entry->to_js = property_uint_to_js;
+        entry->from_js = property_uint_from_js;
+        break;
+    case G_TYPE_DOUBLE:
+        entry->to_js = property_double_to_js;
+        entry->from_js = property_double_from_js;
+        break;
+    case G_TYPE_FLOAT:
+        entry->to_js = property_float_to_js;
+        entry->from_js = property_float_from_js;
+        break;
+    case G_TYPE_STRING:
+        entry->to_js = property_string_to_js;
+        entry->from_js = property_string_from_js;
+        break;
+    case G_TYPE_ENUM:
+    case G_TYPE_FLAGS:
+        entry->to_js = property_generic_to_js;
+        entry->from_js = property_generic_from_js;
+        break;
+    default:
+        return;
+    }
+
+    /* Deprecated properties go through g_object_get_property(), which
+     * knows whether to warn about them */
+    if (pspec->flags & G_PARAM_DEPRECATED)
+        return;
+
+    /* This is what g_object_get_property() does once it has found the
+     * GParamSpec: interface properties are implemented through
+     * overrides that redirect to the interface's GParamSpec. The class
+     * is kept alive by the entry, in case its type is dynamic. */
+    owner_class = (GObjectClass *) g_type_class_ref(pspec->owner_type);
+    if (owner_class->get_property != NULL) {
+        redirect = g_param_spec_get_redirect_target(pspec);
+        entry->owner_class = owner_class;
+        entry->vfunc_pspec = redirect ? redirect : pspec;
+    } else {
+        g_type_class_unref(owner_class);
+    }
+}
+
+/* Returns NULL if @id is not a string or on OOM */
+static PropertyCacheEntry *
+lookup_property(JSContext    *context,
+                GObjectClass *klass,
+                jsid          id)
+{
+    JSIdCache *cache;
+    PropertyCacheEntry *entry;
+    char *name, *gname;
+    GParamSpec *pspec;
+
+    if (!JSID_IS_STRING(id))
+        return NULL;
+
+    cache = get_jsid_cache(context, G_OBJECT_CLASS_TYPE(klass),
+                           gjs_property_cache_quark(),
+                           property_cache_entry_free);
+    entry = (PropertyCacheEntry *) g_hash_table_lookup(cache->entries,
+                                                       (gpointer) JSID_BITS(id));
+    if (G_LIKELY(entry != NULL))
+        return entry;
+
+    if (!gjs_get_string_id(context, id, &name))
+        return NULL;
+
+    gname = gjs_hyphen_from_camel(name);
+    pspec = g_object_class_find_property(klass, gname);
+
+    gjs_debug_jsprop(GJS_DEBUG_GOBJECT,
+                     "Caching prop '%s' (%s) on %s: %s", name, gname,
+                     G_OBJECT_CLASS_NAME(klass),
+                     pspec ? pspec->name : "not a GObject property");
+
+    g_free(gname);
+    g_free(name);
+
+    entry = g_slice_new0(PropertyCacheEntry);
+    if (pspec != NULL) {
+        entry->pspec = g_param_spec_ref(pspec);
+        entry->readable = (pspec->flags & G_PARAM_READABLE) != 0;
+        entry->writable = (pspec->flags & G_PARAM_WRITABLE) != 0;
+        entry->custom = g_param_spec_get_qdata(pspec, gjs_is_custom_property_quark()) != NULL;
+        get_property_accessors(entry);
+    }
+
+    g_hash_table_insert(cache->entries, (gpointer) JSID_BITS(id), entry);
+    return entry;
+}
+
+/* a hook on adding a property to the object, in JS or through
+ * object_instance_set_prop(). Return value is JS_FALSE on OOM/exception.
+ */
+static JSBool
+object_instance_add_prop(JSContext              *context,
+                         JS::HandleObject        obj,
+                         JS::HandleId            id,
+                         JS::MutableHandleValue  value_p)
+{
+    ObjectInstance *priv;
+
+    priv = priv_from_js(context, obj);
+
+    /* The property would be lost along with a handle wrapper */
+    if (priv != NULL && priv->is_handle)
+        promote_handle_wrapper(context, obj, priv);
+
+    return JS_TRUE;
 }
 
 /* a hook on getting a property; set value_p to override property's value.
@@ -256,62 +650,49 @@ object_instance_get_prop(JSContext              *context,
                          JS::MutableHandleValue  value_p)
 {
     ObjectInstance *priv;
-    char *name;
-    char *gname;
+    PropertyCacheEntry *entry;
     GParamSpec *param;
     GValue gvalue = { 0, };
-    JSBool ret = JS_TRUE;
-
-    if (!gjs_get_string_id(context, id, &name))
-        return JS_TRUE; /* not resolved, but no error */
+    JSBool ret;
 
     priv = priv_from_js(context, obj);
-    gjs_debug_jsprop(GJS_DEBUG_GOBJECT,
-                     "Get prop '%s' hook obj %p priv %p", name, obj, priv);
 
     if (priv == NULL) {
         /* If we reach this point, either object_instance_new_resolve
          * did not throw (so name == "_init"), or the property actually
          * exists and it's not something we should be concerned with */
-        goto out;
+        return JS_TRUE;
     }
     if (priv->gobj == NULL) /* prototype, not an instance. */
-        goto out;
+        return JS_TRUE;
 
-    gname = gjs_hyphen_from_camel(name);
-    param = g_object_class_find_property(G_OBJECT_GET_CLASS(priv->gobj),
-                                         gname);
-    g_free(gname);
+    entry = lookup_property(context, G_OBJECT_GET_CLASS(priv->gobj), id);
 
-    if (param == NULL) {
-        /* leave value_p as it was */
-        goto out;
-    }
-
-    /* Do not fetch JS overridden properties from GObject, to avoid
-     * infinite recursion. */
-    if (g_param_spec_get_qdata(param, gjs_is_custom_property_quark()))
-        goto out;
+    /* Not a GObject prop: leave value_p as it was. Do not fetch JS
+     * overridden properties from GObject, to avoid infinite recursion. */
+    if (entry == NULL || entry->pspec == NULL || entry->custom || !entry->readable)
+        return JS_TRUE;
 
-    if ((param->flags & G_PARAM_READABLE) == 0)
-        goto out;
-
-    gjs_debug_jsprop(GJS_DEBUG_GOBJECT,
-                     "Overriding %s with GObject prop %s",
-                     name, param->name);
+    param = entry->pspec;
 
     g_value_init(&gvalue, G_PARAM_SPEC_VALUE_TYPE(param));
-    g_object_get_property(priv->gobj, param->name,
-                          &gvalue);
-    if (!gjs_value_from_g_value(context, value_p.address(), &gvalue)) {
-        g_value_unset(&gvalue);
-        ret = JS_FALSE;
-        goto out;
+
+    if (entry->owner_class != NULL) {
+        /* Skip the name lookup in g_object_get_property(), we already
+         * know which vfunc it would call. Like it, hold a reference in
+         * case the getter drops the last other one. */
+        g_object_ref(priv->gobj);
+        entry->owner_class->get_property(priv->gobj, param->param_id,
+                                         &gvalue, entry->vfunc_pspec);
+        g_object_unref(priv->gobj);
+        ret = entry->to_js(context, &gvalue, value_p.address());
+    } else {
+        g_object_get_property(priv->gobj, param->name,
+                              &gvalue);
+        ret = gjs_value_from_g_value(context, value_p.address(), &gvalue);
     }
-    g_value_unset(&gvalue);
 
- out:
-    g_free(name);
+    g_value_unset(&gvalue);
     return ret;
 }
 
@@ -326,41 +707,50 @@ object_instance_set_prop(JSContext              *context,
                          JS::MutableHandleValue  value_p)
 {
     ObjectInstance *priv;
-    char *name;
-    GParameter param = { NULL, { 0, }};
-    JSBool ret = JS_TRUE;
-
-    if (!gjs_get_string_id(context, id, &name))
-        return JS_TRUE; /* not resolved, but no error */
+    PropertyCacheEntry *entry;
+    GParamSpec *param;
+    GValue gvalue = { 0, };
 
     priv = priv_from_js(context, obj);
-    gjs_debug_jsprop(GJS_DEBUG_GOBJECT,
-                     "Set prop '%s' hook obj %p priv %p", name, obj, priv);
 
     if (priv == NULL) {
         /* see the comment in object_instance_get_prop() on this */
-        goto out;
+        return JS_TRUE;
     }
     if (priv->gobj == NULL) /* prototype, not an instance. */
-        goto out;
+        return JS_TRUE;
 
-    switch (init_g_param_from_property(context, name,
-                                       value_p,
-                                       G_TYPE_FROM_INSTANCE(priv->gobj),
-                                       &param,
-                                       FALSE /* constructing */)) {
-    case SOME_ERROR_OCCURRED:
-        ret = JS_FALSE;
-    case NO_SUCH_G_PROPERTY:
-        goto out;
-    case VALUE_WAS_SET:
-        break;
+    entry = lookup_property(context, G_OBJECT_GET_CLASS(priv->gobj), id);
+
+    /* Do not set JS overridden properties through GObject, to avoid
+     * infinite recursion */
+    if (entry == NULL || entry->pspec == NULL || entry->custom)
+        return JS_TRUE;
+
+    param = entry->pspec;
+
+    if (!entry->writable) {
+        char *name;
+
+        /* prevent setting the prop even in JS */
+        if (gjs_get_string_id(context, id, &name)) {
+            gjs_throw(context, "Property %s (GObject %s) is not writable",
+                      name, param->name);
+            g_free(name);
+        }
+        return JS_FALSE;
     }
 
-    g_object_set_property(priv->gobj, param.name,
-                          &param.value);
+    g_value_init(&gvalue, G_PARAM_SPEC_VALUE_TYPE(param));
+    if (!(entry->from_js ?
+          entry->from_js(context, value_p, &gvalue) :
+          gjs_value_to_g_value(context, value_p, &gvalue))) {
+        g_value_unset(&gvalue);
+        return JS_FALSE;
+    }
 
-    g_value_unset(&param.value);
+    g_object_set_property(priv->gobj, param->name, &gvalue);
+    g_value_unset(&gvalue);
 
     /* note that the prop will also have been set in JS, which I think
      * is OK, since we hook get and set so will always override that
@@ -368,9 +758,7 @@ object_instance_set_prop(JSContext              *context,
      * getter/setter maybe, don't know if that is better.
      */
 
- out:
-    g_free(name);
-    return ret;
+    return JS_TRUE;
 }
 
 static gboolean
@@ -644,49 +1032,188 @@ object_instance_new_resolve(JSContext *context,
     return ret;
 }
 
+/* The pspecs a constructor's property hash resolves to, for one list
+ * of keys. Objects of a class tend to be constructed with the same
+ * keys over and over, so a few of these are kept per GType and reused
+ * instead of looking up every key again.
+ */
+typedef struct {
+    guint n_props;
+    gsize *ids;         /* JSID_BITS() of the keys, in enumeration order */
+    GParamSpec **pspecs;
+    PropertyFromJSFunc *from_js; /* see PropertyCacheEntry */
+} ConstructorShape;
+
+typedef struct {
+    /* ConstructorShape, most recently added last. Like the other jsid
+     * caches, only valid for the GC generation they were added in. */
+    GPtrArray *shapes;
+    guint gc_generation;
+} ConstructorShapeCache;
+
+#define MAX_CONSTRUCTOR_SHAPES 8
+
+/* Turned off only to measure what the shapes save: every construction
+ * then builds its shape from scratch */
+static gboolean constructor_shapes_enabled = TRUE;
+
+static GQuark
+gjs_constructor_shape_cache_quark (void)
+{
+    static GQuark val = 0;
+    if (G_UNLIKELY (!val))
+        val = g_quark_from_static_string ("gjs::constructor-shape-cache");
+
+    return val;
+}
+
 static void
-free_g_params(GParameter *params,
-              int         n_params)
+constructor_shape_free(gpointer data)
 {
-    int i;
+    ConstructorShape *shape = (ConstructorShape *) data;
+    guint i;
 
-    for (i = 0; i < n_params; ++i) {
-        g_value_unset(&params[i].value);
+    for (i = 0; i < shape->n_props; i++)
+        g_param_spec_unref(shape->pspecs[i]);
+    g_free(shape->ids);
+    g_free(shape->pspecs);
+    g_free(shape->from_js);
+    g_slice_free(ConstructorShape, shape);
+}
+
+/* Returns NULL with an exception set if one of @ids is not a writable
+ * property of @gtype */
+static ConstructorShape *
+lookup_constructor_shape(JSContext *context,
+                         GType      gtype,
+                         gsize     *ids,
+                         guint      n_ids)
+{
+    ConstructorShapeCache *cache;
+    ConstructorShape *shape;
+    GObjectClass *klass;
+    guint gc_generation;
+    guint i;
+
+    cache = (ConstructorShapeCache *) g_type_get_qdata(gtype, gjs_constructor_shape_cache_quark());
+    if (G_UNLIKELY(cache == NULL)) {
+        cache = g_new0(ConstructorShapeCache, 1);
+        cache->shapes = g_ptr_array_new_with_free_func(constructor_shape_free);
+        g_type_set_qdata(gtype, gjs_constructor_shape_cache_quark(), cache);
     }
-    g_free(params);
+
+    gc_generation = gjs_runtime_get_gc_generation(JS_GetRuntime(context));
+    if (G_UNLIKELY(cache->gc_generation != gc_generation ||
+                   !constructor_shapes_enabled)) {
+        g_ptr_array_set_size(cache->shapes, 0);
+        cache->gc_generation = gc_generation;
+    }
+
+    for (i = cache->shapes->len; i > 0; i--) {
+        shape = (ConstructorShape *) g_ptr_array_index(cache->shapes, i - 1);
+        if (shape->n_props == n_ids &&
+            memcmp(shape->ids, ids, n_ids * sizeof(gsize)) == 0)
+            return shape;
+    }
+
+    shape = g_slice_new0(ConstructorShape);
+    shape->ids = (gsize *) g_memdup(ids, n_ids * sizeof(gsize));
+    shape->pspecs = g_new0(GParamSpec *, n_ids);
+    shape->from_js = g_new0(PropertyFromJSFunc, n_ids);
+
+    klass = (GObjectClass *) g_type_class_ref(gtype);
+
+    for (i = 0; i < n_ids; i++) {
+        jsid id = JSID_FROM_BITS(ids[i]);
+        PropertyCacheEntry *entry;
+        char *name;
+
+        entry = lookup_property(context, klass, id);
+
+        /* Custom properties are set through GObject when constructing,
+         * unlike when setting them later */
+        if (entry == NULL || entry->pspec == NULL) {
+            if (gjs_get_string_id(context, id, &name)) {
+                gjs_throw(context, "No property %s on this GObject %s",
+                          name, g_type_name(gtype));
+                g_free(name);
+            }
+            goto fail;
+        }
+
+        if (!entry->writable) {
+            if (gjs_get_string_id(context, id, &name)) {
+                gjs_throw(context, "Property %s (GObject %s) is not writable",
+                          name, entry->pspec->name);
+                g_free(name);
+            }
+            goto fail;
+        }
+
+        shape->pspecs[i] = g_param_spec_ref(entry->pspec);
+        shape->from_js[i] = entry->from_js;
+        shape->n_props = i + 1;
+    }
+
+    g_type_class_unref(klass);
+
+    if (cache->shapes->len >= MAX_CONSTRUCTOR_SHAPES)
+        g_ptr_array_remove_index(cache->shapes, 0);
+    g_ptr_array_add(cache->shapes, shape);
+
+    return shape;
+
+ fail:
+    g_type_class_unref(klass);
+    constructor_shape_free(shape);
+    return NULL;
+}
+
+static void
+free_g_values(GValue *values,
+              guint   n_values)
+{
+    guint i;
+
+    for (i = 0; i < n_values; ++i) {
+        g_value_unset(&values[i]);
+    }
+    g_free(values);
 }
 
-/* Set properties from args to constructor (argv[0] is supposed to be
- * a hash)
+/* Converts the properties passed to a constructor (argv[0] is supposed
+ * to be a hash) into parallel arrays of names and values, as taken by
+ * g_object_new_with_properties().
  */
 static JSBool
-object_instance_props_to_g_parameters(JSContext   *context,
-                                      JSObject    *obj,
-                                      unsigned     argc,
-                                      jsval       *argv,
-                                      GType        gtype,
-                                      GParameter **gparams_p,
-                                      int         *n_gparams_p)
+object_instance_props_to_g_values(JSContext     *context,
+                                  JSObject      *obj,
+                                  unsigned       argc,
+                                  jsval         *argv,
+                                  GType          gtype,
+                                  const char  ***names_p,
+                                  GValue       **values_p,
+                                  guint         *n_values_p)
 {
     JSObject *props;
     JSObject *iter;
     jsid prop_id;
-    GArray *gparams;
-
-    if (gparams_p)
-        *gparams_p = NULL;
-    if (n_gparams_p)
-        *n_gparams_p = 0;
+    GArray *ids;
+    ConstructorShape *shape;
+    const char **names;
+    GValue *values;
+    guint i;
 
-    gparams = g_array_new(/* nul term */ FALSE, /* clear */ TRUE,
-                          sizeof(GParameter));
+    *names_p = NULL;
+    *values_p = NULL;
+    *n_values_p = 0;
 
     if (argc == 0 || JSVAL_IS_VOID(argv[0]))
-        goto out;
+        return JS_TRUE;
 
     if (!JSVAL_IS_OBJECT(argv[0])) {
         gjs_throw(context, "argument should be a hash with props to set");
-        goto free_array_and_fail;
+        return JS_FALSE;
     }
 
     props = JSVAL_TO_OBJECT(argv[0]);
@@ -694,68 +1221,104 @@ object_instance_props_to_g_parameters(JSContext   *context,
     iter = JS_NewPropertyIterator(context, props);
     if (iter == NULL) {
         gjs_throw(context, "Failed to create property iterator for object props hash");
-        goto free_array_and_fail;
+        return JS_FALSE;
     }
 
+    ids = g_array_new(FALSE, FALSE, sizeof(gsize));
+
     prop_id = JSID_VOID;
     if (!JS_NextProperty(context, iter, &prop_id))
-        goto free_array_and_fail;
+        goto free_ids_and_fail;
 
     while (!JSID_IS_VOID(prop_id)) {
-        char *name = NULL;
-        jsval value;
-        GParameter gparam = { NULL, { 0, }};
+        gsize bits = JSID_BITS(prop_id);
 
-        if (!gjs_object_require_property(context, props, "property list", prop_id, &value)) {
-            goto free_array_and_fail;
-        }
+        g_array_append_val(ids, bits);
 
-        if (!gjs_get_string_id(context, prop_id, &name))
-            goto free_array_and_fail;
+        prop_id = JSID_VOID;
+        if (!JS_NextProperty(context, iter, &prop_id))
+            goto free_ids_and_fail;
+    }
 
-        switch (init_g_param_from_property(context, name,
-                                           value,
-                                           gtype,
-                                           &gparam,
-                                           TRUE /* constructing */)) {
-        case NO_SUCH_G_PROPERTY:
-            gjs_throw(context, "No property %s on this GObject %s",
-                         name, g_type_name(gtype));
-        case SOME_ERROR_OCCURRED:
-            g_free(name);
-            goto free_array_and_fail;
-        case VALUE_WAS_SET:
-            break;
-        }
+    if (ids->len == 0) {
+        g_array_free(ids, TRUE);
+        return JS_TRUE;
+    }
 
-        g_free(name);
+    shape = lookup_constructor_shape(context, gtype,
+                                     (gsize *) ids->data, ids->len);
+    g_array_free(ids, TRUE);
+    if (shape == NULL)
+        return JS_FALSE;
 
-        g_array_append_val(gparams, gparam);
+    names = g_new(const char *, shape->n_props);
+    values = g_new0(GValue, shape->n_props);
 
-        prop_id = JSID_VOID;
-        if (!JS_NextProperty(context, iter, &prop_id))
-            goto free_array_and_fail;
-    }
+    for (i = 0; i < shape->n_props; i++) {
+        GParamSpec *pspec = shape->pspecs[i];
+        jsval value;
+        JSBool converted;
 
- out:
-    if (n_gparams_p)
-        *n_gparams_p = gparams->len;
-    if (gparams_p)
-        *gparams_p = (GParameter*) g_array_free(gparams, FALSE);
+        if (!gjs_object_require_property(context, props, "property list",
+                                         JSID_FROM_BITS(shape->ids[i]), &value))
+            goto free_values_and_fail;
 
-    return JS_TRUE;
+        names[i] = pspec->name;
+        g_value_init(&values[i], G_PARAM_SPEC_VALUE_TYPE(pspec));
+
+        if (shape->from_js[i] != NULL)
+            converted = shape->from_js[i](context, value, &values[i]);
+        else
+            converted = gjs_value_to_g_value(context, value, &values[i]);
 
- free_array_and_fail:
-    {
-        GParameter *to_free;
-        int count;
-        count = gparams->len;
-        to_free = (GParameter*) g_array_free(gparams, FALSE);
-        free_g_params(to_free, count);
+        if (!converted) {
+            /* Unset values[i] too */
+            i++;
+            goto free_values_and_fail;
+        }
     }
+
+    *names_p = names;
+    *values_p = values;
+    *n_values_p = shape->n_props;
+    return JS_TRUE;
+
+ free_ids_and_fail:
+    g_array_free(ids, TRUE);
+    return JS_FALSE;
+
+ free_values_and_fail:
+    g_free(names);
+    free_g_values(values, i);
     return JS_FALSE;
 }
 
+static GObject *
+object_new_with_properties(GType         gtype,
+                           guint         n_properties,
+                           const char  **names,
+                           const GValue *values)
+{
+#if GLIB_CHECK_VERSION(2, 54, 0)
+    return g_object_new_with_properties(gtype, n_properties, names, values);
+#else
+    GParameter *params;
+    GObject *gobj;
+    guint i;
+
+    /* The values are only borrowed for the call */
+    params = g_new(GParameter, n_properties);
+    for (i = 0; i < n_properties; i++) {
+        params[i].name = names[i];
+        memcpy(&params[i].value, &values[i], sizeof(GValue));
+    }
+
+    gobj = (GObject*) g_object_newv(gtype, n_properties, params);
+    g_free(params);
+    return gobj;
+#endif
+}
+
 #define DEBUG_DISPOSE 0
 #if DEBUG_DISPOSE
 static void
@@ -766,6 +1329,51 @@ wrapped_gobj_dispose_notify(gpointer      data,
 }
 #endif
 
+static ObjectTypeStats *
+get_type_stats(GType gtype)
+{
+    ObjectTypeStats *stats;
+
+    if (G_UNLIKELY (type_stats_table == NULL))
+        type_stats_table = g_hash_table_new(NULL, NULL);
+
+    stats = (ObjectTypeStats *) g_hash_table_lookup(type_stats_table, (gpointer) gtype);
+    if (stats == NULL) {
+        stats = g_slice_new0(ObjectTypeStats);
+        stats->gtype = gtype;
+        g_hash_table_insert(type_stats_table, (gpointer) gtype, stats);
+    }
+
+    return stats;
+}
+
+/* Counts a wrapper that was just associated with priv->gobj */
+static void
+track_wrapper(ObjectInstance *priv)
+{
+    g_assert(priv->type_stats == NULL);
+
+    priv->type_stats = get_type_stats(G_OBJECT_TYPE(priv->gobj));
+    priv->type_stats->live++;
+    priv->type_stats->created++;
+}
+
+/* All changes to priv->keep_alive go through here, so that the
+ * per-type count of rooted wrappers stays right */
+static void
+set_keep_alive(ObjectInstance *priv,
+               JSObject       *keep_alive)
+{
+    if (priv->type_stats != NULL) {
+        if (priv->keep_alive == NULL && keep_alive != NULL)
+            priv->type_stats->rooted++;
+        else if (priv->keep_alive != NULL && keep_alive == NULL)
+            priv->type_stats->rooted--;
+    }
+
+    priv->keep_alive = keep_alive;
+}
+
 static void
 gobj_no_longer_kept_alive_func(JSObject *obj,
                                void     *data)
@@ -778,7 +1386,7 @@ gobj_no_longer_kept_alive_func(JSObject *obj,
                         "GObject wrapper %p will no longer be kept alive, eligible for collection",
                         obj);
 
-    priv->keep_alive = NULL;
+    set_keep_alive(priv, NULL);
 }
 
 static GQuark
@@ -801,8 +1409,8 @@ get_qdata_key_for_toggle_direction(ToggleDirection direction)
 }
 
 static gboolean
-clear_toggle_idle_source(GObject          *gobj,
-                         ToggleDirection   direction)
+clear_toggle_idle(GObject          *gobj,
+                  ToggleDirection   direction)
 {
     GQuark qdata_key;
 
@@ -812,8 +1420,8 @@ clear_toggle_idle_source(GObject          *gobj,
 }
 
 static gboolean
-toggle_idle_source_is_queued(GObject          *gobj,
-                             ToggleDirection   direction)
+toggle_idle_is_queued(GObject          *gobj,
+                      ToggleDirection   direction)
 {
     GQuark qdata_key;
 
@@ -827,25 +1435,35 @@ cancel_toggle_idle(GObject         *gobj,
                    ToggleDirection  direction)
 {
     GQuark qdata_key;
-    GSource *source;
+    ToggleRefNotifyOperation *operation;
 
     qdata_key = get_qdata_key_for_toggle_direction(direction);
 
-    source = (GSource*) g_object_steal_qdata(gobj, qdata_key);
+    operation = (ToggleRefNotifyOperation *) g_object_steal_qdata(gobj, qdata_key);
+
+    if (operation == NULL)
+        return FALSE;
 
-    if (source)
-        g_source_destroy(source);
+    /* It stays in the queue, to be skipped and freed when the idle
+     * gets to it; but the reference is dropped now. */
+    operation->cancelled = TRUE;
+    if (operation->needs_unref)
+        g_object_unref(operation->gobj);
+    operation->needs_unref = FALSE;
+    operation->gobj = NULL;
+    g_atomic_int_add(&pending_idle_toggles, -1);
 
-    return source != 0;
+    return TRUE;
 }
 
 static void
-handle_toggle_down(GObject *gobj)
+handle_toggle_down(JSContext *context,
+                   GObject   *gobj)
 {
     ObjectInstance *priv;
     JSObject *obj;
 
-    obj = peek_js_obj(gobj);
+    obj = peek_js_obj(JS_GetRuntime(context), gobj);
 
     priv = (ObjectInstance *) JS_GetPrivate(obj);
 
@@ -862,12 +1480,13 @@ handle_toggle_down(GObject *gobj)
                                     gobj_no_longer_kept_alive_func,
                                     obj,
                                     priv);
-        priv->keep_alive = NULL;
+        set_keep_alive(priv, NULL);
     }
 }
 
 static void
-handle_toggle_up(GObject   *gobj)
+handle_toggle_up(JSContext *context,
+                 GObject   *gobj)
 {
     ObjectInstance *priv;
     JSObject *obj;
@@ -876,7 +1495,7 @@ handle_toggle_up(GObject   *gobj)
      * doesn't get garbage collected (and lose any associated javascript state
      * such as custom properties).
      */
-    obj = peek_js_obj(gobj);
+    obj = peek_js_obj(JS_GetRuntime(context), gobj);
 
     if (!obj) /* Object already GC'd */
         return;
@@ -891,11 +1510,8 @@ handle_toggle_up(GObject   *gobj)
      * in case the wrapper has data in it that the app cares about
      */
     if (priv->keep_alive == NULL) {
-        /* FIXME: thread the context through somehow. Maybe by looking up
-         * the compartment that obj belongs to. */
-        GjsContext *context = gjs_context_get_current();
         gjs_debug_lifecycle(GJS_DEBUG_GOBJECT, "Adding object to keep alive");
-        priv->keep_alive = gjs_keep_alive_get_global((JSContext*) gjs_context_get_native_context(context));
+        set_keep_alive(priv, gjs_keep_alive_get_global(context));
         gjs_keep_alive_add_child(priv->keep_alive,
                                  gobj_no_longer_kept_alive_func,
                                  obj,
@@ -903,38 +1519,87 @@ handle_toggle_up(GObject   *gobj)
     }
 }
 
-static gboolean
-idle_handle_toggle(gpointer data)
+static void
+handle_toggle_operation(JSContext                *context,
+                        ToggleRefNotifyOperation *operation)
 {
-    ToggleRefNotifyOperation *operation = (ToggleRefNotifyOperation *) data;
-
-    if (!clear_toggle_idle_source(operation->gobj, operation->direction)) {
+    if (operation->cancelled) {
         /* Already cleared, the JSObject is going away, abort mission */
         goto out;
     }
 
+    clear_toggle_idle(operation->gobj, operation->direction);
+
     switch (operation->direction) {
         case TOGGLE_UP:
-            handle_toggle_up(operation->gobj);
+            handle_toggle_up(context, operation->gobj);
             break;
         case TOGGLE_DOWN:
-            handle_toggle_down(operation->gobj);
+            handle_toggle_down(context, operation->gobj);
             break;
         default:
             g_assert_not_reached();
     }
 
-out:
-    return FALSE;
-}
+    g_atomic_int_add(&pending_idle_toggles, -1);
 
-static void
-toggle_ref_notify_operation_free(ToggleRefNotifyOperation *operation)
-{
+out:
     if (operation->needs_unref)
         g_object_unref (operation->gobj);
     g_slice_free(ToggleRefNotifyOperation, operation);
-    g_atomic_int_add(&pending_idle_toggles, -1);
+}
+
+/* Takes everything queued so far, returning it oldest first */
+static ToggleRefNotifyOperation *
+take_toggle_queue(void)
+{
+    ToggleRefNotifyOperation *head, *reversed, *next;
+
+    do {
+        head = (ToggleRefNotifyOperation *) g_atomic_pointer_get(&toggle_queue);
+    } while (!g_atomic_pointer_compare_and_exchange(&toggle_queue, head, NULL));
+
+    reversed = NULL;
+    while (head != NULL) {
+        next = head->next;
+        head->next = reversed;
+        reversed = head;
+        head = next;
+    }
+
+    return reversed;
+}
+
+static gboolean
+idle_handle_toggles(gpointer data)
+{
+    /* FIXME: thread the context through somehow. Maybe by looking up
+     * the compartment that obj belongs to. */
+    JSContext *context = (JSContext*) gjs_context_get_native_context(gjs_context_get_current());
+    guint i;
+
+    if (toggle_batch == NULL)
+        toggle_batch = take_toggle_queue();
+
+    for (i = 0; i < TOGGLE_BATCH_SIZE && toggle_batch != NULL; i++) {
+        ToggleRefNotifyOperation *operation = toggle_batch;
+
+        toggle_batch = operation->next;
+        handle_toggle_operation(context, operation);
+    }
+
+    if (toggle_batch != NULL ||
+        g_atomic_pointer_get(&toggle_queue) != NULL)
+        return TRUE;
+
+    /* A toggle queued between the check above and clearing the flag
+     * will not have scheduled another idle, so look again. */
+    g_atomic_int_set(&toggle_idle_scheduled, FALSE);
+    if (g_atomic_pointer_get(&toggle_queue) != NULL &&
+        g_atomic_int_compare_and_exchange(&toggle_idle_scheduled, FALSE, TRUE))
+        return TRUE;
+
+    return FALSE;
 }
 
 static void
@@ -942,8 +1607,8 @@ queue_toggle_idle(GObject         *gobj,
                   ToggleDirection  direction)
 {
     ToggleRefNotifyOperation *operation;
+    ToggleRefNotifyOperation *head;
     GQuark qdata_key;
-    GSource *source;
 
     operation = g_slice_new0(ToggleRefNotifyOperation);
     operation->direction = direction;
@@ -975,19 +1640,23 @@ queue_toggle_idle(GObject         *gobj,
 
     qdata_key = get_qdata_key_for_toggle_direction(direction);
 
-    source = g_idle_source_new();
-    g_source_set_priority(source, G_PRIORITY_HIGH);
-    g_source_set_callback(source,
-                          idle_handle_toggle,
-                          operation,
-                          (GDestroyNotify) toggle_ref_notify_operation_free);
-
     g_atomic_int_inc(&pending_idle_toggles);
-    g_object_set_qdata (gobj, qdata_key, source);
-    g_source_attach (source, NULL);
+    g_object_set_qdata (gobj, qdata_key, operation);
+
+    do {
+        head = (ToggleRefNotifyOperation *) g_atomic_pointer_get(&toggle_queue);
+        operation->next = head;
+    } while (!g_atomic_pointer_compare_and_exchange(&toggle_queue, head, operation));
 
-    /* object qdata is piggy-backing off the main loop's ref of the source */
-    g_source_unref (source);
+    /* Only the first toggle since the idle last ran needs to add it */
+    if (g_atomic_int_compare_and_exchange(&toggle_idle_scheduled, FALSE, TRUE))
+        g_idle_add_full(G_PRIORITY_HIGH, idle_handle_toggles, NULL, NULL);
+}
+
+guint
+gjs_object_get_n_pending_toggles(void)
+{
+    return g_atomic_int_get(&pending_idle_toggles);
 }
 
 static void
@@ -1048,8 +1717,8 @@ wrapped_gobj_toggle_notify(gpointer      data,
         is_sweeping = FALSE;
     }
 
-    toggle_up_queued = toggle_idle_source_is_queued(gobj, TOGGLE_UP);
-    toggle_down_queued = toggle_idle_source_is_queued(gobj, TOGGLE_DOWN);
+    toggle_up_queued = toggle_idle_is_queued(gobj, TOGGLE_UP);
+    toggle_down_queued = toggle_idle_is_queued(gobj, TOGGLE_DOWN);
 
     if (is_last_ref) {
         /* We've transitions from 2 -> 1 references,
@@ -1064,7 +1733,7 @@ wrapped_gobj_toggle_notify(gpointer      data,
                         toggle_up_queued? "up" : "down");
             }
 
-            handle_toggle_down(gobj);
+            handle_toggle_down(js_context, gobj);
         } else {
             queue_toggle_idle(gobj, TOGGLE_DOWN);
         }
@@ -1082,15 +1751,15 @@ wrapped_gobj_toggle_notify(gpointer      data,
             if (is_sweeping) {
                 JSObject *object;
 
-                object = peek_js_obj(gobj);
+                object = peek_js_obj(JS_GetRuntime(js_context), gobj);
                 if (JS_IsAboutToBeFinalized(&object)) {
                     /* Ouch, the JS object is dead already. Disassociate the GObject
                      * and hope the GObject dies too.
                      */
-                    disassociate_js_gobject(gobj);
+                    disassociate_js_gobject(JS_GetRuntime(js_context), gobj);
                 }
             } else {
-                handle_toggle_up(gobj);
+                handle_toggle_up(js_context, gobj);
             }
         } else {
             queue_toggle_idle(gobj, TOGGLE_UP);
@@ -1099,10 +1768,17 @@ wrapped_gobj_toggle_notify(gpointer      data,
 }
 
 static void
-release_native_object (ObjectInstance *priv)
-{
-    set_js_obj(priv->gobj, NULL);
-    g_object_remove_toggle_ref(priv->gobj, wrapped_gobj_toggle_notify, NULL);
+release_native_object (JSRuntime      *runtime,
+                       ObjectInstance *priv)
+{
+    set_js_obj(runtime, priv->gobj, NULL);
+    if (priv->is_handle) {
+        priv->is_handle = FALSE;
+        n_handle_wrappers--;
+        g_object_unref(priv->gobj);
+    } else {
+        g_object_remove_toggle_ref(priv->gobj, wrapped_gobj_toggle_notify, NULL);
+    }
     priv->gobj = NULL;
 }
 
@@ -1137,7 +1813,7 @@ gjs_object_prepare_shutdown (JSContext *context)
                                         &child, &data)) {
         ObjectInstance *priv = (ObjectInstance*)data;
 
-        release_native_object(priv);
+        release_native_object(JS_GetRuntime(context), priv);
     }
 }
 
@@ -1172,6 +1848,31 @@ init_object_private (JSContext *context,
     return priv;
 }
 
+static void
+add_toggle_ref (JSContext      *context,
+                JSObject       *object,
+                ObjectInstance *priv)
+{
+    /* OK, here is where things get complicated. We want the
+     * wrapped gobj to keep the JSObject* wrapper alive, because
+     * people might set properties on the JSObject* that they care
+     * about. Therefore, whenever the refcount on the wrapped gobj
+     * is >1, i.e. whenever something other than the wrapper is
+     * referencing the wrapped gobj, the wrapped gobj has a strong
+     * ref (gc-roots the wrapper). When the refcount on the
+     * wrapped gobj is 1, then we change to a weak ref to allow
+     * the wrapper to be garbage collected (and thus unref the
+     * wrappee).
+     */
+    set_keep_alive(priv, gjs_keep_alive_get_global(context));
+    gjs_keep_alive_add_child(priv->keep_alive,
+                             gobj_no_longer_kept_alive_func,
+                             object,
+                             priv);
+
+    g_object_add_toggle_ref(priv->gobj, wrapped_gobj_toggle_notify, NULL);
+}
+
 static void
 associate_js_gobject (JSContext      *context,
                       JSObject       *object,
@@ -1181,41 +1882,101 @@ associate_js_gobject (JSContext      *context,
 
     priv = priv_from_js(context, object);
     priv->gobj = gobj;
+    track_wrapper(priv);
+
+    g_assert(peek_js_obj(JS_GetRuntime(context), gobj) == NULL);
+    set_js_obj(JS_GetRuntime(context), gobj, object);
+
+#if DEBUG_DISPOSE
+    g_object_weak_ref(gobj, wrapped_gobj_dispose_notify, object);
+#endif
+
+    add_toggle_ref(context, object, priv);
+}
+
+/* Associates @gobj with a wrapper that holds an ordinary reference on
+ * it and is not kept alive: when JS drops the wrapper it is collected,
+ * even if @gobj lives on. That is only safe as long as the wrapper has
+ * no state of its own, so it is promoted to a regular wrapper as soon
+ * as it gets some. Takes over the caller's reference on @gobj. */
+static void
+associate_js_gobject_handle (JSContext      *context,
+                             JSObject       *object,
+                             GObject        *gobj)
+{
+    ObjectInstance *priv;
+
+    priv = priv_from_js(context, object);
+    priv->gobj = gobj;
+    priv->is_handle = TRUE;
+    n_handle_wrappers++;
+    track_wrapper(priv);
+
+    g_assert(peek_js_obj(JS_GetRuntime(context), gobj) == NULL);
+    set_js_obj(JS_GetRuntime(context), gobj, object);
+
+#if DEBUG_DISPOSE
+    g_object_weak_ref(gobj, wrapped_gobj_dispose_notify, object);
+#endif
+}
+
+/* Turns a handle wrapper into a regular one, before JS state such as an
+ * expando property or a signal connection is attached to it */
+static void
+promote_handle_wrapper (JSContext      *context,
+                        JSObject       *object,
+                        ObjectInstance *priv)
+{
+    if (!priv->is_handle)
+        return;
+
+    gjs_debug_lifecycle(GJS_DEBUG_GOBJECT,
+                        "Promoting handle wrapper %p for gobj %p", object, priv->gobj);
+
+    priv->is_handle = FALSE;
+    n_handle_wrappers--;
+    add_toggle_ref(context, object, priv);
+
+    /* Same as when creating a regular wrapper: we now have both a ref
+     * and a toggle ref, and only want the toggle ref. */
+    g_object_unref(priv->gobj);
+}
+
+void
+gjs_object_set_constructor_shapes_enabled(gboolean enabled)
+{
+    constructor_shapes_enabled = enabled;
+}
 
-    g_assert(peek_js_obj(gobj) == NULL);
-    set_js_obj(gobj, object);
+void
+gjs_set_handle_wrappers(gboolean enabled)
+{
+    handle_wrappers = enabled ? 1 : 0;
+}
 
-#if DEBUG_DISPOSE
-    g_object_weak_ref(gobj, wrapped_gobj_dispose_notify, object);
-#endif
+gboolean
+gjs_get_handle_wrappers(void)
+{
+    if (G_UNLIKELY(handle_wrappers < 0))
+        handle_wrappers = gjs_environment_variable_is_set("GJS_HANDLE_WRAPPERS") ? 1 : 0;
 
-    /* OK, here is where things get complicated. We want the
-     * wrapped gobj to keep the JSObject* wrapper alive, because
-     * people might set properties on the JSObject* that they care
-     * about. Therefore, whenever the refcount on the wrapped gobj
-     * is >1, i.e. whenever something other than the wrapper is
-     * referencing the wrapped gobj, the wrapped gobj has a strong
-     * ref (gc-roots the wrapper). When the refcount on the
-     * wrapped gobj is 1, then we change to a weak ref to allow
-     * the wrapper to be garbage collected (and thus unref the
-     * wrappee).
-     */
-    priv->keep_alive = gjs_keep_alive_get_global(context);
-    gjs_keep_alive_add_child(priv->keep_alive,
-                             gobj_no_longer_kept_alive_func,
-                             object,
-                             priv);
+    return handle_wrappers;
+}
 
-    g_object_add_toggle_ref(gobj, wrapped_gobj_toggle_notify, NULL);
+guint
+gjs_object_get_n_handle_wrappers(void)
+{
+    return n_handle_wrappers;
 }
 
 static void
-disassociate_js_gobject (GObject   *gobj)
+disassociate_js_gobject (JSRuntime *runtime,
+                         GObject   *gobj)
 {
     JSObject *object;
     ObjectInstance *priv;
 
-    object = peek_js_obj(gobj);
+    object = peek_js_obj(runtime, gobj);
     priv = (ObjectInstance*) JS_GetPrivate(object);
     /* Idles are already checked in the only caller of this
        function, the toggle ref notify, but let's check again...
@@ -1224,10 +1985,10 @@ disassociate_js_gobject (GObject   *gobj)
     g_assert(!cancel_toggle_idle(gobj, TOGGLE_DOWN));
 
     invalidate_all_signals(priv);
-    release_native_object(priv);
+    release_native_object(runtime, priv);
 
     /* Use -1 to mark that a JS object once existed, but it doesn't any more */
-    set_js_obj(gobj, (JSObject*)(-1));
+    set_js_obj(runtime, gobj, (JSObject*)(-1));
 
 #if DEBUG_DISPOSE
     g_object_weak_unref(gobj, wrapped_gobj_dispose_notify, object);
@@ -1242,8 +2003,9 @@ object_instance_init (JSContext *context,
 {
     ObjectInstance *priv;
     GType gtype;
-    GParameter *params;
-    int n_params;
+    const char **names;
+    GValue *values;
+    guint n_values;
     GTypeQuery query;
     JSObject *old_jsobj;
     GObject *gobj;
@@ -1253,9 +2015,9 @@ object_instance_init (JSContext *context,
     gtype = priv->gtype;
     g_assert(gtype != G_TYPE_NONE);
 
-    if (!object_instance_props_to_g_parameters(context, *object, argc, argv,
-                                               gtype,
-                                               &params, &n_params)) {
+    if (!object_instance_props_to_g_values(context, *object, argc, argv,
+                                           gtype,
+                                           &names, &values, &n_values)) {
         return JS_FALSE;
     }
 
@@ -1266,11 +2028,12 @@ object_instance_init (JSContext *context,
     if (g_type_get_qdata(gtype, gjs_is_custom_type_quark()))
         object_init_list = g_slist_prepend(object_init_list, *object);
 
-    gobj = (GObject*) g_object_newv(gtype, n_params, params);
+    gobj = object_new_with_properties(gtype, n_values, names, values);
 
-    free_g_params(params, n_params);
+    g_free(names);
+    free_g_values(values, n_values);
 
-    old_jsobj = peek_js_obj(gobj);
+    old_jsobj = peek_js_obj(JS_GetRuntime(context), gobj);
     if (old_jsobj != NULL && old_jsobj != *object) {
         /* g_object_newv returned an object that's already tracked by a JS
          * object. Let's assume this is a singleton like IBus.IBus and return
@@ -1353,17 +2116,20 @@ GJS_NATIVE_CONSTRUCTOR_DECLARE(object_instance)
 static void
 invalidate_all_signals(ObjectInstance *priv)
 {
-    GList *iter, *next;
+    if (priv->signals == NULL)
+        return;
 
-    for (iter = priv->signals; iter; ) {
-        ConnectData *cd = (ConnectData*) iter->data;
-        next = iter->next;
+    /* Taking the last one, so that removing it doesn't need to move
+     * anything. Invalidating a closure may remove other connections
+     * as well, so the length is checked again every time. */
+    while (priv->signals->len > 0) {
+        ConnectData *cd;
 
-        /* This will also free cd and iter, through
+        cd = (ConnectData *) g_ptr_array_index(priv->signals, priv->signals->len - 1);
+
+        /* This will also free cd and remove it from the array, through
            the closure invalidation mechanism */
         g_closure_invalidate(cd->closure);
-
-        iter = next;
     }
 }
 
@@ -1372,12 +2138,15 @@ object_instance_trace(JSTracer *tracer,
                       JSObject *obj)
 {
     ObjectInstance *priv;
-    GList *iter;
+    guint i;
 
     priv = (ObjectInstance *) JS_GetPrivate(obj);
 
-    for (iter = priv->signals; iter; iter = iter->next) {
-        ConnectData *cd = (ConnectData *) iter->data;
+    if (priv->signals == NULL)
+        return;
+
+    for (i = 0; i < priv->signals->len; i++) {
+        ConnectData *cd = (ConnectData *) g_ptr_array_index(priv->signals, i);
 
         gjs_closure_trace(cd->closure, tracer);
     }
@@ -1423,7 +2192,7 @@ object_instance_finalize(JSFreeOp  *fop,
                     priv->info ? g_base_info_get_name((GIBaseInfo*) priv->info) : g_type_name(priv->gtype));
         }
         
-        release_native_object(priv);
+        release_native_object(fop->runtime(), priv);
     }
 
     if (priv->keep_alive != NULL) {
@@ -1453,6 +2222,16 @@ object_instance_finalize(JSFreeOp  *fop,
         priv->klass = NULL;
     }
 
+    if (priv->signals) {
+        g_ptr_array_free(priv->signals, TRUE);
+        priv->signals = NULL;
+    }
+
+    if (priv->type_stats) {
+        set_keep_alive(priv, NULL);
+        priv->type_stats->live--;
+    }
+
     GJS_DEC_COUNTER(object);
     g_slice_free(ObjectInstance, priv);
 }
@@ -1525,12 +2304,63 @@ signal_connection_invalidated (gpointer  user_data,
                                GClosure *closure)
 {
     ConnectData *connect_data = (ConnectData *) user_data;
+    GPtrArray *signals = connect_data->obj->signals;
+    ConnectData *last;
+
+    /* Move the last connection into the freed slot */
+    last = (ConnectData *) g_ptr_array_index(signals, signals->len - 1);
+    g_ptr_array_remove_index_fast(signals, connect_data->index);
+    last->index = connect_data->index;
 
-    connect_data->obj->signals = g_list_delete_link(connect_data->obj->signals,
-                                                    connect_data->link);
     g_slice_free(ConnectData, connect_data);
 }
 
+/* Resolves a "signal::detail" name for connect() and emit(), throwing
+ * if there is no such signal. The detail quark is always created, so
+ * both can share the result. */
+static const SignalCacheEntry *
+lookup_signal(JSContext *context,
+              GType      gtype,
+              jsval      name)
+{
+    JSIdCache *cache;
+    SignalCacheEntry *entry;
+    jsid id;
+    char *signal_name;
+    guint signal_id;
+    GQuark signal_detail;
+    const GjsSignalQuery *query;
+
+    if (!JS_ValueToId(context, name, &id))
+        return NULL;
+
+    cache = get_jsid_cache(context, gtype, gjs_signal_cache_quark(),
+                           signal_cache_entry_free);
+    entry = (SignalCacheEntry *) g_hash_table_lookup(cache->entries,
+                                                     (gpointer) JSID_BITS(id));
+    if (entry != NULL)
+        return entry;
+
+    if (!gjs_string_to_utf8(context, name, &signal_name))
+        return NULL;
+
+    if (!g_signal_parse_name(signal_name, gtype,
+                             &signal_id, &signal_detail, TRUE) ||
+        (query = gjs_signal_query_lookup(signal_id)) == NULL) {
+        gjs_throw(context, "No signal '%s' on object '%s'",
+                  signal_name, g_type_name(gtype));
+        g_free(signal_name);
+        return NULL;
+    }
+    g_free(signal_name);
+
+    entry = g_slice_new(SignalCacheEntry);
+    entry->query = query;
+    entry->detail = signal_detail;
+    g_hash_table_insert(cache->entries, (gpointer) JSID_BITS(id), entry);
+    return entry;
+}
+
 static JSBool
 real_connect_func(JSContext *context,
                   unsigned   argc,
@@ -1542,12 +2372,9 @@ real_connect_func(JSContext *context,
     ObjectInstance *priv;
     GClosure *closure;
     gulong id;
-    guint signal_id;
-    char *signal_name;
-    GQuark signal_detail;
+    const SignalCacheEntry *signal;
     jsval retval;
     ConnectData *connect_data;
-    JSBool ret = JS_FALSE;
 
     if (!do_base_typecheck(context, obj, JS_TRUE))
         return JS_FALSE;
@@ -1579,50 +2406,43 @@ real_connect_func(JSContext *context,
         return JS_FALSE;
     }
 
-    if (!gjs_string_to_utf8(context, argv[0], &signal_name)) {
+    signal = lookup_signal(context, G_OBJECT_TYPE(priv->gobj), argv[0]);
+    if (signal == NULL)
         return JS_FALSE;
-    }
 
-    if (!g_signal_parse_name(signal_name,
-                             G_OBJECT_TYPE(priv->gobj),
-                             &signal_id,
-                             &signal_detail,
-                             TRUE)) {
-        gjs_throw(context, "No signal '%s' on object '%s'",
-                     signal_name,
-                     g_type_name(G_OBJECT_TYPE(priv->gobj)));
-        goto out;
-    }
+    /* The connection is traced through the wrapper */
+    promote_handle_wrapper(context, obj, priv);
 
-    closure = gjs_closure_new_for_signal(context, JSVAL_TO_OBJECT(argv[1]), "signal callback", signal_id);
+    closure = gjs_closure_new_for_signal(context, JSVAL_TO_OBJECT(argv[1]), "signal callback",
+                                         signal->query->signal_id);
     if (closure == NULL)
-        goto out;
+        return JS_FALSE;
+
+    if (priv->signals == NULL)
+        priv->signals = g_ptr_array_new();
 
     connect_data = g_slice_new(ConnectData);
-    priv->signals = g_list_prepend(priv->signals, connect_data);
     connect_data->obj = priv;
-    connect_data->link = priv->signals;
+    connect_data->index = priv->signals->len;
+    g_ptr_array_add(priv->signals, connect_data);
     /* This is a weak reference, and will be cleared when the closure is invalidated */
     connect_data->closure = closure;
     g_closure_add_invalidate_notifier(closure, connect_data, signal_connection_invalidated);
 
     id = g_signal_connect_closure_by_id(priv->gobj,
-                                        signal_id,
-                                        signal_detail,
+                                        signal->query->signal_id,
+                                        signal->detail,
                                         closure,
                                         after);
 
     if (!JS_NewNumberValue(context, id, &retval)) {
         g_signal_handler_disconnect(priv->gobj, id);
-        goto out;
+        return JS_FALSE;
     }
     
     JS_SET_RVAL(context, vp, retval);
 
-    ret = JS_TRUE;
- out:
-    g_free(signal_name);
-    return ret;
+    return JS_TRUE;
 }
 
 static JSBool
@@ -1649,16 +2469,13 @@ emit_func(JSContext *context,
     jsval *argv = JS_ARGV(context, vp);
     JSObject *obj = JS_THIS_OBJECT(context, vp);
     ObjectInstance *priv;
-    guint signal_id;
-    GQuark signal_detail;
-    GSignalQuery signal_query;
-    char *signal_name;
+    const SignalCacheEntry *signal;
+    const GjsSignalQuery *signal_query;
     GValue *instance_and_args;
     GValue rvalue = G_VALUE_INIT;
     unsigned int i;
     gboolean failed;
     jsval retval;
-    JSBool ret = JS_FALSE;
 
     if (!do_base_typecheck(context, obj, JS_TRUE))
         return JS_FALSE;
@@ -1685,48 +2502,42 @@ emit_func(JSContext *context,
         return JS_FALSE;
     }
 
-    if (!gjs_string_to_utf8(context, argv[0], &signal_name))
+    signal = lookup_signal(context, G_OBJECT_TYPE(priv->gobj), argv[0]);
+    if (signal == NULL)
+        return JS_FALSE;
+    signal_query = signal->query;
+
+    if ((argc - 1) != signal_query->n_params) {
+        char *signal_name;
+
+        if (gjs_string_to_utf8(context, argv[0], &signal_name)) {
+            gjs_throw(context, "Signal '%s' on %s requires %d args got %d",
+                      signal_name,
+                      g_type_name(G_OBJECT_TYPE(priv->gobj)),
+                      signal_query->n_params,
+                      argc - 1);
+            g_free(signal_name);
+        }
         return JS_FALSE;
-
-    if (!g_signal_parse_name(signal_name,
-                             G_OBJECT_TYPE(priv->gobj),
-                             &signal_id,
-                             &signal_detail,
-                             FALSE)) {
-        gjs_throw(context, "No signal '%s' on object '%s'",
-                     signal_name,
-                     g_type_name(G_OBJECT_TYPE(priv->gobj)));
-        goto out;
-    }
-
-    g_signal_query(signal_id, &signal_query);
-
-    if ((argc - 1) != signal_query.n_params) {
-        gjs_throw(context, "Signal '%s' on %s requires %d args got %d",
-                     signal_name,
-                     g_type_name(G_OBJECT_TYPE(priv->gobj)),
-                     signal_query.n_params,
-                     argc - 1);
-        goto out;
     }
 
-    if (signal_query.return_type != G_TYPE_NONE) {
-        g_value_init(&rvalue, signal_query.return_type & ~G_SIGNAL_TYPE_STATIC_SCOPE);
+    if (signal_query->return_type != G_TYPE_NONE) {
+        g_value_init(&rvalue, signal_query->return_type);
     }
 
-    instance_and_args = g_newa(GValue, signal_query.n_params + 1);
-    memset(instance_and_args, 0, sizeof(GValue) * (signal_query.n_params + 1));
+    instance_and_args = g_newa(GValue, signal_query->n_params + 1);
+    memset(instance_and_args, 0, sizeof(GValue) * (signal_query->n_params + 1));
 
     g_value_init(&instance_and_args[0], G_TYPE_FROM_INSTANCE(priv->gobj));
     g_value_set_instance(&instance_and_args[0], priv->gobj);
 
     failed = FALSE;
-    for (i = 0; i < signal_query.n_params; ++i) {
+    for (i = 0; i < signal_query->n_params; ++i) {
         GValue *value;
         value = &instance_and_args[i + 1];
 
-        g_value_init(value, signal_query.param_types[i] & ~G_SIGNAL_TYPE_STATIC_SCOPE);
-        if ((signal_query.param_types[i] & G_SIGNAL_TYPE_STATIC_SCOPE) != 0)
+        g_value_init(value, signal_query->param_types[i]);
+        if (i < 32 && (signal_query->static_scope_mask & (1u << i)) != 0)
             failed = !gjs_value_to_g_value_no_copy(context, argv[i+1], value);
         else
             failed = !gjs_value_to_g_value(context, argv[i+1], value);
@@ -1736,11 +2547,11 @@ emit_func(JSContext *context,
     }
 
     if (!failed) {
-        g_signal_emitv(instance_and_args, signal_id, signal_detail,
-                       &rvalue);
+        g_signal_emitv(instance_and_args, signal_query->signal_id,
+                       signal->detail, &rvalue);
     }
 
-    if (signal_query.return_type != G_TYPE_NONE) {
+    if (signal_query->return_type != G_TYPE_NONE) {
         if (!gjs_value_from_g_value(context,
                                     &retval,
                                     &rvalue))
@@ -1751,17 +2562,14 @@ emit_func(JSContext *context,
         retval = JSVAL_VOID;
     }
 
-    for (i = 0; i < (signal_query.n_params + 1); ++i) {
+    for (i = 0; i < (signal_query->n_params + 1); ++i) {
         g_value_unset(&instance_and_args[i]);
     }
 
     if (!failed)
         JS_SET_RVAL(context, vp, retval);
 
-    ret = !failed;
- out:
-    g_free(signal_name);
-    return ret;
+    return !failed;
 }
 
 static JSBool
@@ -1794,11 +2602,78 @@ to_string_func(JSContext *context,
     return ret;
 }
 
+/* obj.set({ prop: value, ... }): sets several properties with one
+ * round of notifications, emitted once all of them have been set */
+static JSBool
+set_func(JSContext *context,
+         unsigned   argc,
+         jsval     *vp)
+{
+    jsval *argv = JS_ARGV(context, vp);
+    JSObject *obj = JS_THIS_OBJECT(context, vp);
+    ObjectInstance *priv;
+    JSObject *props;
+    JSObject *iter;
+    jsid prop_id;
+    JSBool ret = JS_FALSE;
+
+    if (!do_base_typecheck(context, obj, JS_TRUE))
+        return JS_FALSE;
+
+    priv = priv_from_js(context, obj);
+    if (priv == NULL) {
+        throw_priv_is_null_error(context);
+        return JS_FALSE; /* wrong class passed in */
+    }
+    if (priv->gobj == NULL) {
+        /* prototype, not an instance. */
+        gjs_throw(context, "Can't set properties on %s.%s.prototype; only on instances",
+                  priv->info ? g_base_info_get_namespace( (GIBaseInfo*) priv->info) : "",
+                  priv->info ? g_base_info_get_name( (GIBaseInfo*) priv->info) : g_type_name(priv->gtype));
+        return JS_FALSE;
+    }
+
+    if (!gjs_parse_args(context, "set", "o", argc, argv,
+                        "properties", &props))
+        return JS_FALSE;
+
+    iter = JS_NewPropertyIterator(context, props);
+    if (iter == NULL)
+        return JS_FALSE;
+
+    g_object_freeze_notify(priv->gobj);
+
+    prop_id = JSID_VOID;
+    if (!JS_NextProperty(context, iter, &prop_id))
+        goto out;
+
+    while (!JSID_IS_VOID(prop_id)) {
+        jsval value;
+
+        /* Goes through object_instance_set_prop() like a plain
+         * assignment would, so JS overrides are honored too */
+        if (!JS_GetPropertyById(context, props, prop_id, &value) ||
+            !JS_SetPropertyById(context, obj, prop_id, &value))
+            goto out;
+
+        prop_id = JSID_VOID;
+        if (!JS_NextProperty(context, iter, &prop_id))
+            goto out;
+    }
+
+    JS_SET_RVAL(context, vp, JSVAL_VOID);
+    ret = JS_TRUE;
+
+ out:
+    g_object_thaw_notify(priv->gobj);
+    return ret;
+}
+
 struct JSClass gjs_object_instance_class = {
     "GObject_Object",
     JSCLASS_HAS_PRIVATE |
     JSCLASS_NEW_RESOLVE,
-    JS_PropertyStub,
+    object_instance_add_prop,
     JS_DeletePropertyStub,
     object_instance_get_prop,
     object_instance_set_prop,
@@ -1844,6 +2719,7 @@ JSFunctionSpec gjs_object_instance_proto_funcs[] = {
     { "connect_after", JSOP_WRAPPER((JSNative)connect_after_func), 0, 0 },
     { "emit", JSOP_WRAPPER((JSNative)emit_func), 0, 0 },
     { "toString", JSOP_WRAPPER((JSNative)to_string_func), 0, 0 },
+    { "set", JSOP_WRAPPER((JSNative)set_func), 1, 0 },
     { NULL }
 };
 
@@ -2003,26 +2879,296 @@ gjs_define_object_class(JSContext      *context,
         *constructor_p = constructor;
 }
 
+/* GObject -> JS wrapper, for every GObject that currently has one.
+ * This is looked up for every GObject coming out of a C call, and a
+ * GHashTable lookup does not take the global lock that qdata does.
+ * There is one table per runtime, see gjs_runtime_get_wrapper_table().
+ *
+ * Associated GObjects hold a toggle ref until release_native_object()
+ * removes them from here, so an address can't be reused while it's in
+ * the table.
+ */
+static GHashTable *
+get_wrapper_table(JSRuntime *runtime)
+{
+    GHashTable *table;
+
+    table = gjs_runtime_get_wrapper_table(runtime, GJS_WRAPPER_TABLE_OBJECT);
+    if (G_UNLIKELY (table == NULL)) {
+        table = g_hash_table_new(NULL, NULL);
+        gjs_runtime_set_wrapper_table(runtime, GJS_WRAPPER_TABLE_OBJECT, table);
+    }
+
+    return table;
+}
+
+/* GObjects whose wrapper was finalized while they stayed alive, see
+ * disassociate_js_gobject(). A weak ref takes them out again when they
+ * are disposed, possibly from another thread, hence the lock. This is
+ * rare, so it is only looked at while it is not empty.
+ */
+static GHashTable *disassociated_objects;
+static GMutex disassociated_lock;
+static volatile gint n_disassociated;
+
+static void
+forget_disassociated_object(gpointer  data,
+                            GObject  *where_the_object_was)
+{
+    g_mutex_lock(&disassociated_lock);
+    if (g_hash_table_remove(disassociated_objects, where_the_object_was))
+        g_atomic_int_add(&n_disassociated, -1);
+    g_mutex_unlock(&disassociated_lock);
+}
+
+static gboolean
+is_disassociated(GObject *gobj)
+{
+    gboolean ret;
+
+    if (G_LIKELY (g_atomic_int_get(&n_disassociated) == 0))
+        return FALSE;
+
+    g_mutex_lock(&disassociated_lock);
+    ret = g_hash_table_contains(disassociated_objects, gobj);
+    g_mutex_unlock(&disassociated_lock);
+
+    return ret;
+}
+
+static void
+mark_disassociated(GObject  *gobj,
+                   gboolean  disassociated)
+{
+    gboolean changed;
+
+    if (!disassociated && G_LIKELY (g_atomic_int_get(&n_disassociated) == 0))
+        return;
+
+    g_mutex_lock(&disassociated_lock);
+    if (disassociated_objects == NULL)
+        disassociated_objects = g_hash_table_new(NULL, NULL);
+    changed = g_hash_table_contains(disassociated_objects, gobj) != disassociated;
+    if (changed && disassociated)
+        g_hash_table_add(disassociated_objects, gobj);
+    else if (changed)
+        g_hash_table_remove(disassociated_objects, gobj);
+    if (changed)
+        g_atomic_int_add(&n_disassociated, disassociated ? 1 : -1);
+    g_mutex_unlock(&disassociated_lock);
+
+    if (!changed)
+        return;
+
+    if (disassociated)
+        g_object_weak_ref(gobj, forget_disassociated_object, NULL);
+    else
+        g_object_weak_unref(gobj, forget_disassociated_object, NULL);
+}
+
 static JSObject*
-peek_js_obj(GObject *gobj)
+peek_js_obj(JSRuntime *runtime,
+            GObject   *gobj)
 {
-    JSObject *object = (JSObject*) g_object_get_qdata(gobj, gjs_object_priv_quark());
+    JSObject *object;
 
-    if (G_UNLIKELY (object == (JSObject*)(-1))) {
+    object = (JSObject*) g_hash_table_lookup(get_wrapper_table(runtime), gobj);
+    if (object != NULL)
+        return object;
+
+    if (G_UNLIKELY (is_disassociated(gobj))) {
         g_critical ("Object %p (a %s) resurfaced after the JS wrapper was finalized. "
                     "This is some library doing dubious memory management inside dispose()",
-                    gobj, g_type_name(G_TYPE_FROM_INSTANCE(object)));
+                    gobj, g_type_name(G_TYPE_FROM_INSTANCE(gobj)));
         return NULL; /* return null to associate again with a new wrapper */
     }
 
-    return object;
+    return NULL;
 }
 
 static void
-set_js_obj(GObject  *gobj,
-           JSObject *obj)
+set_js_obj(JSRuntime *runtime,
+           GObject   *gobj,
+           JSObject  *obj)
+{
+    GHashTable *table = get_wrapper_table(runtime);
+
+    if (obj == NULL) {
+        g_hash_table_remove(table, gobj);
+    } else if (obj == (JSObject*)(-1)) {
+        g_hash_table_remove(table, gobj);
+        mark_disassociated(gobj, TRUE);
+    } else {
+        /* Clear the mark if this object was wrapped before */
+        mark_disassociated(gobj, FALSE);
+        g_hash_table_insert(table, gobj, obj);
+    }
+}
+
+guint
+gjs_object_get_n_wrappers(JSContext *context)
+{
+    return g_hash_table_size(get_wrapper_table(JS_GetRuntime(context)));
+}
+
+static gint
+compare_type_stats_by_live(gconstpointer a,
+                           gconstpointer b)
+{
+    const ObjectTypeStats *stats_a = *(const ObjectTypeStats **) a;
+    const ObjectTypeStats *stats_b = *(const ObjectTypeStats **) b;
+
+    if (stats_a->live != stats_b->live)
+        return stats_a->live < stats_b->live ? 1 : -1;
+    if (stats_a->created != stats_b->created)
+        return stats_a->created < stats_b->created ? 1 : -1;
+    return 0;
+}
+
+/* Returns the ObjectTypeStats of every type that ever had a wrapper,
+ * most live wrappers first */
+static GPtrArray *
+get_sorted_type_stats(void)
+{
+    GPtrArray *sorted;
+    GHashTableIter iter;
+    gpointer value;
+
+    sorted = g_ptr_array_new();
+    if (type_stats_table != NULL) {
+        g_hash_table_iter_init(&iter, type_stats_table);
+        while (g_hash_table_iter_next(&iter, NULL, &value))
+            g_ptr_array_add(sorted, value);
+    }
+    g_ptr_array_sort(sorted, compare_type_stats_by_live);
+
+    return sorted;
+}
+
+static JSBool
+define_count_property(JSContext  *context,
+                      JSObject   *obj,
+                      const char *name,
+                      double      count)
+{
+    jsval value;
+
+    if (!JS_NewNumberValue(context, count, &value))
+        return JS_FALSE;
+
+    return JS_DefineProperty(context, obj, name, value,
+                             NULL, NULL, JSPROP_ENUMERATE);
+}
+
+/**
+ * gjs_object_get_type_stats:
+ * @context: the JS context
+ * @value_p: return location for the result
+ *
+ * Returns an array with an entry for every GType that ever had a JS
+ * wrapper, sorted by the number of live wrappers. Each entry has the
+ * type "name", the number of "live" wrappers, how many of those are
+ * "rooted" (toggled up, so kept alive by the GObject), the number of
+ * wrappers "created" in total, and the "instanceSize" of the type.
+ */
+JSBool
+gjs_object_get_type_stats(JSContext *context,
+                          jsval     *value_p)
+{
+    GPtrArray *sorted;
+    JSObject *array;
+    JSBool ret = JS_FALSE;
+    guint i;
+
+    sorted = get_sorted_type_stats();
+
+    array = JS_NewArrayObject(context, 0, NULL);
+    if (array == NULL)
+        goto out;
+    *value_p = OBJECT_TO_JSVAL(array);
+
+    for (i = 0; i < sorted->len; i++) {
+        ObjectTypeStats *stats = (ObjectTypeStats *) g_ptr_array_index(sorted, i);
+        GTypeQuery query;
+        JSObject *entry;
+        jsval name;
+
+        g_type_query(stats->gtype, &query);
+
+        entry = JS_NewObject(context, NULL, NULL, NULL);
+        if (entry == NULL ||
+            !JS_DefineElement(context, array, i, OBJECT_TO_JSVAL(entry),
+                              NULL, NULL, JSPROP_ENUMERATE))
+            goto out;
+
+        if (!gjs_string_from_utf8(context, g_type_name(stats->gtype), -1, &name) ||
+            !JS_DefineProperty(context, entry, "name", name,
+                               NULL, NULL, JSPROP_ENUMERATE) ||
+            !define_count_property(context, entry, "live", stats->live) ||
+            !define_count_property(context, entry, "rooted", stats->rooted) ||
+            !define_count_property(context, entry, "created", stats->created) ||
+            !define_count_property(context, entry, "instanceSize", query.instance_size))
+            goto out;
+    }
+
+    ret = JS_TRUE;
+
+ out:
+    g_ptr_array_free(sorted, TRUE);
+    return ret;
+}
+
+/**
+ * gjs_object_dump_type_stats:
+ * @filename: file to write to, or "-" for stderr
+ *
+ * Writes the per-GType wrapper counters described in
+ * gjs_object_get_type_stats() to @filename, one type per line. The
+ * native size column is live wrappers times the instance size, which
+ * ignores memory owned by the instances.
+ *
+ * Returns: %FALSE if @filename could not be written
+ */
+gboolean
+gjs_object_dump_type_stats(const char *filename)
 {
-    g_object_set_qdata(gobj, gjs_object_priv_quark(), obj);
+    GPtrArray *sorted;
+    FILE *fp;
+    guint i;
+
+    if (strcmp(filename, "-") == 0) {
+        fp = stderr;
+    } else {
+        fp = fopen(filename, "w");
+        if (fp == NULL) {
+            g_warning("Could not write wrapper stats to %s: %s",
+                      filename, g_strerror(errno));
+            return FALSE;
+        }
+    }
+
+    sorted = get_sorted_type_stats();
+
+    fprintf(fp, "%-40s %10s %10s %12s %12s\n",
+            "type", "live", "rooted", "created", "native");
+    for (i = 0; i < sorted->len; i++) {
+        ObjectTypeStats *stats = (ObjectTypeStats *) g_ptr_array_index(sorted, i);
+        GTypeQuery query;
+
+        g_type_query(stats->gtype, &query);
+        fprintf(fp, "%-40s %10u %10u %12" G_GUINT64_FORMAT " %12" G_GUINT64_FORMAT "\n",
+                g_type_name(stats->gtype), stats->live, stats->rooted, stats->created,
+                (guint64) stats->live * query.instance_size);
+    }
+
+    g_ptr_array_free(sorted, TRUE);
+
+    if (fp != stderr)
+        fclose(fp);
+    else
+        fflush(fp);
+
+    return TRUE;
 }
 
 JSObject*
@@ -2035,7 +3181,7 @@ gjs_object_from_g_object(JSContext    *context,
     if (gobj == NULL)
         return NULL;
 
-    obj = peek_js_obj(gobj);
+    obj = peek_js_obj(JS_GetRuntime(context), gobj);
 
     if (obj == NULL) {
         /* We have to create a wrapper */
@@ -2065,12 +3211,19 @@ gjs_object_from_g_object(JSContext    *context,
         init_object_private(context, obj);
 
         g_object_ref_sink(gobj);
-        associate_js_gobject(context, obj, gobj);
 
-        /* see the comment in init_object_instance() for this */
-        g_object_unref(gobj);
+        /* Objects of JS-defined types always have JS state */
+        if (gjs_get_handle_wrappers() &&
+            !g_type_get_qdata(gtype, gjs_is_custom_type_quark())) {
+            associate_js_gobject_handle(context, obj, gobj);
+        } else {
+            associate_js_gobject(context, obj, gobj);
+
+            /* see the comment in init_object_instance() for this */
+            g_object_unref(gobj);
+        }
 
-        g_assert(peek_js_obj(gobj) == obj);
+        g_assert(peek_js_obj(JS_GetRuntime(context), gobj) == obj);
     }
 
  out:
@@ -2090,6 +3243,19 @@ gjs_g_object_from_object(JSContext    *context,
     return priv->gobj;
 }
 
+guint
+gjs_object_get_signal_connection_count(JSContext *context,
+                                       JSObject  *obj)
+{
+    ObjectInstance *priv;
+
+    priv = priv_from_js(context, obj);
+    if (priv == NULL || priv->signals == NULL)
+        return 0;
+
+    return priv->signals->len;
+}
+
 JSBool
 gjs_typecheck_is_object(JSContext     *context,
                         JSObject      *object,
@@ -2328,14 +3494,20 @@ gjs_hook_up_vfunc(JSContext *cx,
         offset = g_field_info_get_offset(field_info);
         method_ptr = G_STRUCT_MEMBER_P(implementor_vtable, offset);
 
-        trampoline = gjs_callback_trampoline_new(cx, OBJECT_TO_JSVAL(function), callback_info,
-                                                 GI_SCOPE_TYPE_NOTIFIED, TRUE);
-
-        *((ffi_closure **)method_ptr) = trampoline->closure;
+        trampoline = gjs_vfunc_trampoline_new(cx, OBJECT_TO_JSVAL(function), callback_info,
+                                              vfunc);
+        if (trampoline != NULL)
+            *((ffi_closure **)method_ptr) = trampoline->closure;
 
         g_base_info_unref(interface_info);
         g_base_info_unref(type_info);
         g_base_info_unref(field_info);
+
+        if (trampoline == NULL) {
+            g_base_info_unref(vfunc);
+            g_free(name);
+            return JS_FALSE;
+        }
     }
 
     g_base_info_unref(vfunc);
@@ -2370,7 +3542,7 @@ gjs_object_get_gproperty (GObject    *object,
     gjs_context = gjs_context_get_current();
     context = (JSContext*) gjs_context_get_native_context(gjs_context);
 
-    js_obj = peek_js_obj(object);
+    js_obj = peek_js_obj(JS_GetRuntime(context), object);
 
     underscore_name = hyphen_to_underscore((gchar *)pspec->name);
     JS_GetProperty(context, js_obj, underscore_name, &jsvalue);
@@ -2395,7 +3567,7 @@ gjs_object_set_gproperty (GObject      *object,
     gjs_context = gjs_context_get_current();
     context = (JSContext*) gjs_context_get_native_context(gjs_context);
 
-    js_obj = peek_js_obj(object);
+    js_obj = peek_js_obj(JS_GetRuntime(context), object);
 
     if (!gjs_value_from_g_value(context, &jsvalue, value))
         return;
@@ -39,6 +39,8 @@ JSObject* gjs_object_from_g_object      (JSContext     *context,
                                          GObject       *gobj);
 GObject*  gjs_g_object_from_object      (JSContext     *context,
                                          JSObject      *obj);
+guint     gjs_object_get_signal_connection_count (JSContext *context,
+                                                  JSObject  *obj);
 JSBool    gjs_typecheck_object          (JSContext     *context,
                                          JSObject      *obj,
                                          GType          expected_type,
@@ -49,6 +51,18 @@ JSBool    gjs_typecheck_is_object       (JSContext     *context,
 
 void      gjs_object_prepare_shutdown   (JSContext     *context);
 
+guint     gjs_object_get_n_pending_toggles (void);
+guint     gjs_object_get_n_wrappers     (JSContext     *context);
+guint     gjs_object_get_n_handle_wrappers (void);
+JSBool    gjs_object_get_type_stats     (JSContext     *context,
+                                         jsval         *value_p);
+gboolean  gjs_object_dump_type_stats    (const char    *filename);
+
+void      gjs_object_set_constructor_shapes_enabled (gboolean enabled);
+
+void      gjs_set_handle_wrappers       (gboolean       enabled);
+gboolean  gjs_get_handle_wrappers       (void);
+
 G_END_DECLS
 
 #endif  /* __GJS_OBJECT_H__ */
@@ -135,6 +135,8 @@ resolve_namespace_object(JSContext  *context,
                            GJS_MODULE_PROP_FLAGS))
         g_error("no memory to define ns property");
 
+    gjs_define_ns_warm_set(context, gi_namespace);
+
     override = lookup_override_function(context, ns_id);
     if (override && !JS_CallFunctionValue (context,
                                            gi_namespace, /* thisp */
@@ -48,6 +48,51 @@ static JSBool gjs_value_from_g_value_internal(JSContext    *context,
                                               GSignalQuery *signal_query,
                                               gint          arg_n);
 
+/* Indexed by signal id; signals are never unregistered, so neither are
+ * the entries */
+static GHashTable *signal_queries = NULL;
+
+const GjsSignalQuery *
+gjs_signal_query_lookup(guint signal_id)
+{
+    GjsSignalQuery *cached;
+    guint i;
+
+    if (G_UNLIKELY(signal_queries == NULL))
+        signal_queries = g_hash_table_new(NULL, NULL);
+
+    cached = (GjsSignalQuery *) g_hash_table_lookup(signal_queries,
+                                                    GUINT_TO_POINTER(signal_id));
+    if (cached != NULL)
+        return cached;
+
+    cached = g_new0(GjsSignalQuery, 1);
+    g_signal_query(signal_id, &cached->query);
+    if (cached->query.signal_id == 0) {
+        g_free(cached);
+        return NULL;
+    }
+
+    cached->signal_id = signal_id;
+    cached->signal_name = cached->query.signal_name;
+    cached->itype = cached->query.itype;
+    cached->n_params = cached->query.n_params;
+    cached->return_type = cached->query.return_type & ~G_SIGNAL_TYPE_STATIC_SCOPE;
+    cached->param_types = g_new(GType, cached->n_params);
+    for (i = 0; i < cached->n_params; i++) {
+        GType param_type = cached->query.param_types[i];
+
+        cached->param_types[i] = param_type & ~G_SIGNAL_TYPE_STATIC_SCOPE;
+        /* Copying is always safe, so parameters past the mask just
+         * don't get the no-copy treatment */
+        if (i < 32 && (param_type & G_SIGNAL_TYPE_STATIC_SCOPE) != 0)
+            cached->static_scope_mask |= 1u << i;
+    }
+
+    g_hash_table_insert(signal_queries, GUINT_TO_POINTER(signal_id), cached);
+    return cached;
+}
+
 static void
 closure_marshal(GClosure        *closure,
                 GValue          *return_value,
@@ -63,7 +108,10 @@ closure_marshal(GClosure        *closure,
     jsval *argv;
     jsval rval;
     int i;
-    GSignalQuery signal_query = { 0, };
+    gboolean saved_typed_array_scope;
+    const GjsSignalQuery *cached_query = NULL;
+    GSignalQuery no_signal_query = { 0, };
+    GSignalQuery *signal_query = &no_signal_query;
 
     gjs_debug_marshal(GJS_DEBUG_GCLOSURE,
                       "Marshal closure %p",
@@ -85,11 +133,12 @@ closure_marshal(GClosure        *closure,
                    "using the destroy() or dispose() vfuncs. Because it would crash the "
                    "application, it has been blocked and the JS callback not invoked.");
         if (hint) {
+            GSignalQuery hint_query;
             gpointer instance;
-            g_signal_query(hint->signal_id, &signal_query);
+            g_signal_query(hint->signal_id, &hint_query);
 
             instance = g_value_peek_pointer(&param_values[0]);
-            g_critical("The offending signal was %s on %s %p.", signal_query.signal_name,
+            g_critical("The offending signal was %s on %s %p.", hint_query.signal_name,
                        g_type_name(G_TYPE_FROM_INSTANCE(instance)), instance);
         }
         /* A gjs_dumpstack() would be nice here, but we can't,
@@ -104,6 +153,9 @@ closure_marshal(GClosure        *closure,
     global = JS_GetGlobalObject(context);
     JSAutoCompartment ac(context, global);
 
+    /* The handler is not part of a withTypedArrayResults() scope */
+    saved_typed_array_scope = gjs_set_typed_array_results_scope(FALSE);
+
     argc = n_param_values;
     rval = JSVAL_VOID;
     if (argc > 0) {
@@ -118,20 +170,12 @@ closure_marshal(GClosure        *closure,
     JS_AddValueRoot(context, &rval);
 
     if (marshal_data) {
-        /* we are used for a signal handler */
-        guint signal_id;
+        /* we are used for a signal handler, see
+         * gjs_closure_new_for_signal() */
+        cached_query = (const GjsSignalQuery *) marshal_data;
+        signal_query = (GSignalQuery *) &cached_query->query;
 
-        signal_id = GPOINTER_TO_UINT(marshal_data);
-
-        g_signal_query(signal_id, &signal_query);
-
-        if (!signal_query.signal_id) {
-            gjs_debug(GJS_DEBUG_GCLOSURE,
-                      "Signal handler being called on invalid signal");
-            goto cleanup;
-        }
-
-        if (signal_query.n_params + 1 != n_param_values) {
+        if (cached_query->n_params + 1 != n_param_values) {
             gjs_debug(GJS_DEBUG_GCLOSURE,
                       "Signal handler being called with wrong number of parameters");
             goto cleanup;
@@ -144,11 +188,11 @@ closure_marshal(GClosure        *closure,
 
         no_copy = FALSE;
 
-        if (i >= 1 && signal_query.signal_id) {
-            no_copy = (signal_query.param_types[i - 1] & G_SIGNAL_TYPE_STATIC_SCOPE) != 0;
+        if (i >= 1 && cached_query != NULL && i - 1 < 32) {
+            no_copy = (cached_query->static_scope_mask & (1u << (i - 1))) != 0;
         }
 
-        if (!gjs_value_from_g_value_internal(context, &argv[i], gval, no_copy, &signal_query, i)) {
+        if (!gjs_value_from_g_value_internal(context, &argv[i], gval, no_copy, signal_query, i)) {
             gjs_debug(GJS_DEBUG_GCLOSURE,
                       "Unable to convert arg %d in order to invoke closure",
                       i);
@@ -177,6 +221,7 @@ closure_marshal(GClosure        *closure,
     if (argc > 0)
         gjs_unroot_value_locations(context, argv, argc);
     JS_RemoveValueRoot(context, &rval);
+    gjs_set_typed_array_results_scope(saved_typed_array_scope);
     JS_EndRequest(context);
 }
 
@@ -188,9 +233,14 @@ gjs_closure_new_for_signal(JSContext  *context,
 {
     GClosure *closure;
 
+    const GjsSignalQuery *cached_query;
+
+    cached_query = gjs_signal_query_lookup(signal_id);
+    g_return_val_if_fail(cached_query != NULL, NULL);
+
     closure = gjs_closure_new(context, callable, description, FALSE);
 
-    g_closure_set_meta_marshal(closure, GUINT_TO_POINTER(signal_id), closure_marshal);
+    g_closure_set_meta_marshal(closure, (gpointer) cached_query, closure_marshal);
 
     return closure;
 }
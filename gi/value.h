@@ -29,6 +29,24 @@
 
 G_BEGIN_DECLS
 
+/* g_signal_query() results, kept around for the lifetime of the
+ * process so that connecting, emitting and marshalling don't need to
+ * query the signal each time. The types have G_SIGNAL_TYPE_STATIC_SCOPE
+ * masked out; it is kept in @static_scope_mask instead, with bit n
+ * set if parameter n has static scope (only for the first 32). */
+typedef struct {
+    guint        signal_id;
+    const char  *signal_name;
+    GType        itype;
+    guint        n_params;
+    GType       *param_types;
+    GType        return_type;
+    guint32      static_scope_mask;
+    GSignalQuery query;
+} GjsSignalQuery;
+
+const GjsSignalQuery *gjs_signal_query_lookup (guint signal_id);
+
 JSBool     gjs_value_to_g_value         (JSContext    *context,
                                          jsval         value,
                                          GValue       *gvalue);
@@ -165,6 +165,16 @@ function testUtf8() {
     JSUnit.assertEquals(NONCONST_STR, Everything.test_utf8_inout(CONST_STR));
 }
 
+function testUtf8InEncoding() {
+    // Two-, three- and four-byte sequences, the latter from a surrogate pair
+    JSUnit.assertEquals(4, Everything.test_int_out_utf8("a\u00e9\u2665\ud83d\ude00"));
+
+    // Longer than the arena's inline storage
+    let long = new Array(2000).join("\u2665");
+    JSUnit.assertEquals(1999, Everything.test_int_out_utf8(long));
+    JSUnit.assertEquals(3, Everything.test_int_out_utf8("abc"));
+}
+
 function testFilenameReturn() {
     var filenames = Everything.test_filename_return();
     JSUnit.assertEquals(2, filenames.length);
@@ -214,6 +224,22 @@ function testCallback() {
     JSUnit.assertRaises('CallbackUndefined', function () { Everything.test_callback(undefined); });
 }
 
+function testCallbackTrampolinePool() {
+    const System = imports.system;
+
+    // Warm the pool up with one trampoline for this callback type
+    Everything.test_callback(function() { return 0; });
+
+    let before = System.getMetrics().trampolinePool;
+    for (let i = 0; i < 10; i++)
+        JSUnit.assertEquals(i, Everything.test_callback(function() { return i; }));
+    let after = System.getMetrics().trampolinePool;
+
+    JSUnit.assertEquals(before.misses, after.misses);
+    JSUnit.assertEquals(before.hits + 10, after.hits);
+    JSUnit.assert(after.highWater >= 1);
+}
+
 function testArrayCallback() {
     function arrayEqual(ref, one) {
         JSUnit.assertEquals(ref.length, one.length);
@@ -414,6 +440,93 @@ function testEnumParam() {
     JSUnit.assertEquals('value4', Everything.TestEnum.param(Everything.TestEnum.VALUE4));
 }
 
+function testPropertyLookupCache() {
+    const System = imports.system;
+
+    let o = new Everything.TestObj({ int: 42 });
+
+    // Repeated lookups, both of GObject properties and of expandos,
+    // and again after a GC has flushed the cache
+    for (let i = 0; i < 3; i++) {
+        JSUnit.assertEquals(42, o.int);
+        o.int = 43;
+        JSUnit.assertEquals(43, o.int);
+        o.int = 42;
+
+        o.notAGObjectProperty = i;
+        JSUnit.assertEquals(i, o.notAGObjectProperty);
+
+        System.gc();
+    }
+}
+
+function testConstructorProperties() {
+    // The same keys repeatedly, in another order, and a subset
+    for (let i = 0; i < 3; i++) {
+        let o = new Everything.TestObj({ int: i, string: 'foo' + i });
+        JSUnit.assertEquals(i, o.int);
+        JSUnit.assertEquals('foo' + i, o.string);
+
+        o = new Everything.TestObj({ string: 'bar', int: 7 });
+        JSUnit.assertEquals(7, o.int);
+        JSUnit.assertEquals('bar', o.string);
+
+        o = new Everything.TestObj({ double: 1.5 });
+        JSUnit.assertEquals(1.5, o.double);
+    }
+
+    JSUnit.assertRaises(function() {
+        return new Everything.TestObj({ int: 1, notAProperty: 2 });
+    });
+    JSUnit.assertRaises(function() {
+        return new Everything.TestObj({ string: 42 });
+    });
+}
+
+function testPropertySetMany() {
+    let o = new Everything.TestObj();
+    let notified = [];
+    let id = o.connect('notify', function(obj, pspec) {
+        // All notifications are emitted after the last property is set
+        JSUnit.assertEquals('foo', obj.string);
+        notified.push(pspec.name);
+    });
+
+    o.set({ int: 5, double: 2.5, string: 'foo' });
+    JSUnit.assertEquals(5, o.int);
+    JSUnit.assertEquals(2.5, o.double);
+    JSUnit.assertEquals('foo', o.string);
+    JSUnit.assertEquals(3, notified.length);
+    o.disconnect(id);
+
+    o.string = null;
+    JSUnit.assertEquals(null, o.string);
+
+    JSUnit.assertRaises(function() { o.set({ string: 42 }); });
+    JSUnit.assertRaises(function() { o.set(); });
+}
+
+function testSignalLookupCache() {
+    const System = imports.system;
+
+    let o = new Everything.TestObj();
+    let intNotifies = 0, testEmissions = 0;
+    o.connect('notify::' + 'int', function() { intNotifies++; });
+    o.connect('test', function() { testEmissions++; });
+
+    // The same names again, and again after a GC flushed the cache
+    for (let i = 0; i < 3; i++) {
+        o.int = i + 1;
+        o.emit('test');
+        JSUnit.assertRaises(function() { o.emit('test', 42); });
+        JSUnit.assertRaises(function() { o.connect('no-such-signal', function() {}); });
+        System.gc();
+    }
+
+    JSUnit.assertEquals(3, intNotifies);
+    JSUnit.assertEquals(3, testEmissions);
+}
+
 function testSignal() {
     let handlerCounter = 0;
     let o = new Everything.TestObj();
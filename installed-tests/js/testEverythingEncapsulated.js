@@ -29,6 +29,24 @@ function testStruct() {
     JSUnit.assertEquals(66, struct.nested_a.some_int8);
 }
 
+function testStructScalarFields() {
+    let struct = new Everything.TestStructA();
+    struct.some_int = -42;
+    struct.some_int8 = -43;
+    struct.some_double = -0.5;
+
+    // The copy is made in C, so it sees what the setters wrote
+    let copy = struct.clone();
+    JSUnit.assertEquals(-42, copy.some_int);
+    JSUnit.assertEquals(-43, copy.some_int8);
+    JSUnit.assertEquals(-0.5, copy.some_double);
+
+    JSUnit.assertRaises(function() {
+        struct.some_int8 = 128;
+    });
+    JSUnit.assertEquals(-43, struct.some_int8);
+}
+
 function testStructConstructor()
 {
     // "Copy" an object from a hash of field values
@@ -56,6 +74,26 @@ function testStructConstructor()
     JSUnit.assertEquals(Everything.TestEnum.VALUE3, copy.some_enum);
 }
 
+function testStructConstructorRepeated() {
+    // Same keys in different orders, and a subset of them
+    for (let i = 0; i < 3; i++) {
+        let a = new Everything.TestStructA({ some_int: i, some_double: i + 0.5 });
+        let b = new Everything.TestStructA({ some_double: i + 0.5, some_int: i });
+        let c = new Everything.TestStructA({ some_int8: i });
+        JSUnit.assertEquals(i, a.some_int);
+        JSUnit.assertEquals(i + 0.5, a.some_double);
+        JSUnit.assertEquals(i, b.some_int);
+        JSUnit.assertEquals(i + 0.5, b.some_double);
+        JSUnit.assertEquals(i, c.some_int8);
+        JSUnit.assertEquals(0, c.some_int);
+    }
+
+    // A bad key is still caught once the good ones have been seen
+    JSUnit.assertRaises(function() {
+        let t = new Everything.TestStructA({ some_int: 1, junk: 42 });
+    });
+}
+
 function testSimpleBoxed() {
     let simple_boxed = new Everything.TestSimpleBoxedA();
     simple_boxed.some_int = 42;
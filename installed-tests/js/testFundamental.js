@@ -8,9 +8,35 @@ const GLib = imports.gi.GLib;
 const Gio = imports.gi.Gio;
 const GObject = imports.gi.GObject;
 const Lang = imports.lang;
+const System = imports.system;
 
 function testFundamental() {
     let f = new Everything.TestFundamentalSubObject('plop');
 }
 
+function testFundamentalWrapperMetrics() {
+    let f = new Everything.TestFundamentalSubObject('plop');
+    let wrappers = System.getMetrics().fundamentalWrappers;
+    JSUnit.assertTrue(wrappers.size >= 1);
+    JSUnit.assertTrue(wrappers.hits <= wrappers.lookups);
+}
+
+function testFundamentalWrapperSweep() {
+    // Created in a nested function, so that nothing on the stack
+    // keeps them alive
+    function makeGarbage() {
+        for (let i = 0; i < 10; i++)
+            new Everything.TestFundamentalSubObject('plop');
+    }
+
+    System.gc();
+    let before = System.getMetrics().fundamentalWrappers;
+    makeGarbage();
+    System.gc();
+    let after = System.getMetrics().fundamentalWrappers;
+
+    JSUnit.assertTrue(after.swept > before.swept);
+    JSUnit.assertTrue(after.size < before.size + 10);
+}
+
 JSUnit.gjstestRun(this, JSUnit.setUp, JSUnit.tearDown);
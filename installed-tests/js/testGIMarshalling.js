@@ -113,6 +113,69 @@ function testCArray() {
     GIMarshallingTests.array_in_guint8_len(array);
 }
 
+function testCArrayTypedArrayIn() {
+    GIMarshallingTests.array_in(new Int32Array([-1, 0, 1, 2]));
+    GIMarshallingTests.array_in_len_before(new Int32Array([-1, 0, 1, 2]));
+    GIMarshallingTests.array_fixed_int_in(new Int32Array([-1, 0, 1, 2]));
+
+    // Mismatched element types still go through the per-element path
+    GIMarshallingTests.array_in(new Float64Array([-1, 0, 1, 2]));
+    GIMarshallingTests.array_fixed_int_in(new Int16Array([-1, 0, 1, 2]));
+
+    // Zero-terminated arrays get copied
+    GIMarshallingTests.array_in_len_zero_terminated(new Int32Array([-1, 0, 1, 2]));
+}
+
+function testCArrayTypedResults() {
+    const System = imports.system;
+
+    var array = System.withTypedArrayResults(function() {
+        return GIMarshallingTests.array_return();
+    });
+    assertTrue(array instanceof Int32Array);
+    assertEquals(4, array.length);
+    assertEquals(-1, array[0]);
+    assertEquals(0, array[1]);
+    assertEquals(1, array[2]);
+    assertEquals(2, array[3]);
+
+    System.setTypedArrayResults(true);
+    try {
+        array = GIMarshallingTests.array_fixed_int_return();
+        assertTrue(array instanceof Int32Array);
+        assertEquals(4, array.length);
+        assertEquals(2, array[3]);
+    } finally {
+        System.setTypedArrayResults(false);
+    }
+
+    array = GIMarshallingTests.array_return();
+    assertTrue(array instanceof Array);
+}
+
+function testCArrayTypedResultsScope() {
+    const System = imports.system;
+    const Regress = imports.gi.Regress;
+
+    // Callbacks run from C during the scope are not part of it
+    var inner = null;
+    var outer = System.withTypedArrayResults(function() {
+        Regress.test_callback(function() {
+            inner = GIMarshallingTests.array_return();
+            return 0;
+        });
+        return GIMarshallingTests.array_return();
+    });
+    assertTrue(outer instanceof Int32Array);
+    assertTrue(inner instanceof Array);
+
+    var self = {};
+    var seen = System.withTypedArrayResults(function() {
+        return this;
+    }, self);
+    assertEquals(self, seen);
+}
+
 function testGArray() {
     var array;
     array = GIMarshallingTests.garray_int_none_return();
@@ -401,6 +464,37 @@ function testVFuncs() {
     assertEquals(50, c);
 }
 
+const OtherVFuncTester = new Lang.Class({
+    Name: 'OtherVFuncTester',
+    Extends: GIMarshallingTests.Object,
+
+    vfunc_vfunc_return_value_only: function() { return 7; }
+});
+
+function testVFuncStats() {
+    const System = imports.system;
+
+    function findStats() {
+        let stats = System.dumpVFuncStats();
+        for (let i = 0; i < stats.length; i++) {
+            if (stats[i].name == 'GIMarshallingTests.Object.vfunc_return_value_only')
+                return stats[i];
+        }
+        return null;
+    }
+
+    let before = findStats();
+    assertNotNull(before);
+    assertTrue(before.overrides >= 2);
+
+    assertEquals(42, new VFuncTester().vfunc_return_value_only());
+    assertEquals(7, new OtherVFuncTester().vfunc_return_value_only());
+
+    /* both classes go through the same plan */
+    let after = findStats();
+    assertEquals(before.calls + 2, after.calls);
+}
+
 function testInterfaces() {
     let ifaceImpl = new GIMarshallingTests.InterfaceImpl();
     let itself = ifaceImpl.get_as_interface();
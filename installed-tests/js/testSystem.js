@@ -14,5 +14,102 @@ function testVersion() {
     JSUnit.assert(System.version >= 13600);
 }
 
+function testCallStats() {
+    const GLib = imports.gi.GLib;
+
+    System.setCallStatsEnabled(true);
+    System.resetCallStats();
+    for (let i = 0; i < 3; i++)
+        GLib.random_int_range(0, 10);
+    System.setCallStatsEnabled(false);
+    GLib.random_int_range(0, 10);
+
+    let stats = System.dumpCallStats(1000);
+    let entry = stats.functions.filter(function(f) {
+        return f.name == 'GLib.random_int_range';
+    })[0];
+    JSUnit.assertNotUndefined(entry);
+    JSUnit.assertEquals(3, entry.calls);
+    JSUnit.assertEquals(32, entry.histogram.length);
+    JSUnit.assertEquals(3, entry.histogram.reduce(function(a, b) { return a + b; }, 0));
+    JSUnit.assert(stats.namespaces.some(function(ns) { return ns.name == 'GLib'; }));
+}
+
+function testMetrics() {
+    let metrics = System.getMetrics();
+    JSUnit.assertEquals('number', typeof metrics.pendingTrampolines);
+    JSUnit.assertEquals('number', typeof metrics.pendingToggles);
+    JSUnit.assertEquals('number', typeof metrics.objectWrappers);
+}
+
+function testConnectionCount() {
+    const GObject = imports.gi.GObject;
+
+    let o = new GObject.Object();
+    JSUnit.assertEquals(0, System.connectionCount(o));
+
+    let ids = [];
+    for (let i = 0; i < 3; i++)
+        ids.push(o.connect('notify', function() {}));
+    JSUnit.assertEquals(3, System.connectionCount(o));
+
+    // Removing from the middle, then the rest in connection order
+    o.disconnect(ids[1]);
+    JSUnit.assertEquals(2, System.connectionCount(o));
+    o.disconnect(ids[0]);
+    o.disconnect(ids[2]);
+    JSUnit.assertEquals(0, System.connectionCount(o));
+}
+
+function testHandleWrappers() {
+    const Gio = imports.gi.Gio;
+
+    System.setHandleWrappers(true);
+    try {
+        let before = System.getMetrics().handleWrappers;
+
+        // Wrapped on the way out of a C function
+        let action = Gio.SimpleAction.new('handle', null);
+        JSUnit.assertEquals(before + 1, System.getMetrics().handleWrappers);
+        JSUnit.assertEquals('handle', action.name);
+        JSUnit.assertEquals(before + 1, System.getMetrics().handleWrappers);
+
+        // JS state makes it a regular wrapper
+        action.customData = 42;
+        JSUnit.assertEquals(before, System.getMetrics().handleWrappers);
+        JSUnit.assertEquals(42, action.customData);
+
+        let other = Gio.SimpleAction.new('other', null);
+        other.connect('activate', function() {});
+        JSUnit.assertEquals(before, System.getMetrics().handleWrappers);
+    } finally {
+        System.setHandleWrappers(false);
+    }
+}
+
+function testWrapperStats() {
+    const Gio = imports.gi.Gio;
+
+    function findStats(name) {
+        let stats = System.wrapperStats();
+        for (let i = 0; i < stats.length; i++) {
+            if (stats[i].name == name)
+                return stats[i];
+        }
+        return { live: 0, rooted: 0, created: 0 };
+    }
+
+    let before = findStats('GSimpleAction');
+    let actions = [];
+    for (let i = 0; i < 3; i++)
+        actions.push(new Gio.SimpleAction({ name: 'stats' + i }));
+
+    let after = findStats('GSimpleAction');
+    JSUnit.assertEquals(before.created + 3, after.created);
+    JSUnit.assertEquals(before.live + 3, after.live);
+    JSUnit.assertTrue(after.rooted <= after.live);
+    JSUnit.assertTrue(after.instanceSize > 0);
+}
+
 JSUnit.gjstestRun(this, JSUnit.setUp, JSUnit.tearDown);
 
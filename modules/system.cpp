@@ -29,6 +29,10 @@
 
 #include <cjs/gjs-module.h>
 #include <gi/object.h>
+#include <gi/boxed.h>
+#include <gi/fundamental.h>
+#include <gi/function.h>
+#include <gi/arg.h>
 #include "system.h"
 
 static JSBool
@@ -82,6 +86,26 @@ gjs_refcount(JSContext *context,
     return JS_TRUE;
 }
 
+static JSBool
+gjs_connection_count(JSContext *context,
+                     unsigned   argc,
+                     jsval     *vp)
+{
+    jsval *argv = JS_ARGV(cx, vp);
+    JSObject *target_obj;
+
+    if (!gjs_parse_args(context, "connectionCount", "o", argc, argv, "object", &target_obj))
+        return JS_FALSE;
+
+    if (!gjs_typecheck_object(context, target_obj,
+                              G_TYPE_OBJECT, JS_TRUE))
+        return JS_FALSE;
+
+    JS_SET_RVAL(context, vp,
+                INT_TO_JSVAL(gjs_object_get_signal_connection_count(context, target_obj)));
+    return JS_TRUE;
+}
+
 static JSBool
 gjs_breakpoint(JSContext *context,
                unsigned   argc,
@@ -119,12 +143,302 @@ gjs_exit(JSContext *context,
     return JS_TRUE;
 }
 
+static JSBool
+gjs_set_call_stats_enabled(JSContext *context,
+                           unsigned   argc,
+                           jsval     *vp)
+{
+    jsval *argv = JS_ARGV(cx, vp);
+    gboolean enabled;
+    if (!gjs_parse_args(context, "setCallStatsEnabled", "b", argc, argv,
+                        "enabled", &enabled))
+        return JS_FALSE;
+    gjs_function_set_call_stats_enabled(enabled);
+    JS_SET_RVAL(context, vp, JSVAL_VOID);
+    return JS_TRUE;
+}
+
+static JSBool
+gjs_reset_call_stats(JSContext *context,
+                     unsigned   argc,
+                     jsval     *vp)
+{
+    jsval *argv = JS_ARGV(cx, vp);
+    if (!gjs_parse_args(context, "resetCallStats", "", argc, argv))
+        return JS_FALSE;
+    gjs_function_reset_call_stats();
+    JS_SET_RVAL(context, vp, JSVAL_VOID);
+    return JS_TRUE;
+}
+
+static JSBool
+gjs_dump_call_stats(JSContext *context,
+                    unsigned   argc,
+                    jsval     *vp)
+{
+    jsval *argv = JS_ARGV(cx, vp);
+    guint32 max_entries = 20;
+    jsval retval;
+
+    if (!gjs_parse_args(context, "dumpCallStats", "|u", argc, argv,
+                        "maxEntries", &max_entries))
+        return JS_FALSE;
+
+    if (!gjs_function_dump_call_stats(context, max_entries, &retval))
+        return JS_FALSE;
+
+    JS_SET_RVAL(context, vp, retval);
+    return JS_TRUE;
+}
+
+static JSBool
+gjs_wrapper_stats(JSContext *context,
+                  unsigned   argc,
+                  jsval     *vp)
+{
+    jsval retval;
+
+    if (!gjs_object_get_type_stats(context, &retval))
+        return JS_FALSE;
+
+    JS_SET_RVAL(context, vp, retval);
+    return JS_TRUE;
+}
+
+static JSBool
+gjs_dump_wrapper_stats(JSContext *context,
+                       unsigned   argc,
+                       jsval     *vp)
+{
+    jsval *argv = JS_ARGV(cx, vp);
+    char *filename;
+    gboolean ret;
+
+    if (!gjs_parse_args(context, "dumpWrapperStats", "s", argc, argv,
+                        "filename", &filename))
+        return JS_FALSE;
+
+    ret = gjs_object_dump_type_stats(filename);
+    g_free(filename);
+
+    JS_SET_RVAL(context, vp, BOOLEAN_TO_JSVAL(ret));
+    return JS_TRUE;
+}
+
+static JSBool
+gjs_dump_vfunc_stats(JSContext *context,
+                     unsigned   argc,
+                     jsval     *vp)
+{
+    jsval retval;
+
+    if (!gjs_function_dump_vfunc_stats(context, &retval))
+        return JS_FALSE;
+
+    JS_SET_RVAL(context, vp, retval);
+    return JS_TRUE;
+}
+
+static JSBool
+gjs_set_typed_array_results_js(JSContext *context,
+                               unsigned   argc,
+                               jsval     *vp)
+{
+    jsval *argv = JS_ARGV(cx, vp);
+    gboolean enabled;
+    if (!gjs_parse_args(context, "setTypedArrayResults", "b", argc, argv,
+                        "enabled", &enabled))
+        return JS_FALSE;
+    gjs_set_typed_array_results(enabled);
+    JS_SET_RVAL(context, vp, JSVAL_VOID);
+    return JS_TRUE;
+}
+
+/* Calls a function with typed array results turned on, so a single
+ * call site can opt in without changing the global setting. This only
+ * covers the calls the function makes itself; signal handlers,
+ * callbacks and vfuncs that C code runs meanwhile use the global
+ * setting. The function is called with thisObj as "this", or with the
+ * "this" of withTypedArrayResults() itself if that is not given. */
+static JSBool
+gjs_with_typed_array_results(JSContext *context,
+                             unsigned   argc,
+                             jsval     *vp)
+{
+    jsval *argv = JS_ARGV(cx, vp);
+    JSObject *callback;
+    JSObject *this_obj = NULL;
+    gboolean saved;
+    jsval retval;
+    JSBool ret;
+
+    if (!gjs_parse_args(context, "withTypedArrayResults", "o|o", argc, argv,
+                        "callback", &callback,
+                        "thisObj", &this_obj))
+        return JS_FALSE;
+
+    if (!JS_ObjectIsFunction(context, callback)) {
+        gjs_throw(context, "withTypedArrayResults() expects a function");
+        return JS_FALSE;
+    }
+
+    if (this_obj == NULL)
+        this_obj = JS_THIS_OBJECT(context, vp);
+
+    saved = gjs_set_typed_array_results_scope(TRUE);
+    ret = JS_CallFunctionValue(context, this_obj, OBJECT_TO_JSVAL(callback),
+                               0, NULL, &retval);
+    gjs_set_typed_array_results_scope(saved);
+
+    if (ret)
+        JS_SET_RVAL(context, vp, retval);
+    return ret;
+}
+
+static JSBool
+gjs_set_handle_wrappers_js(JSContext *context,
+                           unsigned   argc,
+                           jsval     *vp)
+{
+    jsval *argv = JS_ARGV(cx, vp);
+    gboolean enabled;
+    if (!gjs_parse_args(context, "setHandleWrappers", "b", argc, argv,
+                        "enabled", &enabled))
+        return JS_FALSE;
+    gjs_set_handle_wrappers(enabled);
+    JS_SET_RVAL(context, vp, JSVAL_VOID);
+    return JS_TRUE;
+}
+
+static JSBool
+define_metric(JSContext  *context,
+              JSObject   *obj,
+              const char *name,
+              double      number)
+{
+    jsval value;
+
+    if (!JS_NewNumberValue(context, number, &value))
+        return JS_FALSE;
+
+    return JS_DefineProperty(context, obj, name, value,
+                             NULL, NULL, JSPROP_ENUMERATE);
+}
+
+static JSBool
+define_trampoline_pool_metrics(JSContext *context,
+                               JSObject  *metrics)
+{
+    GjsTrampolinePoolStats stats;
+    JSObject *pool;
+
+    gjs_callback_trampoline_get_pool_stats(&stats);
+
+    pool = JS_NewObject(context, NULL, NULL, NULL);
+    if (pool == NULL ||
+        !JS_DefineProperty(context, metrics, "trampolinePool",
+                           OBJECT_TO_JSVAL(pool), NULL, NULL, JSPROP_ENUMERATE))
+        return JS_FALSE;
+
+    return define_metric(context, pool, "size", stats.size) &&
+        define_metric(context, pool, "highWater", stats.high_water) &&
+        define_metric(context, pool, "maxSize", stats.max_size) &&
+        define_metric(context, pool, "hits", stats.hits) &&
+        define_metric(context, pool, "misses", stats.misses);
+}
+
+static JSBool
+define_boxed_alloc_metrics(JSContext *context,
+                           JSObject  *metrics)
+{
+    GjsBoxedAllocStats stats;
+    JSObject *boxed;
+
+    gjs_boxed_get_alloc_stats(&stats);
+
+    boxed = JS_NewObject(context, NULL, NULL, NULL);
+    if (boxed == NULL ||
+        !JS_DefineProperty(context, metrics, "boxedAllocations",
+                           OBJECT_TO_JSVAL(boxed), NULL, NULL, JSPROP_ENUMERATE))
+        return JS_FALSE;
+
+    return define_metric(context, boxed, "wrappers", stats.wrappers) &&
+        define_metric(context, boxed, "slabAllocs", stats.slab_allocs) &&
+        define_metric(context, boxed, "structAllocs", stats.struct_allocs) &&
+        define_metric(context, boxed, "inlineStructs", stats.inline_structs);
+}
+
+static JSBool
+define_fundamental_wrapper_metrics(JSContext *context,
+                                   JSObject  *metrics)
+{
+    GjsFundamentalWrapperStats stats;
+    JSObject *wrappers;
+
+    gjs_fundamental_get_wrapper_stats(context, &stats);
+
+    wrappers = JS_NewObject(context, NULL, NULL, NULL);
+    if (wrappers == NULL ||
+        !JS_DefineProperty(context, metrics, "fundamentalWrappers",
+                           OBJECT_TO_JSVAL(wrappers), NULL, NULL, JSPROP_ENUMERATE))
+        return JS_FALSE;
+
+    return define_metric(context, wrappers, "size", stats.size) &&
+        define_metric(context, wrappers, "lookups", stats.lookups) &&
+        define_metric(context, wrappers, "hits", stats.hits) &&
+        define_metric(context, wrappers, "swept", stats.swept);
+}
+
+/* Counters that are useful to monitor in long-running processes */
+static JSBool
+gjs_get_metrics(JSContext *context,
+                unsigned   argc,
+                jsval     *vp)
+{
+    jsval *argv = JS_ARGV(cx, vp);
+    JSObject *metrics;
+
+    if (!gjs_parse_args(context, "getMetrics", "", argc, argv))
+        return JS_FALSE;
+
+    metrics = JS_NewObject(context, NULL, NULL, NULL);
+    if (metrics == NULL)
+        return JS_FALSE;
+
+    if (!define_metric(context, metrics, "pendingTrampolines",
+                       gjs_callback_trampoline_get_n_pending()) ||
+        !define_metric(context, metrics, "pendingToggles",
+                       gjs_object_get_n_pending_toggles()) ||
+        !define_metric(context, metrics, "objectWrappers",
+                       gjs_object_get_n_wrappers(context)) ||
+        !define_metric(context, metrics, "handleWrappers",
+                       gjs_object_get_n_handle_wrappers()) ||
+        !define_trampoline_pool_metrics(context, metrics) ||
+        !define_boxed_alloc_metrics(context, metrics) ||
+        !define_fundamental_wrapper_metrics(context, metrics))
+        return JS_FALSE;
+
+    JS_SET_RVAL(context, vp, OBJECT_TO_JSVAL(metrics));
+    return JS_TRUE;
+}
+
 static JSFunctionSpec module_funcs[] = {
     { "addressOf", JSOP_WRAPPER (gjs_address_of), 1, GJS_MODULE_PROP_FLAGS },
     { "refcount", JSOP_WRAPPER (gjs_refcount), 1, GJS_MODULE_PROP_FLAGS },
+    { "connectionCount", JSOP_WRAPPER (gjs_connection_count), 1, GJS_MODULE_PROP_FLAGS },
     { "breakpoint", JSOP_WRAPPER (gjs_breakpoint), 0, GJS_MODULE_PROP_FLAGS },
     { "gc", JSOP_WRAPPER (gjs_gc), 0, GJS_MODULE_PROP_FLAGS },
     { "exit", JSOP_WRAPPER (gjs_exit), 0, GJS_MODULE_PROP_FLAGS },
+    { "setCallStatsEnabled", JSOP_WRAPPER (gjs_set_call_stats_enabled), 1, GJS_MODULE_PROP_FLAGS },
+    { "resetCallStats", JSOP_WRAPPER (gjs_reset_call_stats), 0, GJS_MODULE_PROP_FLAGS },
+    { "dumpCallStats", JSOP_WRAPPER (gjs_dump_call_stats), 1, GJS_MODULE_PROP_FLAGS },
+    { "dumpVFuncStats", JSOP_WRAPPER (gjs_dump_vfunc_stats), 0, GJS_MODULE_PROP_FLAGS },
+    { "wrapperStats", JSOP_WRAPPER (gjs_wrapper_stats), 0, GJS_MODULE_PROP_FLAGS },
+    { "dumpWrapperStats", JSOP_WRAPPER (gjs_dump_wrapper_stats), 1, GJS_MODULE_PROP_FLAGS },
+    { "getMetrics", JSOP_WRAPPER (gjs_get_metrics), 0, GJS_MODULE_PROP_FLAGS },
+    { "setTypedArrayResults", JSOP_WRAPPER (gjs_set_typed_array_results_js), 1, GJS_MODULE_PROP_FLAGS },
+    { "withTypedArrayResults", JSOP_WRAPPER (gjs_with_typed_array_results), 1, GJS_MODULE_PROP_FLAGS },
+    { "setHandleWrappers", JSOP_WRAPPER (gjs_set_handle_wrappers_js), 1, GJS_MODULE_PROP_FLAGS },
     { NULL },
 };
 
@@ -0,0 +1,513 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Micro-benchmarks for the GI marshalling layer. They are only
+ * registered when running in performance mode ("gjs-tests -m perf"),
+ * and report their numbers through g_test_minimized_result().
+ */
+
+#include <config.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <glib-object.h>
+#include <girepository.h>
+#include <cjs/gjs.h>
+#include <gi/boxed.h>
+#include <gi/function.h>
+#include <gi/object.h>
+
+#include "gjs-tests-add-funcs.h"
+
+static void
+eval_or_die(GjsContext *context,
+            const char *script)
+{
+    GError *error = NULL;
+    int exit_status;
+
+    if (!gjs_context_eval(context, script, -1, "<benchmark>",
+                          &exit_status, &error))
+        g_error("%s", error->message);
+}
+
+/* Evaluates @setup_script in a fresh context, then returns how long
+ * @timed_script takes to run in it.
+ */
+static gdouble
+time_script(const char *setup_script,
+            const char *timed_script)
+{
+    GjsContext *context;
+    gdouble elapsed;
+
+    context = gjs_context_new();
+    eval_or_die(context, setup_script);
+
+    g_test_timer_start();
+    eval_or_die(context, timed_script);
+    elapsed = g_test_timer_elapsed();
+
+    g_object_unref(context);
+    return elapsed;
+}
+
+#define N_CALLS 1000000
+
+/* GLib.random_int_range() takes two ints and returns one, so it goes
+ * through gjs_invoke_c_function_simple() unless that is disabled.
+ */
+static const char call_setup_script[] =
+    "const GLib = imports.gi.GLib;\n"
+    "function run(n) {\n"
+    "    for (let i = 0; i < n; i++)\n"
+    "        GLib.random_int_range(0, 100);\n"
+    "}\n"
+    "run(1000);\n";
+
+static void
+gjstest_perf_function_call_simple_vs_generic(void)
+{
+    gdouble simple, generic;
+    const char *timed_script = "run(" G_STRINGIFY(N_CALLS) ");";
+
+    gjs_function_set_simple_invoke_disabled(FALSE);
+    simple = time_script(call_setup_script, timed_script);
+
+    gjs_function_set_simple_invoke_disabled(TRUE);
+    generic = time_script(call_setup_script, timed_script);
+    gjs_function_set_simple_invoke_disabled(FALSE);
+
+    g_test_minimized_result(simple * 1e9 / N_CALLS,
+                            "simple invoker: %.1f ns per call",
+                            simple * 1e9 / N_CALLS);
+    g_test_minimized_result(generic * 1e9 / N_CALLS,
+                            "generic invoker: %.1f ns per call",
+                            generic * 1e9 / N_CALLS);
+}
+
+#undef N_CALLS
+
+#define N_GETS 1000000
+
+/* "enabled" is a boolean and "name" a string, both overridden from
+ * the GAction interface, so they exercise the redirected pspecs.
+ */
+static const char property_get_setup_script[] =
+    "const Gio = imports.gi.Gio;\n"
+    "let action = new Gio.SimpleAction({ name: 'bench' });\n"
+    "function run(n) {\n"
+    "    let count = 0;\n"
+    "    for (let i = 0; i < n; i++) {\n"
+    "        if (action.enabled)\n"
+    "            count++;\n"
+    "        if (action.name)\n"
+    "            count++;\n"
+    "    }\n"
+    "    return count;\n"
+    "}\n"
+    "run(1000);\n";
+
+static void
+gjstest_perf_object_property_get(void)
+{
+    gdouble elapsed;
+
+    /* Two property gets per iteration */
+    elapsed = time_script(property_get_setup_script,
+                          "run(" G_STRINGIFY(N_GETS) ");");
+
+    g_test_minimized_result(elapsed * 1e9 / (2 * N_GETS),
+                            "property get: %.1f ns per get",
+                            elapsed * 1e9 / (2 * N_GETS));
+}
+
+#undef N_GETS
+
+#define N_OBJECTS 1000
+#define N_ROUNDS 1000
+
+/* Compares finding a GObject's JS wrapper through
+ * gjs_object_from_g_object(), which ends up in peek_js_obj(), with a
+ * plain GObject qdata lookup, which takes a global lock and scans the
+ * object's datalist. Each object gets a few other qdata entries, as
+ * toolkit objects usually carry some. */
+static void
+gjstest_perf_object_wrapper_lookup(void)
+{
+    GObject *objects[N_OBJECTS];
+    JSObject *wrappers[N_OBJECTS];
+    GjsContext *gjs_context;
+    JSContext *context;
+    GQuark wrapper_quark, other_quarks[4];
+    gboolean handle_wrappers;
+    gdouble qdata_time, wrapper_time;
+    gsize found;
+    int i, j;
+
+    /* Regular wrappers are kept alive by the toggle ref, so they can't
+     * be collected while the loop below runs */
+    handle_wrappers = gjs_get_handle_wrappers();
+    gjs_set_handle_wrappers(FALSE);
+
+    gjs_context = gjs_context_new();
+    context = (JSContext *) gjs_context_get_native_context(gjs_context);
+
+    wrapper_quark = g_quark_from_static_string("gjs-perf-wrapper");
+    for (j = 0; j < (int) G_N_ELEMENTS(other_quarks); j++) {
+        char *name = g_strdup_printf("gjs-perf-other-%d", j);
+        other_quarks[j] = g_quark_from_string(name);
+        g_free(name);
+    }
+
+    for (i = 0; i < N_OBJECTS; i++) {
+        objects[i] = (GObject *) g_object_new(G_TYPE_OBJECT, NULL);
+        for (j = 0; j < (int) G_N_ELEMENTS(other_quarks); j++)
+            g_object_set_qdata(objects[i], other_quarks[j], GINT_TO_POINTER(j + 1));
+        wrappers[i] = gjs_object_from_g_object(context, objects[i]);
+        g_assert(wrappers[i] != NULL);
+        g_object_set_qdata(objects[i], wrapper_quark, wrappers[i]);
+    }
+
+    found = 0;
+    g_test_timer_start();
+    for (j = 0; j < N_ROUNDS; j++)
+        for (i = 0; i < N_OBJECTS; i++)
+            found += g_object_get_qdata(objects[i], wrapper_quark) == wrappers[i];
+    qdata_time = g_test_timer_elapsed();
+
+    g_test_timer_start();
+    for (j = 0; j < N_ROUNDS; j++)
+        for (i = 0; i < N_OBJECTS; i++)
+            found += gjs_object_from_g_object(context, objects[i]) == wrappers[i];
+    wrapper_time = g_test_timer_elapsed();
+
+    g_assert_cmpuint(found, ==, 2 * N_OBJECTS * N_ROUNDS);
+
+    g_test_minimized_result(qdata_time * 1e9 / (N_OBJECTS * N_ROUNDS),
+                            "qdata: %.1f ns per lookup",
+                            qdata_time * 1e9 / (N_OBJECTS * N_ROUNDS));
+    g_test_minimized_result(wrapper_time * 1e9 / (N_OBJECTS * N_ROUNDS),
+                            "gjs_object_from_g_object: %.1f ns per lookup",
+                            wrapper_time * 1e9 / (N_OBJECTS * N_ROUNDS));
+
+    for (i = 0; i < N_OBJECTS; i++)
+        g_object_unref(objects[i]);
+    g_object_unref(gjs_context);
+
+    gjs_set_handle_wrappers(handle_wrappers);
+}
+
+/* lookup_action() returns an object that is already wrapped, so this
+ * is mostly the cost of finding the existing wrapper */
+static const char wrapper_from_c_setup_script[] =
+    "const Gio = imports.gi.Gio;\n"
+    "let group = new Gio.SimpleActionGroup();\n"
+    "for (let i = 0; i < 100; i++)\n"
+    "    group.add_action(new Gio.SimpleAction({ name: 'action' + i }));\n"
+    "function run(n) {\n"
+    "    for (let i = 0; i < n; i++)\n"
+    "        group.lookup_action('action' + (i % 100));\n"
+    "}\n"
+    "run(1000);\n";
+
+static void
+gjstest_perf_object_wrapper_from_c(void)
+{
+    gdouble elapsed;
+
+    elapsed = time_script(wrapper_from_c_setup_script,
+                          "run(" G_STRINGIFY(N_OBJECTS * N_ROUNDS) ");");
+
+    g_test_minimized_result(elapsed * 1e9 / (N_OBJECTS * N_ROUNDS),
+                            "wrapped object returned from C: %.1f ns per call",
+                            elapsed * 1e9 / (N_OBJECTS * N_ROUNDS));
+}
+
+#undef N_OBJECTS
+#undef N_ROUNDS
+
+#define N_OBJECTS 100000
+
+/* Stands in for new Gtk.Label({ label: 'x', xalign: 0 }): a string and
+ * a scalar property, always the same keys, without needing a display.
+ */
+static const char construct_setup_script[] =
+    "const Gio = imports.gi.Gio;\n"
+    "function run(n) {\n"
+    "    for (let i = 0; i < n; i++)\n"
+    "        new Gio.SimpleAction({ name: 'x', enabled: false });\n"
+    "}\n"
+    "run(1000);\n";
+
+static void
+gjstest_perf_object_construct(void)
+{
+    gdouble cached, uncached;
+
+    /* Without shapes, every key is still looked up in the property
+     * cache, but the shape is built again for each object */
+    gjs_object_set_constructor_shapes_enabled(FALSE);
+    uncached = time_script(construct_setup_script,
+                           "run(" G_STRINGIFY(N_OBJECTS) ");");
+    gjs_object_set_constructor_shapes_enabled(TRUE);
+    cached = time_script(construct_setup_script,
+                         "run(" G_STRINGIFY(N_OBJECTS) ");");
+
+    g_test_minimized_result(uncached,
+                            "%d objects constructed without shape cache: %.3f s",
+                            N_OBJECTS, uncached);
+    g_test_minimized_result(cached,
+                            "%d objects constructed with shape cache: %.3f s",
+                            N_OBJECTS, cached);
+}
+
+#undef N_OBJECTS
+
+#define N_ACCESSES 1000000
+
+/* Stands in for rect.x/rect.width in layout code: scalar fields of a
+ * plain struct, read and written in a tight loop.
+ */
+static const char boxed_field_setup_script[] =
+    "const GLib = imports.gi.GLib;\n"
+    "let tv = new GLib.TimeVal({ tv_sec: 1, tv_usec: 2 });\n"
+    "function run(n) {\n"
+    "    let sum = 0;\n"
+    "    for (let i = 0; i < n; i++) {\n"
+    "        sum += tv.tv_sec + tv.tv_usec;\n"
+    "        tv.tv_usec = i;\n"
+    "    }\n"
+    "    return sum;\n"
+    "}\n"
+    "run(1000);\n";
+
+static void
+gjstest_perf_boxed_field_access(void)
+{
+    gdouble elapsed;
+
+    elapsed = time_script(boxed_field_setup_script,
+                          "run(" G_STRINGIFY(N_ACCESSES) ");");
+
+    /* two reads and one write per iteration */
+    g_test_minimized_result(elapsed * 1e9 / (3 * N_ACCESSES),
+                            "boxed field access: %.1f ns",
+                            elapsed * 1e9 / (3 * N_ACCESSES));
+}
+
+#undef N_ACCESSES
+
+#define N_STRUCTS 1000000
+
+/* GLib.TimeVal is a 16 byte simple struct, and get_current_time()
+ * fills in a caller-allocated one that is then copied into a wrapper,
+ * the same path as small structs returned by value. The wrappers are
+ * dropped right away, so with the free list most of them reuse the
+ * memory of collected ones.
+ */
+static const char boxed_alloc_setup_script[] =
+    "const GLib = imports.gi.GLib;\n"
+    "const System = imports.system;\n"
+    "function run(n) {\n"
+    "    for (let i = 0; i < n; i++) {\n"
+    "        GLib.get_current_time();\n"
+    "        if (i % 10000 == 0)\n"
+    "            System.gc();\n"
+    "    }\n"
+    "}\n"
+    "run(1000);\n";
+
+static void
+boxed_alloc_run(gboolean             inline_structs,
+                gdouble             *elapsed_p,
+                GjsBoxedAllocStats  *stats_p)
+{
+    GjsBoxedAllocStats before;
+
+    if (inline_structs)
+        g_unsetenv("GJS_DISABLE_BOXED_INLINE");
+    else
+        g_setenv("GJS_DISABLE_BOXED_INLINE", "1", TRUE);
+
+    /* time_script() also counts the setup script, which runs the
+     * loop a few times as well; negligible next to N_STRUCTS */
+    gjs_boxed_get_alloc_stats(&before);
+    *elapsed_p = time_script(boxed_alloc_setup_script,
+                             "run(" G_STRINGIFY(N_STRUCTS) ");");
+    gjs_boxed_get_alloc_stats(stats_p);
+
+    stats_p->wrappers -= before.wrappers;
+    stats_p->slab_allocs -= before.slab_allocs;
+    stats_p->struct_allocs -= before.struct_allocs;
+    stats_p->inline_structs -= before.inline_structs;
+
+    g_unsetenv("GJS_DISABLE_BOXED_INLINE");
+}
+
+static void
+gjstest_perf_boxed_alloc(void)
+{
+    GjsBoxedAllocStats separate, inlined;
+    gdouble separate_time, inline_time;
+
+    boxed_alloc_run(FALSE, &separate_time, &separate);
+    boxed_alloc_run(TRUE, &inline_time, &inlined);
+
+    g_assert_cmpuint(inlined.inline_structs, >=, N_STRUCTS);
+
+    g_test_minimized_result((separate.slab_allocs + separate.struct_allocs) / (gdouble) separate.wrappers,
+                            "separate struct: %.3f allocations per wrapper, %.1f ns per wrapper",
+                            (separate.slab_allocs + separate.struct_allocs) / (gdouble) separate.wrappers,
+                            separate_time * 1e9 / N_STRUCTS);
+    g_test_minimized_result((inlined.slab_allocs + inlined.struct_allocs) / (gdouble) inlined.wrappers,
+                            "inline struct: %.3f allocations per wrapper, %.1f ns per wrapper",
+                            (inlined.slab_allocs + inlined.struct_allocs) / (gdouble) inlined.wrappers,
+                            inline_time * 1e9 / N_STRUCTS);
+}
+
+#undef N_STRUCTS
+
+/* Startup benchmark: imports Gio and touches one name in @touch_every,
+ * as an application's startup touches the names it uses. The warm set
+ * lists every name; those are all defined when Gio is imported instead
+ * of being resolved one at a time, whether the script touches them or
+ * not.
+ */
+static char *
+build_ns_startup_script(const char  *ns_name,
+                        int          touch_every,
+                        char       **warm_set_p)
+{
+    GIRepository *repo = g_irepository_get_default();
+    GString *script, *warm_set;
+    GError *error = NULL;
+    int i, n_infos;
+
+    if (!g_irepository_require(repo, ns_name, NULL, (GIRepositoryLoadFlags) 0, &error))
+        g_error("%s", error->message);
+
+    script = g_string_new(NULL);
+    warm_set = g_string_new(NULL);
+    g_string_append_printf(script, "const Ns = imports.gi.%s;\n", ns_name);
+    g_string_append(script, "const names = [");
+
+    n_infos = g_irepository_get_n_infos(repo, ns_name);
+    for (i = 0; i < n_infos; i++) {
+        GIBaseInfo *info = g_irepository_get_info(repo, ns_name, i);
+        const char *name = g_base_info_get_name(info);
+
+        if (i % touch_every == 0)
+            g_string_append_printf(script, "'%s',", name);
+        g_string_append_printf(warm_set, "%s.%s\n", ns_name, name);
+        g_base_info_unref(info);
+    }
+
+    /* Some names may not be usable from JS; that's the same either way */
+    g_string_append(script,
+                    "];\n"
+                    "for (let i = 0; i < names.length; i++) {\n"
+                    "    try {\n"
+                    "        Ns[names[i]];\n"
+                    "    } catch (e) {\n"
+                    "    }\n"
+                    "}\n");
+
+    *warm_set_p = g_string_free(warm_set, FALSE);
+    return g_string_free(script, FALSE);
+}
+
+static void
+time_ns_startup(const char *script,
+                const char *warm_set_path,
+                const char *what)
+{
+    gdouble lazy, warm;
+
+    /* The first import also loads the typelib, which both modes share */
+    g_unsetenv("GJS_WARM_SET_FILE");
+    time_script("", script);
+    lazy = time_script("", script);
+
+    g_setenv("GJS_WARM_SET_FILE", warm_set_path, TRUE);
+    warm = time_script("", script);
+    g_unsetenv("GJS_WARM_SET_FILE");
+
+    g_test_minimized_result(lazy * 1e3,
+                            "lazy resolve: %.2f ms to import Gio and touch %s",
+                            lazy * 1e3, what);
+    g_test_minimized_result(warm * 1e3,
+                            "warm set: %.2f ms to import Gio and touch %s",
+                            warm * 1e3, what);
+}
+
+static void
+gjstest_perf_ns_startup_warm_set(void)
+{
+    char *script, *partial_script, *warm_set, *warm_set_path;
+    GError *error = NULL;
+    int fd;
+
+    script = build_ns_startup_script("Gio", 1, &warm_set);
+    g_free(warm_set);
+    partial_script = build_ns_startup_script("Gio", 10, &warm_set);
+
+    fd = g_file_open_tmp("gjs-warm-set-XXXXXX", &warm_set_path, &error);
+    if (fd < 0)
+        g_error("%s", error->message);
+    close(fd);
+    if (!g_file_set_contents(warm_set_path, warm_set, -1, &error))
+        g_error("%s", error->message);
+
+    time_ns_startup(script, warm_set_path, "every name");
+    /* Shows the cost of defining names the script never uses */
+    time_ns_startup(partial_script, warm_set_path, "one name in ten");
+
+    g_unlink(warm_set_path);
+    g_free(warm_set_path);
+    g_free(warm_set);
+    g_free(partial_script);
+    g_free(script);
+}
+
+void
+gjs_test_add_tests_for_performance(void)
+{
+    if (!g_test_perf())
+        return;
+
+    g_test_add_func("/gjs/perf/function/call/simple_vs_generic",
+                    gjstest_perf_function_call_simple_vs_generic);
+    g_test_add_func("/gjs/perf/object/property/get",
+                    gjstest_perf_object_property_get);
+    g_test_add_func("/gjs/perf/object/wrapper/lookup",
+                    gjstest_perf_object_wrapper_lookup);
+    g_test_add_func("/gjs/perf/object/wrapper/from_c",
+                    gjstest_perf_object_wrapper_from_c);
+    g_test_add_func("/gjs/perf/object/construct",
+                    gjstest_perf_object_construct);
+    g_test_add_func("/gjs/perf/boxed/field/access",
+                    gjstest_perf_boxed_field_access);
+    g_test_add_func("/gjs/perf/boxed/alloc",
+                    gjstest_perf_boxed_alloc);
+    g_test_add_func("/gjs/perf/ns/startup/warm_set",
+                    gjstest_perf_ns_startup_warm_set);
+}
@@ -22,11 +22,13 @@
  */
 
 #include <config.h>
+#include <string.h>
 #include <glib.h>
 #include <glib-object.h>
 #include <cjs/gjs-module.h>
 #include <util/glib.h>
 #include <util/crash.h>
+#include <util/arena.h>
 
 #include "gjs-tests-add-funcs.h"
 
@@ -162,6 +164,34 @@ gjstest_test_func_gjs_jsapi_util_string_js_string_utf8(void)
     g_free(utf8_result);
 }
 
+static void
+gjstest_test_func_gjs_runtime_interned_utf8(void)
+{
+    GjsUnitTestFixture fixture;
+    JSContext *context;
+    JSObject *global;
+    JSString *atom, *str;
+    const char *utf8, *utf8_again;
+
+    _gjs_unit_test_fixture_begin(&fixture);
+    context = fixture.context;
+    global = JS_GetGlobalObject(context);
+    JSCompartment *oldCompartment = JS_EnterCompartment(context, global);
+
+    atom = JS_InternString(context, "foo-bar");
+    g_assert(gjs_runtime_lookup_interned_utf8(context, atom, &utf8));
+    g_assert_cmpstr(utf8, ==, "foo-bar");
+    g_assert(gjs_runtime_lookup_interned_utf8(context, atom, &utf8_again));
+    g_assert(utf8 == utf8_again);
+
+    str = JS_NewStringCopyZ(context, "not interned");
+    g_assert(gjs_runtime_lookup_interned_utf8(context, str, &utf8));
+    g_assert(utf8 == NULL);
+
+    JS_LeaveCompartment(context, oldCompartment);
+    _gjs_unit_test_fixture_finish(&fixture);
+}
+
 static void
 gjstest_test_func_gjs_stack_dump(void)
 {
@@ -281,6 +311,38 @@ gjstest_test_func_util_glib_strv_concat_pointers(void)
     g_strfreev(ret);
 }
 
+static void
+gjstest_test_func_util_arena_alloc(void)
+{
+    GjsArena arena;
+    char *small, *large;
+    guint i;
+
+    gjs_arena_init(&arena);
+
+    small = (char *) gjs_arena_alloc0(&arena, 3);
+    g_assert(small >= arena.inline_block.data);
+    g_assert(small < arena.inline_block.data + GJS_ARENA_INLINE_SIZE);
+    g_assert_cmpuint(GPOINTER_TO_SIZE(small) % GJS_ARENA_ALIGNMENT, ==, 0);
+    g_assert_cmpint(small[0], ==, 0);
+    g_assert_cmpint(small[2], ==, 0);
+    g_assert(arena.chunks == NULL);
+
+    /* Every allocation is suitably aligned */
+    for (i = 0; i < 100; i++)
+        g_assert_cmpuint(GPOINTER_TO_SIZE(gjs_arena_alloc(&arena, i)) % GJS_ARENA_ALIGNMENT, ==, 0);
+    g_assert(arena.chunks != NULL);
+
+    large = (char *) gjs_arena_alloc(&arena, 100000);
+    memset(large, 'x', 100000);
+
+    gjs_arena_clear(&arena);
+    g_assert(arena.chunks == NULL);
+    g_assert(arena.pos >= arena.inline_block.data);
+    g_assert(arena.pos < arena.inline_block.data + GJS_ARENA_ALIGNMENT);
+    g_assert_cmpuint(GPOINTER_TO_SIZE(arena.pos) % GJS_ARENA_ALIGNMENT, ==, 0);
+}
+
 static void
 gjstest_test_strip_shebang_no_advance_for_no_shebang(void)
 {
@@ -348,11 +410,14 @@ main(int    argc,
     g_test_add_func("/gjs/jsutil/strip_shebang/no_shebang", gjstest_test_strip_shebang_no_advance_for_no_shebang);
     g_test_add_func("/gjs/jsutil/strip_shebang/have_shebang", gjstest_test_strip_shebang_advance_for_shebang);
     g_test_add_func("/gjs/jsutil/strip_shebang/only_shebang", gjstest_test_strip_shebang_return_null_for_just_shebang);
+    g_test_add_func("/gjs/runtime/interned_utf8", gjstest_test_func_gjs_runtime_interned_utf8);
     g_test_add_func("/gjs/stack/dump", gjstest_test_func_gjs_stack_dump);
     g_test_add_func("/util/glib/strv/concat/null", gjstest_test_func_util_glib_strv_concat_null);
     g_test_add_func("/util/glib/strv/concat/pointers", gjstest_test_func_util_glib_strv_concat_pointers);
+    g_test_add_func("/util/arena/alloc", gjstest_test_func_util_arena_alloc);
 
     gjs_test_add_tests_for_coverage ();
+    gjs_test_add_tests_for_performance ();
 
     g_test_run();
 
@@ -0,0 +1,97 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <config.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define GJS_ARENA_CHUNK_SIZE 4096
+
+/* The data of a chunk starts GJS_ARENA_ALIGNMENT bytes after its header */
+struct _GjsArenaChunk {
+    GjsArenaChunk *next;
+};
+
+#define ALIGN_UP(size) (((size) + GJS_ARENA_ALIGNMENT - 1) & ~((gsize) GJS_ARENA_ALIGNMENT - 1))
+
+void
+gjs_arena_init(GjsArena *arena)
+{
+    /* The inline block is only as aligned as the GjsArena itself */
+    arena->pos = (char *) GSIZE_TO_POINTER(ALIGN_UP(GPOINTER_TO_SIZE(arena->inline_block.data)));
+    arena->end = arena->inline_block.data + GJS_ARENA_INLINE_SIZE;
+    arena->chunks = NULL;
+}
+
+gpointer
+gjs_arena_alloc(GjsArena *arena,
+                gsize     size)
+{
+    GjsArenaChunk *chunk;
+    gsize chunk_size;
+    char *ret;
+
+    size = ALIGN_UP(size);
+
+    if (G_LIKELY(size <= (gsize) (arena->end - arena->pos))) {
+        ret = arena->pos;
+        arena->pos += size;
+        return ret;
+    }
+
+    /* Large requests get a chunk of their own, so that they don't
+     * waste what is left of the current one */
+    chunk_size = MAX(size, GJS_ARENA_CHUNK_SIZE);
+    chunk = (GjsArenaChunk *) g_malloc(GJS_ARENA_ALIGNMENT + chunk_size);
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+
+    ret = (char *) chunk + GJS_ARENA_ALIGNMENT;
+    if (chunk_size > size) {
+        arena->pos = ret + size;
+        arena->end = ret + chunk_size;
+    }
+    return ret;
+}
+
+gpointer
+gjs_arena_alloc0(GjsArena *arena,
+                 gsize     size)
+{
+    gpointer ret = gjs_arena_alloc(arena, size);
+
+    memset(ret, 0, size);
+    return ret;
+}
+
+void
+gjs_arena_clear(GjsArena *arena)
+{
+    GjsArenaChunk *chunk, *next;
+
+    for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        g_free(chunk);
+    }
+
+    gjs_arena_init(arena);
+}
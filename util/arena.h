@@ -0,0 +1,63 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef __GJS_UTIL_ARENA_H__
+#define __GJS_UTIL_ARENA_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Bump allocator for short-lived temporaries that are all freed at
+ * once. The first GJS_ARENA_INLINE_SIZE bytes come from the GjsArena
+ * itself, so an arena on the stack does not touch malloc at all unless
+ * it overflows. Nothing allocated from it may be freed individually.
+ */
+
+#define GJS_ARENA_INLINE_SIZE 512
+
+/* Every allocation is aligned to this, enough for SIMD types */
+#define GJS_ARENA_ALIGNMENT 16
+
+typedef struct _GjsArenaChunk GjsArenaChunk;
+typedef struct _GjsArena GjsArena;
+
+struct _GjsArena {
+    char *pos;
+    char *end;
+    GjsArenaChunk *chunks;  /* overflow chunks, most recent first */
+    union {
+        char data[GJS_ARENA_INLINE_SIZE];
+        gint64 align_int;
+        double align_double;
+        gpointer align_pointer;
+    } inline_block;
+};
+
+void     gjs_arena_init   (GjsArena *arena);
+gpointer gjs_arena_alloc  (GjsArena *arena,
+                           gsize     size);
+gpointer gjs_arena_alloc0 (GjsArena *arena,
+                           gsize     size);
+void     gjs_arena_clear  (GjsArena *arena);
+
+G_END_DECLS
+
+#endif  /* __GJS_UTIL_ARENA_H__ */